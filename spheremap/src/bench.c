@@ -0,0 +1,1260 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file bench.c
+ * @brief Benchmarks for the projection math, mesh generation and remap.
+ *
+ * Inputs are generated from fixed seeds and every figure is the best of
+ * -n runs. With -J the results are also written as JSON, one record per
+ * measurement, for tracking regressions; "make bench" writes bench.json.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "lens_kernel.h"
+#include "lenscurve.h"
+#include "madoka.h"
+#include "mesh.h"
+#include "remap.h"
+#include "pool.h"
+#include "tilesrc.h"
+#include "lut.h"
+
+static FILE * s_json = NULL;
+static int32_t s_nrecords = 0;
+
+/**
+ * Append one result to the JSON output; fmt gives the fields after
+ * "bench", without braces.
+ */
+static void
+json_record(const char * bench, const char * fmt, ...)
+{
+	va_list ap;
+
+	if (s_json == NULL) {
+		return;
+	}
+
+	fprintf(s_json, "%s\n    {\"bench\": \"%s\", ", (s_nrecords > 0) ? "," : "", bench);
+	va_start(ap, fmt);
+	vfprintf(s_json, fmt, ap);
+	va_end(ap);
+	fputc('}', s_json);
+	s_nrecords++;
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void
+fill_pattern(image_t * img)
+{
+	uint32_t s = 0x12345678u;
+	int32_t x, y;
+
+	for (y=0; y<img->height; y++) {
+		uint8_t * row = img->pixels + (size_t)y*img->stride;
+		for (x=0; x<img->width*img->channels; x++) {
+			s = s*1664525u + 1013904223u;
+			row[x] = (uint8_t)(s >> 24);
+		}
+	}
+}
+
+/**
+ * Feed every kernel random coordinates, including ones at and beyond the
+ * image border, and compare against the scalar sampler. The fixed-point
+ * kernels get the same coordinates through remap_quantize_row().
+ */
+static int
+verify_kernels(int32_t channels)
+{
+	static const remap_isa_t isas[] = {REMAP_ISA_SCALAR, REMAP_ISA_SSE41, REMAP_ISA_AVX2};
+	const int32_t n = 4099;
+	image_t src;
+	float * sxy;
+	int16_t * ixy;
+	uint16_t * frac;
+	uint8_t * ref;
+	uint8_t * out;
+	uint32_t s = 0xdeadbeefu;
+	size_t i;
+	int32_t k;
+	int rc = 0;
+
+	if (image_alloc(&src, 37, 23, channels) < 0) {
+		return -1;
+	}
+	fill_pattern(&src);
+
+	sxy = malloc(sizeof(float)*2*n);
+	ixy = malloc(sizeof(int16_t)*2*n);
+	frac = malloc(sizeof(uint16_t)*n);
+	ref = malloc((size_t)n*channels);
+	out = malloc((size_t)n*channels);
+	if (sxy == NULL || ixy == NULL || frac == NULL || ref == NULL || out == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	for (k=0; k<2*n; k++) {
+		s = s*1664525u + 1013904223u;
+		sxy[k] = ((float)(s >> 8)/(float)(1 << 24))*44.0f - 4.0f;
+		if ((s & 0x70) == 0) {
+			/* exact integer positions, including the last row and column */
+			sxy[k] = (float)((s >> 8) % 40);
+		}
+	}
+
+	remap_quantize_row(ixy, frac, sxy, n, src.width, src.height);
+
+	remap_select_isa(REMAP_ISA_SCALAR);
+	remap_sample_row(ref, &src, sxy, n);
+
+	for (i=0; i<sizeof(isas)/sizeof(isas[0]); i++) {
+		if (remap_select_isa(isas[i]) != isas[i]) {
+			continue;
+		}
+		if (i > 0) {
+			memset(out, 0x5a, (size_t)n*channels);
+			remap_sample_row(out, &src, sxy, n);
+			if (memcmp(ref, out, (size_t)n*channels) != 0) {
+				printf("verify %-6s ch=%d  MISMATCH against scalar\n", remap_isa_name(isas[i]), channels);
+				rc = -1;
+			}
+		}
+		memset(out, 0x5a, (size_t)n*channels);
+		remap_sample_row_fixed(out, &src, ixy, frac, n);
+		if (memcmp(ref, out, (size_t)n*channels) != 0) {
+			printf("verify %-6s fixed ch=%d  MISMATCH against scalar\n", remap_isa_name(isas[i]), channels);
+			rc = -1;
+		}
+	}
+	remap_select_isa(REMAP_ISA_AUTO);
+	json_record("verify", "\"channels\": %d, \"ok\": %s", channels, (rc == 0) ? "true" : "false");
+
+	free(out);
+	free(ref);
+	free(frac);
+	free(ixy);
+	free(sxy);
+	image_free(&src);
+
+	return rc;
+}
+
+/**
+ * Best-of-n wall time of one full-frame remap with the given kernel.
+ */
+static double
+time_remap(image_t * dst, const image_t * src, const remap_lut_t * lut, pool_t * pool, int32_t iters)
+{
+	double best = 1e30;
+	int32_t i;
+
+	for (i=0; i<iters; i++) {
+		double t0 = now_sec( );
+		remap_lut_apply(dst, src, lut, pool);
+		double t1 = now_sec( );
+		if (t1 - t0 < best) {
+			best = t1 - t0;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * A table that walks the source row by row at a fixed sub-pixel offset,
+ * laid out like remap_lut_build() output so remap_lut_free() can
+ * release it. Kernels run it with every fetch in cache, which leaves
+ * only their own instruction cost.
+ */
+static int
+sequential_lut(remap_lut_t * lut, remap_lut_format_t format, int32_t width, int32_t height)
+{
+	size_t n = (size_t)width*height;
+	float * sxy = malloc(2*sizeof(float)*n);
+	int16_t * ixy;
+	int32_t x, y;
+
+	if (sxy == NULL) {
+		fprintf(stderr, "Failed to allocate memory for the sequential table\n");
+		return -1;
+	}
+	for (y=0; y<height; y++) {
+		for (x=0; x<width; x++) {
+			sxy[2*((size_t)y*width + x)] = (float)x + 0.3f;
+			sxy[2*((size_t)y*width + x) + 1] = (float)y + 0.6f;
+		}
+	}
+
+	memset(lut, 0, sizeof(*lut));
+	lut->width = width;
+	lut->height = height;
+	lut->src_width = width + 1;
+	lut->src_height = height + 1;
+	lut->format = format;
+	if (format == REMAP_LUT_FLOAT) {
+		lut->sxy = sxy;
+		return 0;
+	}
+
+	ixy = malloc((2*sizeof(int16_t) + sizeof(uint16_t))*n);
+	if (ixy == NULL) {
+		fprintf(stderr, "Failed to allocate memory for the sequential table\n");
+		free(sxy);
+		return -1;
+	}
+	for (y=0; y<height; y++) {
+		remap_quantize_row(ixy + 2*(size_t)y*width, (uint16_t *)(ixy + 2*n) + (size_t)y*width,
+						   sxy + 2*(size_t)y*width, width, width + 1, height + 1);
+	}
+	free(sxy);
+	lut->ixy = ixy;
+	lut->frac = (const uint16_t *)(ixy + 2*n);
+
+	return 0;
+}
+
+/**
+ * Full-frame remap with each kernel, against the scalar kernel of the
+ * same table format. Every case is also timed on a sequential table,
+ * and bench.json records whether it reaches 4x and, when not, what
+ * holds it back: "kernel" when it misses even with every fetch in
+ * cache, "source_access" when only the lens table's scattered fetches
+ * keep it below.
+ */
+static int
+bench_remap(int32_t channels, int32_t iters)
+{
+	static const remap_isa_t isas[] = {REMAP_ISA_SCALAR, REMAP_ISA_SSE41, REMAP_ISA_AVX2};
+	lens_param_t lens = {LENS_EQUIDISTANT, 1900.0, {12.5, -7.25}};
+	view_param_t view = {20.0, -10.0, 90.0, 3840, 2160, VIEW_RECTILINEAR};
+	image_t src, seq_src, ref, dst;
+	remap_lut_t luts[2];
+	remap_lut_t seq[2];
+	double t_scalar[2] = {0.0, 0.0};
+	double t_seq_scalar[2] = {0.0, 0.0};
+	size_t i;
+	int32_t f;
+	int rc = 0;
+
+	if (image_alloc(&src, 3840, 3840, channels) < 0 ||
+		image_alloc(&seq_src, view.width + 1, view.height + 1, channels) < 0 ||
+		image_alloc(&ref, view.width, view.height, channels) < 0 ||
+		image_alloc(&dst, view.width, view.height, channels) < 0) {
+		return -1;
+	}
+	fill_pattern(&src);
+	fill_pattern(&seq_src);
+
+	if (remap_lut_build(&luts[0], NULL, REMAP_LUT_FLOAT, &lens, &view, src.width, src.height) < 0 ||
+		remap_lut_build(&luts[1], NULL, REMAP_LUT_FIXED, &lens, &view, src.width, src.height) < 0 ||
+		sequential_lut(&seq[0], REMAP_LUT_FLOAT, view.width, view.height) < 0 ||
+		sequential_lut(&seq[1], REMAP_LUT_FIXED, view.width, view.height) < 0) {
+		return -1;
+	}
+
+	for (i=0; i<sizeof(isas)/sizeof(isas[0]); i++) {
+		remap_isa_t sel = remap_select_isa(isas[i]);
+
+		if (sel != isas[i]) {
+			printf("remap %-6s ch=%d  not supported on this CPU\n", remap_isa_name(isas[i]), channels);
+			continue;
+		}
+
+		for (f=0; f<2; f++) {
+			int32_t first = (i == 0 && f == 0);
+			double t = time_remap(first ? &ref : &dst, &src, &luts[f], NULL, iters);
+			double t_seq;
+			double speedup, seq_speedup;
+			const char * limit;
+
+			if (!first && memcmp(ref.pixels, dst.pixels, (size_t)dst.height*dst.stride) != 0) {
+				printf("remap %-6s %-5s ch=%d  MISMATCH against scalar\n",
+					   remap_isa_name(sel), (f == 0) ? "float" : "fixed", channels);
+				rc = -1;
+			}
+			t_seq = time_remap(&dst, &seq_src, &seq[f], NULL, iters);
+			if (i == 0) {
+				t_scalar[f] = t;
+				t_seq_scalar[f] = t_seq;
+			}
+			speedup = t_scalar[f]/t;
+			seq_speedup = t_seq_scalar[f]/t_seq;
+			if (i == 0) {
+				limit = "baseline";
+			}
+			else if (speedup >= 4.0) {
+				limit = "none";
+			}
+			else if (seq_speedup < 4.0) {
+				limit = "kernel";
+			}
+			else {
+				limit = "source_access";
+			}
+
+			printf("remap %-6s %-5s ch=%d  %8.2f ms  %8.1f Mpix/s  x%.2f  (sequential x%.2f)\n",
+				   remap_isa_name(sel), (f == 0) ? "float" : "fixed", channels, t*1e3,
+				   view.width*view.height/t*1e-6, speedup, seq_speedup);
+			json_record("remap_kernel",
+						"\"isa\": \"%s\", \"format\": \"%s\", \"channels\": %d, "
+						"\"width\": %d, \"height\": %d, \"ms\": %.3f, \"mpix_per_s\": %.2f, "
+						"\"speedup\": %.3f, \"sequential_speedup\": %.3f, \"meets_4x\": %s, "
+						"\"limit\": \"%s\"",
+						remap_isa_name(sel), (f == 0) ? "float" : "fixed", channels,
+						view.width, view.height, t*1e3, view.width*view.height/t*1e-6,
+						speedup, seq_speedup, (speedup >= 4.0) ? "true" : "false", limit);
+		}
+	}
+	remap_select_isa(REMAP_ISA_AUTO);
+
+	remap_lut_free(&seq[1]);
+	remap_lut_free(&seq[0]);
+	remap_lut_free(&luts[1]);
+	remap_lut_free(&luts[0]);
+	image_free(&dst);
+	image_free(&ref);
+	image_free(&seq_src);
+	image_free(&src);
+
+	return rc;
+}
+
+static int64_t
+ulp_diff(double a, double b)
+{
+	int64_t ia, ib;
+	memcpy(&ia, &a, sizeof(ia));
+	memcpy(&ib, &b, sizeof(ib));
+	return (ia > ib) ? ia - ib : ib - ia;
+}
+
+/**
+ * madoka_theta_to_radius() one call at a time against the array form,
+ * over random (unpredictable segments) and sorted angles.
+ */
+static int
+bench_madoka(int32_t iters)
+{
+	const int32_t n = 1 << 20;
+	double * th = malloc(sizeof(double)*n);
+	double * ref = malloc(sizeof(double)*n);
+	double * out = malloc(sizeof(double)*n);
+	uint32_t s = 0x2468aceu;
+	int32_t pass;
+	int32_t i, k;
+
+	if (th == NULL || ref == NULL || out == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	for (pass=0; pass<2; pass++) {
+		double t_scalar = 1e30;
+		double t_array = 1e30;
+		int64_t maxulp = 0;
+
+		for (i=0; i<n; i++) {
+			s = s*1664525u + 1013904223u;
+			th[i] = (pass == 0) ? (s >> 8)*(0.5*M_PI/(1 << 24)) : (i + 0.5)*(0.5*M_PI/n);
+		}
+
+		for (k=0; k<iters; k++) {
+			double t0 = now_sec( );
+			for (i=0; i<n; i++) {
+				ref[i] = madoka_theta_to_radius(th[i]);
+			}
+			double t1 = now_sec( );
+			madoka_theta_to_radius_array(th, out, n);
+			double t2 = now_sec( );
+			if (t1 - t0 < t_scalar) {
+				t_scalar = t1 - t0;
+			}
+			if (t2 - t1 < t_array) {
+				t_array = t2 - t1;
+			}
+		}
+
+		for (i=0; i<n; i++) {
+			int64_t d = ulp_diff(ref[i], out[i]);
+			if (d > maxulp) {
+				maxulp = d;
+			}
+		}
+
+		printf("madoka %-6s  scalar %6.2f ns  array %6.2f ns  x%.2f  max %lld ulp\n",
+			   (pass == 0) ? "random" : "sorted", t_scalar/n*1e9, t_array/n*1e9,
+			   t_scalar/t_array, (long long)maxulp);
+		json_record("madoka", "\"angles\": \"%s\", \"scalar_ns\": %.3f, \"array_ns\": %.3f, \"max_ulp\": %lld",
+					(pass == 0) ? "random" : "sorted", t_scalar/n*1e9, t_array/n*1e9, (long long)maxulp);
+	}
+
+	free(out);
+	free(ref);
+	free(th);
+
+	return 0;
+}
+
+/**
+ * Reference inverse: bisection on madoka_theta_to_radius().
+ */
+static double
+madoka_inverse_bisect(double r)
+{
+	double lo = 0.0;
+	double hi = 0.55*M_PI;
+	int32_t i;
+
+	for (i=0; i<52; i++) {
+		double m = 0.5*(lo + hi);
+		if (madoka_theta_to_radius(m) < r) {
+			lo = m;
+		}
+		else {
+			hi = m;
+		}
+	}
+
+	return 0.5*(lo + hi);
+}
+
+/**
+ * madoka_radius_to_theta() against a per-call root solve, with the
+ * round-trip residual |r(theta(r)) - r| over the image circle.
+ */
+static int
+bench_madoka_inverse(int32_t iters)
+{
+	const int32_t n = 1 << 20;
+	const int32_t nref = 1 << 14;
+	double * r = malloc(sizeof(double)*n);
+	double * ref = malloc(sizeof(double)*n);
+	double * out = malloc(sizeof(double)*n);
+	double t_bisect = 1e30;
+	double t_scalar = 1e30;
+	double t_array = 1e30;
+	double maxres = 0.0;
+	int64_t maxulp = 0;
+	uint32_t s = 0x13579bdu;
+	int32_t i, k;
+
+	if (r == NULL || ref == NULL || out == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	for (i=0; i<n; i++) {
+		s = s*1664525u + 1013904223u;
+		r[i] = madoka_theta_to_radius((s >> 8)*(0.5*M_PI/(1 << 24)));
+	}
+
+	for (k=0; k<iters; k++) {
+		double t0 = now_sec( );
+		for (i=0; i<nref; i++) {
+			out[i] = madoka_inverse_bisect(r[i]);
+		}
+		double t1 = now_sec( );
+		for (i=0; i<n; i++) {
+			ref[i] = madoka_radius_to_theta(r[i]);
+		}
+		double t2 = now_sec( );
+		madoka_radius_to_theta_array(r, out, n);
+		double t3 = now_sec( );
+		if ((t1 - t0)*(n/nref) < t_bisect) {
+			t_bisect = (t1 - t0)*(n/nref);
+		}
+		if (t2 - t1 < t_scalar) {
+			t_scalar = t2 - t1;
+		}
+		if (t3 - t2 < t_array) {
+			t_array = t3 - t2;
+		}
+	}
+
+	for (i=0; i<n; i++) {
+		int64_t d = ulp_diff(ref[i], out[i]);
+		double res = fabs(madoka_theta_to_radius(out[i]) - r[i]);
+		if (d > maxulp) {
+			maxulp = d;
+		}
+		if (res > maxres) {
+			maxres = res;
+		}
+	}
+
+	printf("madoka inverse  bisect %6.2f ns  scalar %6.2f ns  array %6.2f ns  max %lld ulp  residual %.2g\n",
+		   t_bisect/n*1e9, t_scalar/n*1e9, t_array/n*1e9, (long long)maxulp, maxres);
+	json_record("madoka_inverse",
+				"\"bisect_ns\": %.3f, \"scalar_ns\": %.3f, \"array_ns\": %.3f, \"max_ulp\": %lld, \"residual\": %.3g",
+				t_bisect/n*1e9, t_scalar/n*1e9, t_array/n*1e9, (long long)maxulp, maxres);
+
+	free(out);
+	free(ref);
+	free(r);
+
+	return 0;
+}
+
+/**
+ * The MADOKA model as a lens curve sampled every 2 degrees, against the
+ * compiled-in table: deviation and cost of the forward and inverse maps
+ * over random angles in [0, pi/2). Leaves the curve installed for the
+ * benchmarks after it.
+ */
+static int
+bench_lens_curve(int32_t iters)
+{
+	const int32_t n = 1 << 20;
+	double st[48], sr[48];
+	double * th = malloc(sizeof(double)*n);
+	double * r = malloc(sizeof(double)*n);
+	double * out = malloc(sizeof(double)*n);
+	double t_madoka = 1e30, t_curve = 1e30;
+	double t_madoka_inv = 1e30, t_curve_inv = 1e30;
+	double err = 0.0, err_inv = 0.0;
+	uint32_t s = 0x13579bdu;
+	int32_t i, k;
+
+	if (th == NULL || r == NULL || out == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(th);
+		free(r);
+		free(out);
+		return -1;
+	}
+
+	for (i=0; i<48; i++) {
+		st[i] = (i + 1) * (M_PI/90.0);
+		sr[i] = madoka_theta_to_radius(st[i]);
+	}
+	if (lens_curve_from_samples(st, sr, 48) < 0) {
+		free(th);
+		free(r);
+		free(out);
+		return -1;
+	}
+
+	for (i=0; i<n; i++) {
+		s = s*1664525u + 1013904223u;
+		th[i] = (s >> 8)*(0.5*M_PI/(1 << 24));
+		r[i] = madoka_theta_to_radius(th[i]);
+	}
+
+	for (k=0; k<iters; k++) {
+		double t0 = now_sec( );
+		madoka_theta_to_radius_array(th, out, n);
+		double t1 = now_sec( );
+		lens_curve_theta_to_radius_array(th, out, n);
+		double t2 = now_sec( );
+		madoka_radius_to_theta_array(r, out, n);
+		double t3 = now_sec( );
+		lens_curve_radius_to_theta_array(r, out, n);
+		double t4 = now_sec( );
+		t_madoka = (t1 - t0 < t_madoka) ? t1 - t0 : t_madoka;
+		t_curve = (t2 - t1 < t_curve) ? t2 - t1 : t_curve;
+		t_madoka_inv = (t3 - t2 < t_madoka_inv) ? t3 - t2 : t_madoka_inv;
+		t_curve_inv = (t4 - t3 < t_curve_inv) ? t4 - t3 : t_curve_inv;
+	}
+
+	for (i=0; i<n; i++) {
+		double e = fabs(lens_curve_theta_to_radius(th[i]) - r[i]);
+		double ei = fabs(lens_curve_radius_to_theta(r[i]) - th[i]);
+		err = (e > err) ? e : err;
+		err_inv = (ei > err_inv) ? ei : err_inv;
+	}
+
+	printf("lens curve  forward %6.2f ns (madoka %6.2f ns)  inverse %6.2f ns (madoka %6.2f ns)"
+		   "  max dev %.2g  inverse %.2g rad\n",
+		   t_curve/n*1e9, t_madoka/n*1e9, t_curve_inv/n*1e9, t_madoka_inv/n*1e9, err, err_inv);
+	json_record("lens_curve",
+				"\"forward_ns\": %.3f, \"madoka_ns\": %.3f, \"inverse_ns\": %.3f, "
+				"\"madoka_inverse_ns\": %.3f, \"max_dev\": %.3g, \"max_dev_inverse\": %.3g",
+				t_curve/n*1e9, t_madoka/n*1e9, t_curve_inv/n*1e9, t_madoka_inv/n*1e9, err, err_inv);
+
+	free(out);
+	free(r);
+	free(th);
+
+	return 0;
+}
+
+/**
+ * lens_theta_to_radius() for every lens model, one call at a time and
+ * through the array form, over random angles in [0, pi/2).
+ */
+static int
+bench_projections(int32_t iters)
+{
+	static const lens_type_t types[] = {
+		LENS_STEREOGRAPHIC, LENS_EQUIDISTANT, LENS_EQUISOLID,
+		LENS_ORTHOGONAL, LENS_MADOKA, LENS_CURVE,
+	};
+	const int32_t n = 1 << 18;
+	double * th = malloc(sizeof(double)*n);
+	double * out = malloc(sizeof(double)*n);
+	uint32_t s = 0x0badcafeu;
+	volatile double sink = 0.0;
+	size_t t;
+	int32_t i, k;
+
+	if (th == NULL || out == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	for (i=0; i<n; i++) {
+		s = s*1664525u + 1013904223u;
+		th[i] = (s >> 8)*(0.5*M_PI/(1 << 24));
+	}
+
+	for (t=0; t<sizeof(types)/sizeof(types[0]); t++) {
+		double t_scalar = 1e30;
+		double t_array = 1e30;
+
+		for (k=0; k<iters; k++) {
+			double acc = 0.0;
+			double t0 = now_sec( );
+			for (i=0; i<n; i++) {
+				acc += lens_theta_to_radius(types[t], th[i]);
+			}
+			double t1 = now_sec( );
+			lens_theta_to_radius_array(types[t], th, out, n);
+			double t2 = now_sec( );
+			sink += acc + out[k];
+			if (t1 - t0 < t_scalar) {
+				t_scalar = t1 - t0;
+			}
+			if (t2 - t1 < t_array) {
+				t_array = t2 - t1;
+			}
+		}
+
+		printf("projection %-13s  scalar %6.2f ns  array %6.2f ns\n",
+			   lens_type_name(types[t]), t_scalar/n*1e9, t_array/n*1e9);
+		json_record("projection", "\"lens\": \"%s\", \"scalar_ns\": %.3f, \"array_ns\": %.3f",
+					lens_type_name(types[t]), t_scalar/n*1e9, t_array/n*1e9);
+	}
+
+	free(out);
+	free(th);
+
+	return 0;
+}
+
+/**
+ * Projection of rays as remap_project_row() did it before the span
+ * kernels (atan2, then lens_theta_to_radius_array()) against the
+ * generic build of each kernel and the one lens_span_kernel() picks for
+ * this CPU, over random rays of the front hemisphere at random scale.
+ */
+static int
+bench_span_kernels(int32_t iters)
+{
+	static const lens_type_t types[] = {
+		LENS_STEREOGRAPHIC, LENS_EQUIDISTANT, LENS_EQUISOLID,
+		LENS_ORTHOGONAL, LENS_MADOKA, LENS_CURVE,
+	};
+	static const lens_span_fn_t generic[] = {
+		lens_span_stereographic_c, lens_span_equidistant_c, lens_span_equisolid_c,
+		lens_span_orthogonal_c, NULL, NULL,
+	};
+	const int32_t n = 1 << 16;
+	double * rho = malloc(sizeof(double)*n);
+	double * z = malloc(sizeof(double)*n);
+	double * th = malloc(sizeof(double)*n);
+	double * ref = malloc(sizeof(double)*n);
+	double * out = malloc(sizeof(double)*n);
+	uint32_t s = 0x5eed1e55u;
+	size_t t;
+	int32_t i, k;
+
+	if (rho == NULL || z == NULL || th == NULL || ref == NULL || out == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(rho);
+		free(z);
+		free(th);
+		free(ref);
+		free(out);
+		return -1;
+	}
+
+	for (i=0; i<n; i++) {
+		double a, l;
+		s = s*1664525u + 1013904223u;
+		a = (s >> 8)*(0.5*M_PI/(1 << 24));
+		s = s*1664525u + 1013904223u;
+		l = 0.5 + (s >> 8)*(1.5/(1 << 24));
+		rho[i] = sin(a)*l;
+		z[i] = cos(a)*l;
+	}
+
+	for (t=0; t<sizeof(types)/sizeof(types[0]); t++) {
+		lens_span_fn_t fn = lens_span_kernel(types[t]);
+		double t_old = 1e30, t_c = 1e30, t_best = 1e30;
+		double dev = 0.0;
+
+		for (k=0; k<iters; k++) {
+			double t0 = now_sec( );
+			for (i=0; i<n; i++) {
+				th[i] = atan2(rho[i], z[i]);
+			}
+			lens_theta_to_radius_array(types[t], th, ref, n);
+			double t1 = now_sec( );
+			if (generic[t] != NULL) {
+				generic[t](rho, z, out, n);
+			}
+			double t2 = now_sec( );
+			fn(rho, z, out, n);
+			double t3 = now_sec( );
+			t_old = (t1 - t0 < t_old) ? t1 - t0 : t_old;
+			t_c = (t2 - t1 < t_c) ? t2 - t1 : t_c;
+			t_best = (t3 - t2 < t_best) ? t3 - t2 : t_best;
+		}
+		for (i=0; i<n; i++) {
+			double d = fabs(out[i] - ref[i]);
+			dev = (d > dev) ? d : dev;
+		}
+		if (generic[t] == NULL) {
+			t_c = t_best;
+		}
+
+		printf("span %-13s  atan2+array %6.2f ns  generic %6.2f ns  %s %6.2f ns  x%.2f  max dev %.2g\n",
+			   lens_type_name(types[t]), t_old/n*1e9, t_c/n*1e9,
+			   remap_isa_name(remap_select_isa(REMAP_ISA_AUTO)), t_best/n*1e9, t_old/t_best, dev);
+		json_record("span_kernel",
+					"\"lens\": \"%s\", \"atan2_array_ns\": %.3f, \"generic_ns\": %.3f, "
+					"\"dispatched_ns\": %.3f, \"max_dev\": %.3g",
+					lens_type_name(types[t]), t_old/n*1e9, t_c/n*1e9, t_best/n*1e9, dev);
+	}
+
+	free(out);
+	free(ref);
+	free(th);
+	free(z);
+	free(rho);
+
+	return 0;
+}
+
+/**
+ * Mesh generation at increasing tessellation levels, starting from the
+ * viewer's default: building the geometry, update_sphere_object() after
+ * a lens type change and after a center/radius change, and the
+ * wireframe.
+ */
+static int
+bench_mesh(int32_t iters)
+{
+	static const lens_type_t types[] = {LENS_EQUIDISTANT, LENS_MADOKA};
+	static const int32_t levels[][2] = {
+		{NDIV_V, NDIV_H}, {2*NDIV_V, 2*NDIV_H}, {4*NDIV_V, 4*NDIV_H}, {8*NDIV_V, 8*NDIV_H},
+	};
+	size_t l, t;
+	int32_t k;
+
+	for (l=0; l<sizeof(levels)/sizeof(levels[0]); l++) {
+		sphere_mesh_t sphere;
+		wireframe_mesh_t wf;
+		double t_geom = 1e30;
+		double t_wf = 1e30;
+		int32_t strip_vertices;
+		size_t strip_bytes;
+
+		for (k=0; k<iters; k++) {
+			double t0 = now_sec( );
+			if (alloc_sphere_object(&sphere, levels[l][0], levels[l][1]) < 0) {
+				return -1;
+			}
+			double t1 = now_sec( );
+			if (t1 - t0 < t_geom) {
+				t_geom = t1 - t0;
+			}
+			if (k < iters-1) {
+				free_sphere_object(&sphere);
+			}
+		}
+		/* the same triangles as one strip per ring and sector, with
+		 * double positions, coords and directions per strip vertex */
+		strip_vertices = sphere.nindices/3 + 2*levels[l][0]*levels[l][1];
+		strip_bytes = strip_vertices*(sizeof(vec3_t) + 2*sizeof(vec2_t) + sizeof(int32_t));
+		printf("mesh %4dx%-3d %-11s  %7d vertices  %9.1f us  %8zu bytes"
+			   "  (strips: %7d vertices %8zu bytes)\n",
+			   levels[l][0], levels[l][1], "geometry", sphere.nvertices, t_geom*1e6,
+			   sphere_object_bytes(&sphere), strip_vertices, strip_bytes);
+		json_record("mesh_geometry", "\"ndiv_v\": %d, \"ndiv_h\": %d, \"vertices\": %d, "
+					"\"indices\": %d, \"bytes\": %zu, \"strip_vertices\": %d, \"strip_bytes\": %zu, "
+					"\"us\": %.3f",
+					levels[l][0], levels[l][1], sphere.nvertices, sphere.nindices,
+					sphere_object_bytes(&sphere), strip_vertices, strip_bytes, t_geom*1e6);
+
+		for (t=0; t<sizeof(types)/sizeof(types[0]); t++) {
+			lens_param_t lens = {types[t], 1024.0, {3.0, -2.0}};
+			lens_param_t other = lens;
+			double t_type = 1e30;
+			double t_affine = 1e30;
+
+			other.type = types[(t + 1) % (sizeof(types)/sizeof(types[0]))];
+			for (k=0; k<iters; k++) {
+				update_sphere_object(&sphere, &other);
+				double t0 = now_sec( );
+				update_sphere_object(&sphere, &lens);
+				double t1 = now_sec( );
+				lens.center.x += 1.0;
+				update_sphere_object(&sphere, &lens);
+				double t2 = now_sec( );
+				if (t1 - t0 < t_type) {
+					t_type = t1 - t0;
+				}
+				if (t2 - t1 < t_affine) {
+					t_affine = t2 - t1;
+				}
+			}
+
+			printf("mesh %4dx%-3d %-11s  %7d vertices  %9.1f us  (center/r only %9.1f us)\n",
+				   levels[l][0], levels[l][1], lens_type_name(types[t]),
+				   sphere.nvertices, t_type*1e6, t_affine*1e6);
+			json_record("mesh", "\"ndiv_v\": %d, \"ndiv_h\": %d, \"lens\": \"%s\", "
+						"\"vertices\": %d, \"us\": %.3f, \"affine_us\": %.3f",
+						levels[l][0], levels[l][1], lens_type_name(types[t]),
+						sphere.nvertices, t_type*1e6, t_affine*1e6);
+		}
+		for (k=0; k<iters; k++) {
+			double t0 = now_sec( );
+			if (alloc_sphere_wireframe(&wf, &sphere) < 0) {
+				return -1;
+			}
+			double t1 = now_sec( );
+			if (t1 - t0 < t_wf) {
+				t_wf = t1 - t0;
+			}
+			if (k < iters-1) {
+				free_sphere_wireframe(&wf);
+			}
+		}
+		printf("mesh %4dx%-3d %-11s  %7d edges     %9.1f us\n",
+			   levels[l][0], levels[l][1], "wireframe", wf.nindices/2, t_wf*1e6);
+		json_record("mesh", "\"ndiv_v\": %d, \"ndiv_h\": %d, \"lens\": \"wireframe\", "
+					"\"edges\": %d, \"us\": %.3f",
+					levels[l][0], levels[l][1], wf.nindices/2, t_wf*1e6);
+		free_sphere_wireframe(&wf);
+		free_sphere_object(&sphere);
+	}
+
+	return 0;
+}
+
+/**
+ * Error in pixels of the uniform 2k x k mesh for the lens, and its
+ * vertex count in @a nvertices.
+ */
+static double
+uniform_mesh_error(const lens_param_t * lens, int32_t k, int32_t * nvertices)
+{
+	sphere_mesh_t sphere;
+	double err;
+
+	if (alloc_sphere_object(&sphere, 2*k, k) < 0) {
+		return -1.0;
+	}
+	update_sphere_object(&sphere, lens);
+	err = sphere_object_error(&sphere, lens);
+	*nvertices = sphere.nvertices;
+	free_sphere_object(&sphere);
+
+	return err;
+}
+
+/**
+ * Adaptive tessellation against the smallest uniform mesh, in the
+ * viewer's 2:1 ring to sector ratio, that meets the same error bound.
+ */
+static int
+bench_mesh_adaptive(int32_t iters)
+{
+	static const lens_type_t types[] = {
+		LENS_STEREOGRAPHIC, LENS_EQUIDISTANT, LENS_EQUISOLID, LENS_ORTHOGONAL, LENS_MADOKA,
+	};
+	static const double tols[] = {1.0, 0.5, 0.25};
+	size_t t, e;
+	int32_t k;
+
+	for (t=0; t<sizeof(types)/sizeof(types[0]); t++) {
+		lens_param_t lens = {types[t], 1024.0, {0.0, 0.0}};
+
+		for (e=0; e<sizeof(tols)/sizeof(tols[0]); e++) {
+			sphere_mesh_t sphere;
+			double t_plan = 1e30;
+			double err;
+			double u_err;
+			int32_t u_vertices = 0;
+			int32_t lo = 1;
+			int32_t hi = 1;
+
+			for (k=0; k<iters; k++) {
+				double t0 = now_sec( );
+				if (alloc_sphere_object_adaptive(&sphere, &lens, tols[e]) < 0) {
+					return -1;
+				}
+				double t1 = now_sec( );
+				if (t1 - t0 < t_plan) {
+					t_plan = t1 - t0;
+				}
+				if (k < iters-1) {
+					free_sphere_object(&sphere);
+				}
+			}
+			err = sphere_object_error(&sphere, &lens);
+
+			/* smallest k with the 2k x k mesh within the bound */
+			while ((u_err = uniform_mesh_error(&lens, hi, &u_vertices)) > tols[e]) {
+				if (u_err < 0.0) {
+					return -1;
+				}
+				lo = hi;
+				hi *= 2;
+			}
+			while (hi - lo > 1) {
+				int32_t mid = (lo + hi) / 2;
+				if (uniform_mesh_error(&lens, mid, &u_vertices) > tols[e]) {
+					lo = mid;
+				}
+				else {
+					hi = mid;
+				}
+			}
+			u_err = uniform_mesh_error(&lens, hi, &u_vertices);
+
+			printf("mesh adaptive %-13s  tol %4.2f px  %3dx%-3d %6d vertices  err %5.3f  %7.1f ms"
+				   "  | uniform %3dx%-3d %6d vertices  err %5.3f\n",
+				   lens_type_name(types[t]), tols[e], sphere.ndiv_v, sphere.ndiv_h,
+				   sphere.nvertices, err, t_plan*1e3, 2*hi, hi, u_vertices, u_err);
+			json_record("mesh_adaptive", "\"lens\": \"%s\", \"tol\": %.3f, "
+						"\"ndiv_v\": %d, \"ndiv_h\": %d, \"vertices\": %d, \"err\": %.4f, \"ms\": %.3f, "
+						"\"uniform_ndiv_v\": %d, \"uniform_ndiv_h\": %d, \"uniform_vertices\": %d, "
+						"\"uniform_err\": %.4f",
+						lens_type_name(types[t]), tols[e], sphere.ndiv_v, sphere.ndiv_h,
+						sphere.nvertices, err, t_plan*1e3, 2*hi, hi, u_vertices, u_err);
+			free_sphere_object(&sphere);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Table build (MADOKA, rim-heavy) and tiled remap throughput at several
+ * output resolutions, for thread counts doubling up to maxthreads.
+ */
+static int
+bench_threads(int32_t maxthreads, int32_t iters)
+{
+	static const int32_t sizes[][2] = {{1280, 720}, {1920, 1080}, {3840, 2160}};
+	lens_param_t lens = {LENS_MADOKA, 1900.0, {0.0, 0.0}};
+	image_t src;
+	size_t r;
+
+	if (image_alloc(&src, 3840, 3840, 4) < 0) {
+		return -1;
+	}
+	fill_pattern(&src);
+
+	for (r=0; r<sizeof(sizes)/sizeof(sizes[0]); r++) {
+		view_param_t view = {0.0, 0.0, 120.0, sizes[r][0], sizes[r][1], VIEW_RECTILINEAR};
+		double t_build1 = 0.0;
+		double t_apply1 = 0.0;
+		image_t dst;
+		remap_lut_t lut;
+		int32_t nt;
+
+		if (image_alloc(&dst, view.width, view.height, 4) < 0) {
+			return -1;
+		}
+
+		for (nt=1; nt<=maxthreads; nt*=2) {
+			pool_t * pool = pool_create(nt);
+			double t_build = 1e30;
+			double t_apply;
+			int32_t i;
+
+			if (pool == NULL) {
+				return -1;
+			}
+
+			for (i=0; i<iters; i++) {
+				double t0 = now_sec( );
+				if (remap_lut_build(&lut, pool, REMAP_LUT_FIXED, &lens, &view, src.width, src.height) < 0) {
+					return -1;
+				}
+				double t1 = now_sec( );
+				if (t1 - t0 < t_build) {
+					t_build = t1 - t0;
+				}
+				if (i < iters-1) {
+					remap_lut_free(&lut);
+				}
+			}
+			t_apply = time_remap(&dst, &src, &lut, pool, iters);
+			remap_lut_free(&lut);
+			pool_destroy(pool);
+
+			if (nt == 1) {
+				t_build1 = t_build;
+				t_apply1 = t_apply;
+			}
+			printf("%4dx%-4d threads %2d  build %8.2f ms (x%.2f)  remap %8.2f ms  %8.1f Mpix/s (x%.2f)\n",
+				   view.width, view.height, nt, t_build*1e3, t_build1/t_build, t_apply*1e3,
+				   view.width*view.height/t_apply*1e-6, t_apply1/t_apply);
+			json_record("remap_threads", "\"width\": %d, \"height\": %d, \"threads\": %d, "
+						"\"build_ms\": %.3f, \"remap_ms\": %.3f, \"mpix_per_s\": %.2f",
+						view.width, view.height, nt, t_build*1e3, t_apply*1e3,
+						view.width*view.height/t_apply*1e-6);
+		}
+
+		image_free(&dst);
+	}
+
+	image_free(&src);
+
+	return 0;
+}
+
+typedef struct {
+	const char * name;
+	int32_t side;			/* square source */
+	int32_t channels;
+	double lens_r;
+	double yaw_step;		/* between neighbouring views, degrees */
+} views_case_t;
+
+/**
+ * Eight 1280x720 PTZ views around a ceiling-mounted fisheye, remapped
+ * one remap_lut_apply() after another and in one remap_views_apply()
+ * pass, on one thread and on maxthreads.
+ */
+static int
+bench_views_case(const views_case_t * c, int32_t maxthreads, int32_t iters)
+{
+	enum { NVIEWS = 8 };
+	lens_param_t lens = {LENS_EQUIDISTANT, c->lens_r, {0.0, 0.0}};
+	view_param_t view[NVIEWS];
+	image_t src;
+	image_t ref[NVIEWS];
+	image_t dst[NVIEWS];
+	remap_views_t views;
+	int32_t nthreads[2] = {1, maxthreads};
+	int32_t npix = 0;
+	int32_t r, v;
+	int rc = 0;
+
+	if (image_alloc(&src, c->side, c->side, c->channels) < 0) {
+		return -1;
+	}
+	fill_pattern(&src);
+
+	for (v=0; v<NVIEWS; v++) {
+		view[v].yaw = c->yaw_step*v;
+		view[v].pitch = (v & 1) ? 40.0 : 60.0;
+		view[v].fovY = (v & 2) ? 35.0 : 55.0;
+		view[v].width = 1280;
+		view[v].height = 720;
+		view[v].projection = VIEW_RECTILINEAR;
+		npix += view[v].width*view[v].height;
+		if (image_alloc(&ref[v], view[v].width, view[v].height, src.channels) < 0 ||
+			image_alloc(&dst[v], view[v].width, view[v].height, src.channels) < 0) {
+			return -1;
+		}
+	}
+
+	if (remap_views_build(&views, NULL, REMAP_LUT_FIXED, NULL, &lens, view, NVIEWS,
+						  src.width, src.height) < 0) {
+		return -1;
+	}
+
+	for (r=0; r<((maxthreads > 1) ? 2 : 1); r++) {
+		int32_t nt = nthreads[r];
+		pool_t * pool = pool_create(nt);
+		double t_sep = 1e30;
+		double t_one = 1e30;
+		int32_t i;
+
+		if (pool == NULL) {
+			return -1;
+		}
+
+		for (i=0; i<iters; i++) {
+			double t0 = now_sec( );
+			for (v=0; v<NVIEWS; v++) {
+				remap_lut_apply(&ref[v], &src, &views.luts[v], pool);
+			}
+			double t1 = now_sec( );
+			remap_views_apply(dst, &src, &views, pool);
+			double t2 = now_sec( );
+			t_sep = (t1 - t0 < t_sep) ? t1 - t0 : t_sep;
+			t_one = (t2 - t1 < t_one) ? t2 - t1 : t_one;
+		}
+		pool_destroy(pool);
+
+		for (v=0; v<NVIEWS; v++) {
+			if (memcmp(ref[v].pixels, dst[v].pixels, (size_t)dst[v].height*dst[v].stride) != 0) {
+				printf("views %-8s threads %2d  view %d MISMATCH against remap_lut_apply\n", c->name, nt, v);
+				rc = -1;
+			}
+		}
+
+		printf("views %-8s %d x %dx%d from %dx%dx%d threads %2d  separate %8.2f ms  one pass %8.2f ms"
+			   "  %8.1f Mpix/s (x%.2f)\n",
+			   c->name, NVIEWS, view[0].width, view[0].height, src.width, src.height, src.channels,
+			   nt, t_sep*1e3, t_one*1e3, npix/t_one*1e-6, t_sep/t_one);
+		json_record("remap_views", "\"case\": \"%s\", \"views\": %d, \"width\": %d, \"height\": %d, "
+					"\"src_width\": %d, \"src_height\": %d, \"channels\": %d, \"threads\": %d, "
+					"\"separate_ms\": %.3f, \"one_pass_ms\": %.3f, \"mpix_per_s\": %.2f, \"speedup\": %.3f",
+					c->name, NVIEWS, view[0].width, view[0].height, src.width, src.height, src.channels,
+					nt, t_sep*1e3, t_one*1e3, npix/t_one*1e-6, t_sep/t_one);
+	}
+
+	remap_views_free(&views);
+	for (v=0; v<NVIEWS; v++) {
+		image_free(&dst[v]);
+		image_free(&ref[v]);
+	}
+	image_free(&src);
+
+	return rc;
+}
+
+/**
+ * "cached": views spread around the lens over a source that fits the
+ * last-level cache, where there is little to share. "dram": views
+ * overlapping on one area of an 8K RGBA source (256 MB, past the LLC
+ * of current CPUs), where separate remaps fetch the shared area from
+ * memory once per view and the single pass about once.
+ */
+static int
+bench_views(int32_t maxthreads, int32_t iters)
+{
+	static const views_case_t cases[] = {
+		{"cached", 3840, 3, 1900.0, 45.0},
+		{"dram",   8192, 4, 4000.0, 10.0},
+	};
+	size_t i;
+	int rc = 0;
+
+	for (i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+		if (bench_views_case(&cases[i], maxthreads, iters) < 0) {
+			rc = -1;
+		}
+	}
+
+	return rc;
+}
+
+int
+main(int argc, char ** argv)
+{
+	int32_t iters = 5;
+	int32_t maxthreads = pool_default_threads( );
+	const char_t * json_path = NULL;
+	int opt;
+	int rc = 0;
+
+	while ((opt = getopt(argc, argv, "n:j:J:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 'j':
+			maxthreads = atoi(optarg);
+			break;
+		case 'J':
+			json_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-j max_threads] [-J results.json]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if (json_path != NULL) {
+		s_json = fopen(json_path, "w");
+		if (s_json == NULL) {
+			fprintf(stderr, "Failed to create %s\n", json_path);
+			exit(1);
+		}
+		fprintf(s_json, "{\n  \"suite\": \"spherebench\",\n  \"format_version\": 1,\n"
+				"  \"iterations\": %d,\n  \"max_threads\": %d,\n  \"cpus\": %d,\n"
+				"  \"isa\": \"%s\",\n  \"results\": [",
+				iters, maxthreads, pool_default_threads( ),
+				remap_isa_name(remap_select_isa(REMAP_ISA_AUTO)));
+	}
+
+	if (verify_kernels(1) < 0 || verify_kernels(2) < 0 ||
+		verify_kernels(3) < 0 || verify_kernels(4) < 0) {
+		rc = 1;
+	}
+	if (bench_lens_curve(iters) < 0) {
+		rc = 1;
+	}
+	if (bench_projections(iters) < 0) {
+		rc = 1;
+	}
+	if (bench_span_kernels(iters) < 0) {
+		rc = 1;
+	}
+	if (bench_madoka(iters) < 0) {
+		rc = 1;
+	}
+	if (bench_madoka_inverse(iters) < 0) {
+		rc = 1;
+	}
+	if (bench_mesh(iters) < 0) {
+		rc = 1;
+	}
+	if (bench_mesh_adaptive(iters) < 0) {
+		rc = 1;
+	}
+	if (bench_remap(3, iters) < 0) {
+		rc = 1;
+	}
+	if (bench_remap(4, iters) < 0) {
+		rc = 1;
+	}
+	if (bench_threads(maxthreads, iters) < 0) {
+		rc = 1;
+	}
+	if (bench_views(maxthreads, iters) < 0) {
+		rc = 1;
+	}
+
+	if (s_json != NULL) {
+		fprintf(s_json, "\n  ],\n  \"ok\": %s\n}\n", (rc == 0) ? "true" : "false");
+		fclose(s_json);
+	}
+
+	return rc;
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,474 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file circle.c
+ * @brief Image circle detection: lens center and radius from a frame.
+ *
+ * Rays are cast from a start point inside the circle, and each ray's
+ * luma profile is searched from the image border inwards for the first
+ * rise above a threshold between the background and the inside of the
+ * circle; the rim is placed at the steepest slope there. Searching from
+ * the outside makes dark scenery inside the circle harmless, and the
+ * profile is only sampled as far in as the rim. The edge points are
+ * fitted with RANSAC and refined by least squares on the distance to
+ * the circle. A second, denser set of rays is then cast from the fitted
+ * center, searching only a band around the first radius.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "remap.h"
+#include "pool.h"
+#include "circle.h"
+
+#define  CIRCLE_RAYS       (1024)		/* final pass; the first casts a quarter */
+#define  RAYS_PER_TASK     (32)
+#define  RANSAC_ROUNDS     (256)
+#define  RANSAC_TOL        (2.0)		/* px */
+#define  MIN_CONTRAST      (20.0)
+#define  MIN_EDGES         (16)
+
+typedef struct {
+	const image_t * img;
+	vec2_t origin;
+	int32_t nrays;
+	double band;			/* search below this distance, 0: from the border */
+	double thr;
+	vec2_t * edge;			/* per ray */
+	int32_t * found;
+	float * scratch;		/* per worker, one profile each */
+	int32_t max_len;
+} scan_job_t;
+
+static inline double
+luma_at(const image_t * img, int32_t x, int32_t y)
+{
+	const uint8_t * p = img->pixels + (size_t)y*img->stride + (size_t)x*img->channels;
+
+	if (img->channels < 3) {
+		return p[0];
+	}
+	return (77*p[0] + 150*p[1] + 29*p[2]) * (1.0/256.0);
+}
+
+static inline double
+luma_bilinear(const image_t * img, double x, double y)
+{
+	int32_t xi = (int32_t)x;
+	int32_t yi = (int32_t)y;
+	double fx = x - xi;
+	double fy = y - yi;
+
+	if (xi >= img->width - 1) {
+		xi = img->width - 2;
+		fx = 1.0;
+	}
+	if (yi >= img->height - 1) {
+		yi = img->height - 2;
+		fy = 1.0;
+	}
+
+	return (luma_at(img, xi, yi)*(1.0-fx) + luma_at(img, xi+1, yi)*fx)*(1.0-fy)
+		+ (luma_at(img, xi, yi+1)*(1.0-fx) + luma_at(img, xi+1, yi+1)*fx)*fy;
+}
+
+static int
+cmp_double(const void * a, const void * b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Background from the image border (its darker fifth, as the circle may
+ * touch the border) and the inside from the central square.
+ */
+static int
+luma_levels(const image_t * img, double * bg, double * inner)
+{
+	int32_t w = img->width;
+	int32_t h = img->height;
+	int32_t side = ((w < h) ? w : h) / 4;
+	int32_t step = (side > 256) ? side / 128 : 2;
+	int32_t nb = 0;
+	int32_t ni = 0;
+	double * v;
+	int32_t x, y;
+
+	v = malloc(sizeof(double)*(2*(w + h) + (side/step + 1)*(side/step + 1)));
+	if (v == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	for (x=0; x<w; x++) {
+		v[nb++] = luma_at(img, x, 0);
+		v[nb++] = luma_at(img, x, h-1);
+	}
+	for (y=0; y<h; y++) {
+		v[nb++] = luma_at(img, 0, y);
+		v[nb++] = luma_at(img, w-1, y);
+	}
+	qsort(v, nb, sizeof(double), cmp_double);
+	*bg = v[nb/5];
+
+	for (y=(h-side)/2; y<(h+side)/2; y+=step) {
+		for (x=(w-side)/2; x<(w+side)/2; x+=step) {
+			v[ni++] = luma_at(img, x, y);
+		}
+	}
+	qsort(v, ni, sizeof(double), cmp_double);
+	*inner = v[ni/2];
+
+	free(v);
+
+	return 0;
+}
+
+static void
+scan_rays(void * arg, int32_t task, int32_t worker)
+{
+	scan_job_t * job = arg;
+	const image_t * img = job->img;
+	float * prof = job->scratch + (size_t)worker*job->max_len;
+	int32_t i;
+
+	for (i=task*RAYS_PER_TASK; i<(task+1)*RAYS_PER_TASK; i++) {
+		double phi = 2.0*M_PI*(i + 0.5)/job->nrays;
+		vec2_t d = vec2(cos(phi), sin(phi));
+		double len = 1e30;
+		int32_t n, s, c, best, top, lo;
+		double g, g0, g1, gbest, off;
+
+		/* distance to the border, keeping samples one pixel inside */
+		if (d.x > 1e-9) {
+			len = fmin(len, (img->width - 1 - job->origin.x)/d.x);
+		}
+		else if (d.x < -1e-9) {
+			len = fmin(len, -job->origin.x/d.x);
+		}
+		if (d.y > 1e-9) {
+			len = fmin(len, (img->height - 1 - job->origin.y)/d.y);
+		}
+		else if (d.y < -1e-9) {
+			len = fmin(len, -job->origin.y/d.y);
+		}
+		n = (int32_t)len;
+		if (n > job->max_len) {
+			n = job->max_len;
+		}
+
+		job->found[i] = 0;
+		if (n < 8) {
+			continue;
+		}
+
+		top = n - 1;
+		if (job->band > 0.0 && job->band < top) {
+			top = (int32_t)job->band;
+		}
+
+		/* profile samples [lo, top], filled from the outside in */
+		lo = top + 1;
+#define  FILL_TO(k)														\
+		while (lo > (k)) {												\
+			lo--;														\
+			prof[lo] = (float)luma_bilinear(img, job->origin.x + d.x*lo, job->origin.y + d.y*lo); \
+		}
+
+		/* outermost rise above the threshold, on a 5-tap mean */
+		c = -1;
+		for (s=top-2; s>=2; s--) {
+			double m;
+
+			FILL_TO(s-2);
+			m = (prof[s-2] + prof[s-1] + prof[s] + prof[s+1] + prof[s+2]) * 0.2;
+			if (m > job->thr) {
+				c = s;
+				break;
+			}
+		}
+		/* the rim must lie inside the frame and below the band's top */
+		if (c < 0 || c > n - 6 || c > top - 4) {
+			continue;
+		}
+
+		/* steepest fall near the crossing, refined by a parabola */
+		FILL_TO((c-6 > 0) ? c-6 : 0);
+#undef  FILL_TO
+		best = -1;
+		gbest = 0.0;
+		for (s=(c-4 > 1) ? c-4 : 1; s<=c+4 && s<top; s++) {
+			g = prof[s-1] - prof[s+1];
+			if (g > gbest) {
+				gbest = g;
+				best = s;
+			}
+		}
+		if (best < 0) {
+			continue;
+		}
+		off = 0.0;
+		if (best >= 2 && best < top-1) {
+			g0 = prof[best-2] - prof[best];
+			g1 = prof[best] - prof[best+2];
+			if (g0 - 2.0*gbest + g1 < 0.0) {
+				off = 0.5*(g0 - g1)/(g0 - 2.0*gbest + g1);
+				off = fmax(-0.5, fmin(0.5, off));
+			}
+		}
+
+		job->edge[i] = vec2(job->origin.x + d.x*(best + off), job->origin.y + d.y*(best + off));
+		job->found[i] = 1;
+	}
+}
+
+static int
+circle_from_3(const vec2_t * a, const vec2_t * b, const vec2_t * c, vec2_t * ctr, double * r)
+{
+	double bx = b->x - a->x, by = b->y - a->y;
+	double cx = c->x - a->x, cy = c->y - a->y;
+	double d = 2.0*(bx*cy - by*cx);
+	double b2 = bx*bx + by*by;
+	double c2 = cx*cx + cy*cy;
+
+	if (fabs(d) < 1e-9) {
+		return -1;
+	}
+	ctr->x = a->x + (cy*b2 - by*c2)/d;
+	ctr->y = a->y + (bx*c2 - cx*b2)/d;
+	*r = hypot(ctr->x - a->x, ctr->y - a->y);
+
+	return 0;
+}
+
+/**
+ * Geometric least squares on the points within tol of the circle, by
+ * Gauss-Newton from the given estimate. Returns the number of points
+ * used in the last step.
+ */
+static int32_t
+refine_circle(const vec2_t * pts, int32_t n, vec2_t * ctr, double * r, double tol, double * rms)
+{
+	int32_t used = 0;
+	int32_t it, i;
+
+	for (it=0; it<10; it++) {
+		double a[3][3] = {{0}};
+		double b[3] = {0};
+		double ss = 0.0;
+		double det, dx, dy, dr;
+
+		used = 0;
+		for (i=0; i<n; i++) {
+			double ex = pts[i].x - ctr->x;
+			double ey = pts[i].y - ctr->y;
+			double dist = hypot(ex, ey);
+			double res = dist - *r;
+			double j[3];
+			int32_t p, q;
+
+			if (fabs(res) > tol || dist < 1e-9) {
+				continue;
+			}
+			/* d(res)/d(cx, cy, r) */
+			j[0] = -ex/dist;
+			j[1] = -ey/dist;
+			j[2] = -1.0;
+			for (p=0; p<3; p++) {
+				for (q=0; q<3; q++) {
+					a[p][q] += j[p]*j[q];
+				}
+				b[p] -= j[p]*res;
+			}
+			ss += res*res;
+			used++;
+		}
+		if (used < 3) {
+			break;
+		}
+		*rms = sqrt(ss/used);
+
+		/* 3x3 solve by Cramer's rule */
+		det = a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+			- a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0])
+			+ a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+		if (fabs(det) < 1e-12) {
+			break;
+		}
+		dx = (b[0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+			  - a[0][1]*(b[1]*a[2][2] - a[1][2]*b[2])
+			  + a[0][2]*(b[1]*a[2][1] - a[1][1]*b[2])) / det;
+		dy = (a[0][0]*(b[1]*a[2][2] - a[1][2]*b[2])
+			  - b[0]*(a[1][0]*a[2][2] - a[1][2]*a[2][0])
+			  + a[0][2]*(a[1][0]*b[2] - b[1]*a[2][0])) / det;
+		dr = (a[0][0]*(a[1][1]*b[2] - b[1]*a[2][1])
+			  - a[0][1]*(a[1][0]*b[2] - b[1]*a[2][0])
+			  + b[0]*(a[1][0]*a[2][1] - a[1][1]*a[2][0])) / det;
+		ctr->x += dx;
+		ctr->y += dy;
+		*r += dr;
+		if (fabs(dx) + fabs(dy) + fabs(dr) < 1e-4) {
+			break;
+		}
+	}
+
+	return used;
+}
+
+/**
+ * RANSAC over triples of edge points (a fixed sequence, so results are
+ * reproducible), then least squares on the inliers of the best one.
+ */
+static int32_t
+fit_circle(const vec2_t * pts, int32_t n, vec2_t * ctr, double * r, double * rms)
+{
+	uint32_t seed = 0x12345678u;
+	int32_t best = 0;
+	int32_t round, i;
+
+	for (round=0; round<RANSAC_ROUNDS; round++) {
+		int32_t k[3];
+		vec2_t c;
+		double rr;
+		int32_t count = 0;
+
+		for (i=0; i<3; i++) {
+			seed = seed*1664525u + 1013904223u;
+			k[i] = (int32_t)((seed >> 8) % (uint32_t)n);
+		}
+		if (k[0] == k[1] || k[1] == k[2] || k[0] == k[2] ||
+			circle_from_3(&pts[k[0]], &pts[k[1]], &pts[k[2]], &c, &rr) < 0) {
+			continue;
+		}
+		for (i=0; i<n; i++) {
+			if (fabs(hypot(pts[i].x - c.x, pts[i].y - c.y) - rr) <= RANSAC_TOL) {
+				count++;
+			}
+		}
+		if (count > best) {
+			best = count;
+			*ctr = c;
+			*r = rr;
+		}
+	}
+
+	if (best < 3) {
+		return 0;
+	}
+
+	return refine_circle(pts, n, ctr, r, RANSAC_TOL, rms);
+}
+
+/* Coarse pass from the image center, then a dense one from the fit */
+static int
+scan_and_fit(scan_job_t * job, vec2_t * pts, circle_fit_t * res, pool_t * pool,
+			 vec2_t * ctr, double * r)
+{
+	const image_t * img = job->img;
+	int32_t pass, i, n;
+
+	*ctr = vec2(0.5*img->width - 0.5, 0.5*img->height - 0.5);
+	for (pass=0; pass<2; pass++) {
+		job->origin = *ctr;
+		job->nrays = pass ? CIRCLE_RAYS : CIRCLE_RAYS/4;
+		job->band = pass ? *r*1.05 + 16.0 : 0.0;
+		pool_run(pool, job->nrays/RAYS_PER_TASK, scan_rays, job);
+		res->rays = job->nrays;
+
+		n = 0;
+		for (i=0; i<job->nrays; i++) {
+			if (job->found[i]) {
+				pts[n++] = job->edge[i];
+			}
+		}
+		res->edges = n;
+		if (n < MIN_EDGES) {
+			fprintf(stderr, "lens_detect_circle: rim not found (%d edge points)\n", n);
+			return -1;
+		}
+
+		res->inliers = fit_circle(pts, n, ctr, r, &res->rms);
+		if (res->inliers < MIN_EDGES ||
+			ctr->x < 0.0 || ctr->y < 0.0 || ctr->x >= img->width || ctr->y >= img->height) {
+			fprintf(stderr, "lens_detect_circle: no consistent circle (%d of %d points)\n",
+					res->inliers, n);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Estimate lens->center and lens->r from a frame with the whole or
+ * part of the image circle on a dark background. Returns -1 if no rim
+ * is found; lens is left untouched then. fit may be NULL.
+ */
+int
+lens_detect_circle(lens_param_t * lens, circle_fit_t * fit,
+				   const image_t * img, pool_t * pool)
+{
+	scan_job_t job;
+	circle_fit_t res = {CIRCLE_RAYS, 0, 0, 0.0};
+	vec2_t * pts;
+	vec2_t ctr;
+	double bg, inner, r = 0.0;
+	int rc = -1;
+
+	if (img->width < 16 || img->height < 16) {
+		fprintf(stderr, "lens_detect_circle: image too small\n");
+		return -1;
+	}
+	if (luma_levels(img, &bg, &inner) < 0) {
+		return -1;
+	}
+	if (inner - bg < MIN_CONTRAST) {
+		fprintf(stderr, "lens_detect_circle: no contrast between circle and background\n");
+		return -1;
+	}
+
+	job.img = img;
+	job.thr = bg + 0.25*(inner - bg);
+	job.max_len = (int32_t)hypot(img->width, img->height) + 1;
+	job.edge = malloc(sizeof(vec2_t)*CIRCLE_RAYS);
+	job.found = malloc(sizeof(int32_t)*CIRCLE_RAYS);
+	job.scratch = malloc(sizeof(float)*job.max_len*pool_size(pool));
+	pts = malloc(sizeof(vec2_t)*CIRCLE_RAYS);
+
+	if (job.edge == NULL || job.found == NULL || job.scratch == NULL || pts == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+	}
+	else if (scan_and_fit(&job, pts, &res, pool, &ctr, &r) == 0) {
+		/* image-centred offsets, as used by remap_project_row() */
+		lens->center.x = ctr.x - (0.5*img->width - 0.5);
+		lens->center.y = ctr.y - (0.5*img->height - 0.5);
+		lens->r = r;
+		rc = 0;
+	}
+
+	if (fit != NULL) {
+		*fit = res;
+	}
+	free(job.edge);
+	free(job.found);
+	free(job.scratch);
+	free(pts);
+
+	return rc;
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,39 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file circle.h
+ * @brief Image circle detection: lens center and radius from a frame.
+ *
+ */
+
+#ifndef SPHERE_CIRCLE_H_
+#define SPHERE_CIRCLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * How well the rim was found: rays scanned, rays that crossed the rim,
+ * edge points kept by the fit and their RMS distance to the circle.
+ */
+typedef struct {
+	int32_t rays;
+	int32_t edges;
+	int32_t inliers;
+	double rms;
+} circle_fit_t;
+
+extern int lens_detect_circle(lens_param_t * lens, circle_fit_t * fit,
+							  const image_t * img, pool_t * pool);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_CIRCLE_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,215 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file dewarp.c
+ * @brief Command line fisheye to rectilinear converter (no display needed).
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "lenscurve.h"
+#include "remap.h"
+#include "pool.h"
+#include "tilesrc.h"
+#include "lut.h"
+#include "pnm.h"
+#include "circle.h"
+
+static void
+usage(const char_t * prog)
+{
+	fprintf(stderr,
+			"Usage: %s [options] input.pnm output.pnm\n"
+			"  -t type   lens type (stereographic, equidistant, equisolid,\n"
+			"            orthogonal, madoka, curve; default: equidistant)\n"
+			"  -L file   load a lens curve file and use it (-t curve)\n"
+			"  -x cx     lens center offset x in pixels (default: 0)\n"
+			"  -y cy     lens center offset y in pixels (default: 0)\n"
+			"  -r r      image circle radius in pixels (default: half the short side)\n"
+			"  -A        detect the lens center and radius from the image\n"
+			"  -Y yaw    view yaw in degrees (default: 0)\n"
+			"  -P pitch  view pitch in degrees (default: 0)\n"
+			"  -f fovY   vertical field of view in degrees (default: 45)\n"
+			"  -W width  output width (default: 800)\n"
+			"  -H height output height (default: 600)\n"
+			"  -C dir    keep the remap table in a cache directory\n"
+			"  -M mb     read the input in tiles, caching at most mb megabytes\n"
+			"  -j n      worker threads (default: one per CPU)\n",
+			prog);
+}
+
+int
+main(int argc, char ** argv)
+{
+	lens_param_t lens = {LENS_EQUIDISTANT, 0.0, {0.0, 0.0}};
+	view_param_t view = {0.0, 0.0, 45.0, 800, 600, VIEW_RECTILINEAR};
+	image_t src;
+	image_t dst;
+	tile_source_t * tiles = NULL;
+	double cache_mb = 0.0;
+	int32_t detect = 0;
+	const char_t * cache_dir = NULL;
+	int32_t nthreads = 0;
+	remap_lut_t lut;
+	remap_lut_format_t format;
+	pool_t * pool;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:L:x:y:r:AY:P:f:W:H:C:M:j:h")) != -1) {
+		switch (opt) {
+		case 't':
+			if (lens_type_from_name(&lens.type, optarg) < 0) {
+				exit(1);
+			}
+			break;
+		case 'L':
+			if (lens_curve_load(optarg) < 0) {
+				exit(1);
+			}
+			lens.type = LENS_CURVE;
+			break;
+		case 'x':
+			lens.center.x = atof(optarg);
+			break;
+		case 'y':
+			lens.center.y = atof(optarg);
+			break;
+		case 'r':
+			lens.r = atof(optarg);
+			break;
+		case 'A':
+			detect = 1;
+			break;
+		case 'Y':
+			view.yaw = atof(optarg);
+			break;
+		case 'P':
+			view.pitch = atof(optarg);
+			break;
+		case 'f':
+			view.fovY = atof(optarg);
+			break;
+		case 'W':
+			view.width = atoi(optarg);
+			break;
+		case 'H':
+			view.height = atoi(optarg);
+			break;
+		case 'C':
+			cache_dir = optarg;
+			break;
+		case 'M':
+			cache_mb = atof(optarg);
+			if (cache_mb <= 0.0) {
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (argc - optind < 2 || (detect && cache_mb > 0.0)) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	if (cache_mb > 0.0) {
+		/* out of core: only the geometry is needed up front */
+		tile_source_info_t info;
+
+		tiles = tile_source_open(argv[optind], (size_t)(cache_mb*1024.0*1024.0));
+		if (tiles == NULL) {
+			exit(1);
+		}
+		tile_source_get_info(tiles, &info);
+		src.width = info.width;
+		src.height = info.height;
+		src.channels = info.channels;
+		src.stride = 0;
+		src.pixels = NULL;
+	}
+	else if (pnm_read(argv[optind], &src) < 0) {
+		exit(1);
+	}
+
+	if (lens.r <= 0.0) {
+		lens.r = 0.5*((src.width < src.height) ? src.width : src.height);
+	}
+
+	if (image_alloc(&dst, view.width, view.height, src.channels) < 0) {
+		exit(1);
+	}
+
+	pool = pool_create(nthreads);
+	if (pool == NULL) {
+		exit(1);
+	}
+
+	if (detect) {
+		if (lens_detect_circle(&lens, NULL, &src, pool) < 0) {
+			exit(1);
+		}
+		fprintf(stderr, "lens: -x %.2f -y %.2f -r %.2f\n", lens.center.x, lens.center.y, lens.r);
+	}
+
+	/* a tiled source can be larger than fixed-point tables address */
+	format = (tiles != NULL) ? REMAP_LUT_TILED : REMAP_LUT_FIXED;
+	if (cache_dir != NULL) {
+		if (remap_lut_load_cached(&lut, pool, format, cache_dir, &lens, &view,
+								  src.width, src.height) < 0) {
+			exit(1);
+		}
+	}
+	else if (remap_lut_build(&lut, pool, format, &lens, &view, src.width, src.height) < 0) {
+		exit(1);
+	}
+
+	if (tiles != NULL) {
+		tile_source_info_t info;
+
+		if (remap_lut_apply_tiled(&dst, tiles, &lut, pool) < 0) {
+			exit(1);
+		}
+		tile_source_get_info(tiles, &info);
+		fprintf(stderr, "tile cache: %d of %d tiles, %llu hits, %llu misses, %llu evictions, %.1f MB read\n",
+				info.slots, info.tiles_x*info.tiles_y, (unsigned long long)info.hits,
+				(unsigned long long)info.misses, (unsigned long long)info.evictions,
+				info.bytes_read/(1024.0*1024.0));
+		tile_source_close(tiles);
+	}
+	else if (remap_lut_apply(&dst, &src, &lut, pool) < 0) {
+		exit(1);
+	}
+
+	remap_lut_free(&lut);
+	pool_destroy(pool);
+
+	if (pnm_write(argv[optind+1], &dst) < 0) {
+		exit(1);
+	}
+
+	image_free(&dst);
+	image_free(&src);
+
+	return 0;
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,587 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file dewarpstream.c
+ * @brief Streaming fisheye correction from stdin to stdout.
+ *
+ * Reads YUV4MPEG2 (4:2:0, 4:4:4 or mono) or raw RGB24 frames, remaps them
+ * with a fixed lens and view and writes the result in the same format.
+ * Reading, remapping and writing run on separate threads connected by
+ * bounded queues of recycled frame buffers, so I/O overlaps the remap.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <math.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "lenscurve.h"
+#include "remap.h"
+#include "pool.h"
+#include "tilesrc.h"
+#include "lut.h"
+
+#define  MAX_PLANES  (3)
+#define  MAX_DEPTH   (16)
+
+typedef enum {
+	FMT_Y4M_420 = 0,
+	FMT_Y4M_444,
+	FMT_Y4M_MONO,
+	FMT_RAW_RGB24,
+} stream_fmt_t;
+
+/* Plane geometry of one frame format */
+typedef struct {
+	int32_t nplanes;
+	int32_t channels;
+	int32_t w[MAX_PLANES];
+	int32_t h[MAX_PLANES];
+	size_t offset[MAX_PLANES];
+	size_t size;
+} frame_layout_t;
+
+/* Bounded FIFO of frame buffers */
+typedef struct {
+	uint8_t * slots[MAX_DEPTH];
+	int32_t head;
+	int32_t count;
+	int32_t closed;
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+} frame_queue_t;
+
+typedef struct {
+	stream_fmt_t fmt;
+	char_t y4m_tags[1024];
+	frame_layout_t in;
+	frame_layout_t out;
+
+	frame_queue_t in_free;
+	frame_queue_t in_full;
+	frame_queue_t out_free;
+	frame_queue_t out_full;
+
+	int32_t read_error;
+	int32_t write_error;
+} stream_t;
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void
+queue_init(frame_queue_t * q)
+{
+	memset(q->slots, 0, sizeof(q->slots));
+	q->head = 0;
+	q->count = 0;
+	q->closed = 0;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cv, NULL);
+}
+
+static void
+queue_destroy(frame_queue_t * q)
+{
+	pthread_cond_destroy(&q->cv);
+	pthread_mutex_destroy(&q->lock);
+}
+
+static void
+queue_push(frame_queue_t * q, uint8_t * buf)
+{
+	pthread_mutex_lock(&q->lock);
+	/* capacity equals the number of buffers in flight, so this never blocks */
+	q->slots[(q->head + q->count) % MAX_DEPTH] = buf;
+	q->count++;
+	pthread_cond_signal(&q->cv);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * Take the oldest buffer, waiting until one arrives. Returns NULL once the
+ * queue is closed and drained.
+ */
+static uint8_t *
+queue_pop(frame_queue_t * q)
+{
+	uint8_t * buf = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0 && !q->closed) {
+		pthread_cond_wait(&q->cv, &q->lock);
+	}
+	if (q->count > 0) {
+		buf = q->slots[q->head];
+		q->head = (q->head + 1) % MAX_DEPTH;
+		q->count--;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return buf;
+}
+
+static void
+queue_close(frame_queue_t * q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->cv);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void
+make_layout(frame_layout_t * l, stream_fmt_t fmt, int32_t w, int32_t h)
+{
+	int32_t i;
+
+	memset(l, 0, sizeof(*l));
+	l->channels = 1;
+	switch (fmt) {
+	case FMT_Y4M_420:
+		l->nplanes = 3;
+		l->w[0] = w;
+		l->h[0] = h;
+		l->w[1] = l->w[2] = (w + 1)/2;
+		l->h[1] = l->h[2] = (h + 1)/2;
+		break;
+	case FMT_Y4M_444:
+		l->nplanes = 3;
+		l->w[0] = l->w[1] = l->w[2] = w;
+		l->h[0] = l->h[1] = l->h[2] = h;
+		break;
+	case FMT_Y4M_MONO:
+		l->nplanes = 1;
+		l->w[0] = w;
+		l->h[0] = h;
+		break;
+	case FMT_RAW_RGB24:
+		l->nplanes = 1;
+		l->channels = 3;
+		l->w[0] = w;
+		l->h[0] = h;
+		break;
+	}
+
+	for (i=0; i<l->nplanes; i++) {
+		l->offset[i] = l->size;
+		l->size += (size_t)l->w[i]*l->h[i]*l->channels;
+	}
+}
+
+static int
+read_line(FILE * fp, char_t * buf, size_t len)
+{
+	size_t n = 0;
+	int c;
+
+	while ((c = fgetc(fp)) != EOF && c != '\n') {
+		if (n+1 < len) {
+			buf[n++] = (char_t)c;
+		}
+	}
+	buf[n] = 0;
+
+	return (c == EOF && n == 0) ? -1 : 0;
+}
+
+/**
+ * Parse the stream header. Tags other than W, H and C are kept so they can
+ * be copied to the output header.
+ */
+static int
+read_y4m_header(stream_t * s, FILE * fp, int32_t * w, int32_t * h)
+{
+	char_t line[1024];
+	char_t * tok;
+	char_t * save = NULL;
+	size_t used = 0;
+
+	if (read_line(fp, line, sizeof(line)) < 0 || strncmp(line, "YUV4MPEG2", 9) != 0) {
+		fprintf(stderr, "Not a YUV4MPEG2 stream\n");
+		return -1;
+	}
+
+	s->fmt = FMT_Y4M_420;
+	s->y4m_tags[0] = 0;
+	for (tok = strtok_r(line + 9, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save)) {
+		switch (tok[0]) {
+		case 'W':
+			*w = atoi(tok + 1);
+			break;
+		case 'H':
+			*h = atoi(tok + 1);
+			break;
+		case 'C':
+			if (strncmp(tok, "C420", 4) == 0) {
+				s->fmt = FMT_Y4M_420;
+			}
+			else if (strcmp(tok, "C444") == 0) {
+				s->fmt = FMT_Y4M_444;
+			}
+			else if (strcmp(tok, "Cmono") == 0) {
+				s->fmt = FMT_Y4M_MONO;
+			}
+			else {
+				fprintf(stderr, "Unsupported Y4M colorspace: %s\n", tok);
+				return -1;
+			}
+			/* fall through: keep the tag */
+		default:
+			used += snprintf(s->y4m_tags + used, sizeof(s->y4m_tags) - used, " %s", tok);
+			if (used >= sizeof(s->y4m_tags)) {
+				fprintf(stderr, "Y4M header too long\n");
+				return -1;
+			}
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static void *
+reader_main(void * arg)
+{
+	stream_t * s = arg;
+	uint8_t * buf;
+
+	while ((buf = queue_pop(&s->in_free)) != NULL) {
+		if (s->fmt != FMT_RAW_RGB24) {
+			char_t line[256];
+			if (read_line(stdin, line, sizeof(line)) < 0) {
+				break;
+			}
+			if (strncmp(line, "FRAME", 5) != 0) {
+				fprintf(stderr, "Broken Y4M frame header\n");
+				s->read_error = 1;
+				break;
+			}
+		}
+		if (fread(buf, 1, s->in.size, stdin) != s->in.size) {
+			if (!feof(stdin) || s->fmt != FMT_RAW_RGB24) {
+				fprintf(stderr, "Truncated input frame\n");
+				s->read_error = 1;
+			}
+			break;
+		}
+		queue_push(&s->in_full, buf);
+	}
+
+	queue_close(&s->in_full);
+
+	return NULL;
+}
+
+static void *
+writer_main(void * arg)
+{
+	stream_t * s = arg;
+	uint8_t * buf;
+
+	while ((buf = queue_pop(&s->out_full)) != NULL) {
+		if (!s->write_error) {
+			if ((s->fmt != FMT_RAW_RGB24 && fputs("FRAME\n", stdout) < 0) ||
+				fwrite(buf, 1, s->out.size, stdout) != s->out.size) {
+				fprintf(stderr, "Failed to write output frame\n");
+				s->write_error = 1;
+			}
+		}
+		queue_push(&s->out_free, buf);
+	}
+	fflush(stdout);
+
+	return NULL;
+}
+
+/**
+ * Offsets of the pixels that fall outside the image circle. Chroma planes
+ * get a neutral value there instead of the sampler's zero.
+ */
+static int32_t *
+find_holes(const remap_lut_t * lut, int32_t * nholes)
+{
+	int32_t n = lut->width*lut->height;
+	int32_t * holes = malloc(sizeof(int32_t)*n);
+	int32_t cnt = 0;
+	int32_t i;
+
+	if (holes == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return NULL;
+	}
+
+	for (i=0; i<n; i++) {
+		if (lut->ixy[2*i+0] < 0) {
+			holes[cnt++] = i;
+		}
+	}
+	*nholes = cnt;
+
+	return holes;
+}
+
+static void
+usage(const char_t * prog)
+{
+	fprintf(stderr,
+			"Usage: %s [options] < input > output\n"
+			"  -R WxH    raw RGB24 input of the given size (default: YUV4MPEG2)\n"
+			"  -t type   lens type (default: equidistant)\n"
+			"  -L file   load a lens curve file and use it (-t curve)\n"
+			"  -x cx     lens center offset x in pixels (default: 0)\n"
+			"  -y cy     lens center offset y in pixels (default: 0)\n"
+			"  -r r      image circle radius in pixels (default: half the short side)\n"
+			"  -Y yaw    view yaw in degrees (default: 0)\n"
+			"  -P pitch  view pitch in degrees (default: 0)\n"
+			"  -f fovY   vertical field of view in degrees (default: 45)\n"
+			"  -W width  output width (default: 800)\n"
+			"  -H height output height (default: 600)\n"
+			"  -d depth  frames in flight per stage (default: 3)\n"
+			"  -j n      remap threads (default: one per CPU)\n",
+			prog);
+}
+
+int
+main(int argc, char ** argv)
+{
+	stream_t s;
+	lens_param_t lens = {LENS_EQUIDISTANT, 0.0, {0.0, 0.0}};
+	view_param_t view = {0.0, 0.0, 45.0, 800, 600, VIEW_RECTILINEAR};
+	remap_lut_t luts[2];
+	int32_t * holes = NULL;
+	int32_t nholes = 0;
+	int32_t nluts = 1;
+	int32_t src_w = 0;
+	int32_t src_h = 0;
+	int32_t depth = 3;
+	int32_t nthreads = 0;
+	int32_t frames = 0;
+	double t_wait = 0.0;
+	double t_start;
+	pthread_t reader, writer;
+	pool_t * pool;
+	uint8_t * buf;
+	int32_t i;
+	int opt;
+
+	memset(&s, 0, sizeof(s));
+	s.fmt = FMT_Y4M_420;
+
+	while ((opt = getopt(argc, argv, "R:t:L:x:y:r:Y:P:f:W:H:d:j:h")) != -1) {
+		switch (opt) {
+		case 'R':
+			if (sscanf(optarg, "%dx%d", &src_w, &src_h) != 2) {
+				usage(argv[0]);
+				exit(1);
+			}
+			s.fmt = FMT_RAW_RGB24;
+			break;
+		case 't':
+			if (lens_type_from_name(&lens.type, optarg) < 0) {
+				exit(1);
+			}
+			break;
+		case 'L':
+			if (lens_curve_load(optarg) < 0) {
+				exit(1);
+			}
+			lens.type = LENS_CURVE;
+			break;
+		case 'x':
+			lens.center.x = atof(optarg);
+			break;
+		case 'y':
+			lens.center.y = atof(optarg);
+			break;
+		case 'r':
+			lens.r = atof(optarg);
+			break;
+		case 'Y':
+			view.yaw = atof(optarg);
+			break;
+		case 'P':
+			view.pitch = atof(optarg);
+			break;
+		case 'f':
+			view.fovY = atof(optarg);
+			break;
+		case 'W':
+			view.width = atoi(optarg);
+			break;
+		case 'H':
+			view.height = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (depth < 1 || depth > MAX_DEPTH) {
+		fprintf(stderr, "Queue depth must be 1..%d\n", MAX_DEPTH);
+		exit(1);
+	}
+
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	if (s.fmt != FMT_RAW_RGB24 && read_y4m_header(&s, stdin, &src_w, &src_h) < 0) {
+		exit(1);
+	}
+	if (src_w <= 1 || src_h <= 1) {
+		fprintf(stderr, "Invalid input size %dx%d\n", src_w, src_h);
+		exit(1);
+	}
+
+	make_layout(&s.in, s.fmt, src_w, src_h);
+	make_layout(&s.out, s.fmt, view.width, view.height);
+
+	if (lens.r <= 0.0) {
+		lens.r = 0.5*((src_w < src_h) ? src_w : src_h);
+	}
+
+	pool = pool_create(nthreads);
+	if (pool == NULL) {
+		exit(1);
+	}
+
+	/* luma (or RGB) table, and a half-resolution one for 4:2:0 chroma */
+	if (remap_lut_build(&luts[0], pool, REMAP_LUT_FIXED, &lens, &view, src_w, src_h) < 0) {
+		exit(1);
+	}
+	if (s.fmt == FMT_Y4M_420) {
+		lens_param_t clens = lens;
+		view_param_t cview = view;
+		clens.r *= 0.5;
+		clens.center = mult2d(0.5, lens.center);
+		cview.width = s.out.w[1];
+		cview.height = s.out.h[1];
+		if (remap_lut_build(&luts[1], pool, REMAP_LUT_FIXED, &clens, &cview, s.in.w[1], s.in.h[1]) < 0) {
+			exit(1);
+		}
+		nluts = 2;
+	}
+	if (s.out.nplanes > 1) {
+		holes = find_holes(&luts[nluts-1], &nholes);
+		if (holes == NULL) {
+			exit(1);
+		}
+	}
+
+	if (s.fmt != FMT_RAW_RGB24) {
+		printf("YUV4MPEG2 W%d H%d%s\n", view.width, view.height, s.y4m_tags);
+	}
+
+	queue_init(&s.in_free);
+	queue_init(&s.in_full);
+	queue_init(&s.out_free);
+	queue_init(&s.out_full);
+	for (i=0; i<depth; i++) {
+		uint8_t * ib = malloc(s.in.size);
+		uint8_t * ob = malloc(s.out.size);
+		if (ib == NULL || ob == NULL) {
+			fprintf(stderr, "Failed to allocate memory...\n");
+			exit(1);
+		}
+		queue_push(&s.in_free, ib);
+		queue_push(&s.out_free, ob);
+	}
+
+	remap_select_isa(REMAP_ISA_AUTO);
+	pthread_create(&reader, NULL, reader_main, &s);
+	pthread_create(&writer, NULL, writer_main, &s);
+
+	t_start = now_sec( );
+	for (;;) {
+		double t0 = now_sec( );
+		uint8_t * ob;
+		int32_t p;
+
+		buf = queue_pop(&s.in_full);
+		if (buf == NULL) {
+			break;
+		}
+		ob = queue_pop(&s.out_free);
+		t_wait += now_sec( ) - t0;
+
+		for (p=0; p<s.in.nplanes; p++) {
+			const remap_lut_t * lut = &luts[(p > 0) ? nluts-1 : 0];
+			image_t src = {s.in.w[p], s.in.h[p], s.in.channels,
+						   s.in.w[p]*s.in.channels, buf + s.in.offset[p]};
+			image_t dst = {s.out.w[p], s.out.h[p], s.out.channels,
+						   s.out.w[p]*s.out.channels, ob + s.out.offset[p]};
+			remap_lut_apply(&dst, &src, lut, pool);
+			if (p > 0) {
+				for (i=0; i<nholes; i++) {
+					dst.pixels[holes[i]] = 0x80;
+				}
+			}
+		}
+
+		queue_push(&s.in_free, buf);
+		queue_push(&s.out_full, ob);
+		frames++;
+	}
+	queue_close(&s.in_free);
+	queue_close(&s.out_full);
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+
+	{
+		double t = now_sec( ) - t_start;
+		fprintf(stderr, "%d frames in %.2f s (%.1f fps), remap stage idle %.1f%%\n",
+				frames, t, (t > 0.0) ? frames/t : 0.0, (t > 0.0) ? 100.0*t_wait/t : 0.0);
+	}
+
+	/* every buffer is back in a free queue once both threads are done */
+	while (s.in_free.count > 0) {
+		free(queue_pop(&s.in_free));
+	}
+	while (s.out_free.count > 0) {
+		free(queue_pop(&s.out_free));
+	}
+	queue_destroy(&s.out_full);
+	queue_destroy(&s.out_free);
+	queue_destroy(&s.in_full);
+	queue_destroy(&s.in_free);
+
+	free(holes);
+	for (i=0; i<nluts; i++) {
+		remap_lut_free(&luts[i]);
+	}
+	pool_destroy(pool);
+
+	return (s.read_error || s.write_error) ? 1 : 0;
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
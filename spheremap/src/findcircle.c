@@ -0,0 +1,107 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file findcircle.c
+ * @brief Batch image circle detection for lens calibration.
+ *
+ * Prints the lens center offset and radius of every image in the form
+ * dewarp takes them, so a whole rig can be recalibrated in one run.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "remap.h"
+#include "pool.h"
+#include "pnm.h"
+#include "circle.h"
+
+static void
+usage(const char_t * prog)
+{
+	fprintf(stderr,
+			"Usage: %s [options] image.pnm ...\n"
+			"  -j n      worker threads (default: one per CPU)\n",
+			prog);
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int
+main(int argc, char ** argv)
+{
+	int32_t nthreads = 0;
+	int32_t failed = 0;
+	pool_t * pool;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "j:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (argc - optind < 1) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	pool = pool_create(nthreads);
+	if (pool == NULL) {
+		exit(1);
+	}
+
+	for (i=optind; i<argc; i++) {
+		lens_param_t lens = {LENS_EQUIDISTANT, 0.0, {0.0, 0.0}};
+		circle_fit_t fit;
+		image_t img;
+		double t0, t1;
+
+		if (pnm_read(argv[i], &img) < 0) {
+			failed++;
+			continue;
+		}
+
+		t0 = now_sec( );
+		if (lens_detect_circle(&lens, &fit, &img, pool) < 0) {
+			fprintf(stderr, "%s: no image circle found\n", argv[i]);
+			failed++;
+		}
+		else {
+			t1 = now_sec( );
+			printf("%s: -x %.2f -y %.2f -r %.2f  # %d of %d rays, %d inliers, rms %.2f px, %.1f ms\n",
+				   argv[i], lens.center.x, lens.center.y, lens.r,
+				   fit.edges, fit.rays, fit.inliers, fit.rms, (t1 - t0)*1e3);
+		}
+		image_free(&img);
+	}
+
+	pool_destroy(pool);
+
+	return (failed > 0) ? 1 : 0;
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,249 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file fitlens.c
+ * @brief Fit the projection models to calibration target observations.
+ *
+ * Reads pixel / ray angle correspondences, one "x y theta" per line with
+ * x, y in image pixels and theta in degrees from the optical axis, and
+ * prints every model's fit and the options dewarp takes for the best.
+ * The polynomial fit can be saved as a lens curve file.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "pool.h"
+#include "lensfit.h"
+
+static void
+usage(const char_t * prog)
+{
+	fprintf(stderr,
+			"Usage: %s [options] -s WxH points.txt\n"
+			"  -s WxH    image size the pixel coordinates refer to\n"
+			"  -o file   write the polynomial fit as a lens curve file\n"
+			"  -j n      worker threads (default: one per CPU)\n"
+			"  -v        print the residual of every point for the best model\n",
+			prog);
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/**
+ * Read correspondences, converting pixels to offsets from the center of
+ * a width x height image. Returns the count, or -1.
+ */
+static int32_t
+read_points(const char * path, int32_t width, int32_t height, lens_obs_t ** obs)
+{
+	lens_obs_t * buf = NULL;
+	int32_t n = 0, cap = 0;
+	int32_t lineno = 0;
+	char line[256];
+	FILE * fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		double x, y, t;
+		char c;
+
+		lineno++;
+		if (sscanf(line, " %c", &c) != 1 || c == '#') {
+			continue;
+		}
+		if (sscanf(line, "%lf %lf %lf", &x, &y, &t) != 3) {
+			fprintf(stderr, "%s:%d: expected \"x y theta\"\n", path, lineno);
+			n = -1;
+			break;
+		}
+		if (n == cap) {
+			lens_obs_t * p;
+			cap = (cap > 0) ? cap*2 : 1024;
+			p = realloc(buf, sizeof(lens_obs_t)*cap);
+			if (p == NULL) {
+				fprintf(stderr, "Failed to allocate memory...\n");
+				n = -1;
+				break;
+			}
+			buf = p;
+		}
+		buf[n].p = vec2(x - (0.5*width - 0.5), y - (0.5*height - 0.5));
+		buf[n].theta = t * (M_PI/180.0);
+		n++;
+	}
+	fclose(fp);
+
+	if (n < 0) {
+		free(buf);
+		return -1;
+	}
+	*obs = buf;
+
+	return n;
+}
+
+/**
+ * Save the polynomial fit in the lens curve format over the observed
+ * range of angles.
+ */
+static int
+write_curve(const char * path, const lens_fit_t * fit, const lens_obs_t * obs, int32_t n)
+{
+	double max = 0.0;
+	int32_t i;
+	FILE * fp;
+
+	for (i=0; i<n; i++) {
+		max = (obs[i].theta > max) ? obs[i].theta : max;
+	}
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to create %s\n", path);
+		return -1;
+	}
+	fprintf(fp, "# fitlens: rms %.3f px, max %.3f px over %d points\n", fit->rms, fit->max, n);
+	fprintf(fp, "max %.4f\npoly", max * (180.0/M_PI));
+	for (i=0; i<LENS_FIT_POLY_TERMS; i++) {
+		fprintf(fp, " %.17g%s", fit->poly[i], (i < LENS_FIT_POLY_TERMS-1) ? " 0" : "\n");
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Failed to write %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char ** argv)
+{
+	lens_fit_t fits[LENS_FIT_MODELS];
+	const lens_fit_t * fit;
+	lens_obs_t * obs = NULL;
+	const char * curve_path = NULL;
+	int32_t width = 0, height = 0;
+	int32_t nthreads = 0;
+	int32_t verbose = 0;
+	int32_t n, best, fixed;
+	pool_t * pool;
+	double t0, t1;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "s:o:j:vh")) != -1) {
+		switch (opt) {
+		case 's':
+			if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+				width = 0;
+			}
+			break;
+		case 'o':
+			curve_path = optarg;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (argc - optind != 1 || width <= 0 || height <= 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	n = read_points(argv[optind], width, height, &obs);
+	if (n < 0) {
+		exit(1);
+	}
+
+	pool = pool_create(nthreads);
+	if (pool == NULL) {
+		free(obs);
+		exit(1);
+	}
+
+	t0 = now_sec( );
+	best = lens_fit_models(fits, obs, n, pool);
+	t1 = now_sec( );
+	pool_destroy(pool);
+	if (best < 0) {
+		free(obs);
+		exit(1);
+	}
+
+	printf("%d correspondences, %.1f ms\n", n, (t1 - t0)*1e3);
+	printf("%-14s %9s %9s %9s %9s %9s %5s\n", "model", "rms", "max", "-x", "-y", "-r", "steps");
+	fixed = 0;
+	for (i=0; i<LENS_FIT_MODELS; i++) {
+		fit = &fits[i];
+		printf("%-14s %9.3f %9.3f %9.2f %9.2f %9.2f %5d%s\n", lens_fit_model_name(i),
+			   fit->rms, fit->max, fit->lens.center.x, fit->lens.center.y, fit->lens.r,
+			   fit->iterations, (i == best) ? "  *" : "");
+		if (i < LENS_FIT_POLY && fit->rms < fits[fixed].rms) {
+			fixed = i;
+		}
+	}
+
+	fit = &fits[LENS_FIT_POLY];
+	printf("polynomial: r(theta)/r = %.6g t %+.6g t^3 %+.6g t^5 %+.6g t^7\n",
+		   fit->poly[0], fit->poly[1], fit->poly[2], fit->poly[3]);
+
+	fit = &fits[fixed];
+	printf("-t %s -x %.2f -y %.2f -r %.2f\n", lens_type_name(fit->lens.type),
+		   fit->lens.center.x, fit->lens.center.y, fit->lens.r);
+
+	if (curve_path != NULL) {
+		fit = &fits[LENS_FIT_POLY];
+		if (write_curve(curve_path, fit, obs, n) < 0) {
+			free(obs);
+			exit(1);
+		}
+		printf("-L %s -x %.2f -y %.2f -r %.2f\n", curve_path,
+			   fit->lens.center.x, fit->lens.center.y, fit->lens.r);
+	}
+
+	if (verbose) {
+		fit = &fits[best];
+		for (i=0; i<n; i++) {
+			double d = hypot(obs[i].p.x - fit->lens.center.x, obs[i].p.y - fit->lens.center.y);
+			printf("%9.2f %9.2f %8.3f %+8.3f\n",
+				   obs[i].p.x + (0.5*width - 0.5), obs[i].p.y + (0.5*height - 0.5),
+				   obs[i].theta * (180.0/M_PI), d - lens_fit_radius(fits, best, obs[i].theta));
+		}
+	}
+	free(obs);
+
+	return 0;
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
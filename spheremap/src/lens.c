@@ -0,0 +1,300 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lens.c
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "madoka.h"
+#include "lenscurve.h"
+#include "lens_kernel.h"
+
+/* Angles converted per batch by the table-driven span kernels */
+#define  SPAN_CHUNK  (64)
+
+static pthread_once_t s_span_once = PTHREAD_ONCE_INIT;
+static int32_t s_span_avx2 = 0;
+
+LENS_SPAN_KERNELS(c)
+
+/**
+ * Normalized image radius of a ray at angle theta from the optical axis.
+ * A ray at theta = pi/2 lands on the image circle (radius 1.0) for every
+ * projection except the stereographic one; for LENS_CURVE the curve
+ * file decides.
+ */
+double
+lens_theta_to_radius(lens_type_t type, double theta)
+{
+	double sr = 0.0;
+
+	switch (type) {
+	case LENS_STEREOGRAPHIC:
+		/* stereographic projection */
+		sr = sin(theta) / (1.0 + cos(theta));
+		break;
+
+	case LENS_EQUIDISTANT:
+		/* equidistant projection */
+		sr = theta * (2.0/M_PI);
+		break;
+
+	case LENS_EQUISOLID:
+		/* equisolid projection */
+		sr = sin(theta*0.5) / sin(0.25*M_PI);
+		break;
+
+	case LENS_ORTHOGONAL:
+		/* orthogonal projection */
+		sr = sin(theta);
+		break;
+
+	case LENS_MADOKA:
+		/* MADOKA */
+		sr = madoka_theta_to_radius(theta);
+		break;
+
+	case LENS_CURVE:
+		sr = lens_curve_theta_to_radius(theta);
+		break;
+	}
+
+	return sr;
+}
+
+/**
+ * lens_theta_to_radius() over a span of angles.
+ */
+void
+lens_theta_to_radius_array(lens_type_t type, const double * theta, double * sr, int32_t n)
+{
+	int32_t i;
+
+	if (type == LENS_MADOKA) {
+		madoka_theta_to_radius_array(theta, sr, n);
+		return;
+	}
+	if (type == LENS_CURVE) {
+		lens_curve_theta_to_radius_array(theta, sr, n);
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+		sr[i] = lens_theta_to_radius(type, theta[i]);
+	}
+}
+
+/**
+ * Inverse of lens_theta_to_radius(): the angle from the optical axis of a
+ * point at normalized image radius sr. Radii with no ray (beyond the
+ * orthogonal/equisolid rim) are clamped to the rim.
+ */
+double
+lens_radius_to_theta(lens_type_t type, double sr)
+{
+	double theta = 0.0;
+
+	switch (type) {
+	case LENS_STEREOGRAPHIC:
+		theta = 2.0 * atan(sr);
+		break;
+
+	case LENS_EQUIDISTANT:
+		theta = sr * (M_PI/2.0);
+		break;
+
+	case LENS_EQUISOLID:
+		sr = sr * sin(0.25*M_PI);
+		theta = 2.0 * asin((sr < 1.0) ? sr : 1.0);
+		break;
+
+	case LENS_ORTHOGONAL:
+		theta = asin((sr < 1.0) ? sr : 1.0);
+		break;
+
+	case LENS_MADOKA:
+		theta = madoka_radius_to_theta(sr);
+		break;
+
+	case LENS_CURVE:
+		theta = lens_curve_radius_to_theta(sr);
+		break;
+	}
+
+	return theta;
+}
+
+/**
+ * lens_radius_to_theta() over a span of radii.
+ */
+void
+lens_radius_to_theta_array(lens_type_t type, const double * sr, double * theta, int32_t n)
+{
+	int32_t i;
+
+	if (type == LENS_MADOKA) {
+		madoka_radius_to_theta_array(sr, theta, n);
+		return;
+	}
+	if (type == LENS_CURVE) {
+		lens_curve_radius_to_theta_array(sr, theta, n);
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+		theta[i] = lens_radius_to_theta(type, sr[i]);
+	}
+}
+
+/* Span kernels of the table-driven models: angles, then the array form */
+static void
+lens_span_madoka(const double * rho, const double * z, double * sr, int32_t n)
+{
+	double th[SPAN_CHUNK];
+	int32_t i, m;
+
+	for (i=0; i<n; i+=m) {
+		m = (n - i < SPAN_CHUNK) ? n - i : SPAN_CHUNK;
+		if (s_span_avx2) {
+			lens_span_angle_avx2(rho + i, z + i, th, m);
+		}
+		else {
+			lens_span_angle_c(rho + i, z + i, th, m);
+		}
+		madoka_theta_to_radius_array(th, sr + i, m);
+	}
+}
+
+static void
+lens_span_curve(const double * rho, const double * z, double * sr, int32_t n)
+{
+	double th[SPAN_CHUNK];
+	int32_t i, m;
+
+	for (i=0; i<n; i+=m) {
+		m = (n - i < SPAN_CHUNK) ? n - i : SPAN_CHUNK;
+		if (s_span_avx2) {
+			lens_span_angle_avx2(rho + i, z + i, th, m);
+		}
+		else {
+			lens_span_angle_c(rho + i, z + i, th, m);
+		}
+		lens_curve_theta_to_radius_array(th, sr + i, m);
+	}
+}
+
+/* resolved once: table builds reach lens_span_kernel() from pool workers */
+static void
+select_span_isa(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init( );
+	s_span_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+}
+
+/**
+ * The span kernel of a lens model, for the best ISA of this CPU. Pick it
+ * once per table or mesh rebuild; the models are specialized at compile
+ * time (see lens_kernel.h), so the loops carry no per-element dispatch.
+ */
+lens_span_fn_t
+lens_span_kernel(lens_type_t type)
+{
+	lens_span_fn_t fn = lens_span_equidistant_c;
+
+	pthread_once(&s_span_once, select_span_isa);
+
+	switch (type) {
+	case LENS_STEREOGRAPHIC:
+		fn = s_span_avx2 ? lens_span_stereographic_avx2 : lens_span_stereographic_c;
+		break;
+
+	case LENS_EQUIDISTANT:
+		fn = s_span_avx2 ? lens_span_equidistant_avx2 : lens_span_equidistant_c;
+		break;
+
+	case LENS_EQUISOLID:
+		fn = s_span_avx2 ? lens_span_equisolid_avx2 : lens_span_equisolid_c;
+		break;
+
+	case LENS_ORTHOGONAL:
+		fn = s_span_avx2 ? lens_span_orthogonal_avx2 : lens_span_orthogonal_c;
+		break;
+
+	case LENS_MADOKA:
+		fn = lens_span_madoka;
+		break;
+
+	case LENS_CURVE:
+		fn = lens_span_curve;
+		break;
+	}
+
+	return fn;
+}
+
+const char *
+lens_type_name(lens_type_t type)
+{
+	const char * name = "unknown";
+	switch (type) {
+	case LENS_STEREOGRAPHIC:
+		name = "Stereographic";
+		break;
+	case LENS_EQUIDISTANT:
+		name = "Equidistant";
+		break;
+	case LENS_EQUISOLID:
+		name = "Equisolid";
+		break;
+	case LENS_ORTHOGONAL:
+		name = "Orthogonal";
+		break;
+	case LENS_MADOKA:
+		name = "MADOKA";
+		break;
+	case LENS_CURVE:
+		name = "Curve";
+		break;
+	}
+
+	return name;
+}
+
+int
+lens_type_from_name(lens_type_t * type, const char * name)
+{
+	static const lens_type_t types[] = {
+		LENS_STEREOGRAPHIC, LENS_EQUIDISTANT, LENS_EQUISOLID,
+		LENS_ORTHOGONAL, LENS_MADOKA, LENS_CURVE,
+	};
+	size_t i;
+
+	for (i=0; i<sizeof(types)/sizeof(types[0]); i++) {
+		if (strcasecmp(name, lens_type_name(types[i])) == 0) {
+			*type = types[i];
+			return 0;
+		}
+	}
+
+	fprintf(stderr, "Unknown lens type: %s\n", name);
+	return -1;
+}
+
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -17,6 +17,7 @@ typedef enum {
 	LENS_EQUISOLID,
 	LENS_ORTHOGONAL,
 	LENS_MADOKA,
+	LENS_CURVE,				/* loaded at run time, see lenscurve.h */
 } lens_type_t;
 
 typedef struct {
@@ -25,6 +26,20 @@ typedef struct {
 	vec2_t center;
 } lens_param_t;
 
+/**
+ * Normalized image radius over a span of rays, each given by its
+ * distance from the optical axis rho and its component along the axis
+ * z, at any scale: the ray's angle is atan2(rho, z).
+ */
+typedef void (*lens_span_fn_t)(const double * rho, const double * z, double * sr, int32_t n);
+
+extern double lens_theta_to_radius(lens_type_t type, double theta);
+extern void lens_theta_to_radius_array(lens_type_t type, const double * theta, double * sr, int32_t n);
+extern double lens_radius_to_theta(lens_type_t type, double sr);
+extern void lens_radius_to_theta_array(lens_type_t type, const double * sr, double * theta, int32_t n);
+extern lens_span_fn_t lens_span_kernel(lens_type_t type);
+extern const char * lens_type_name(lens_type_t type);
+extern int lens_type_from_name(lens_type_t * type, const char * name);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,25 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lens_avx2.c
+ * @brief Span kernels of lens_kernel.h built for AVX2.
+ *
+ * Built with -mavx2 but without FMA, and only entered after a runtime
+ * CPU check; the results are identical to the generic build.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "common.h"
+#include "lens_kernel.h"
+
+LENS_SPAN_KERNELS(avx2)
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
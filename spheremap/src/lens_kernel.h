@@ -0,0 +1,107 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lens_kernel.h
+ * @brief Per-model span kernels behind lens_span_kernel().
+ *
+ * Each closed-form model is written once below as an expression of the
+ * ray's distance from the optical axis p, its component along it c and
+ * its length l, and LENS_SPAN_KERNELS(isa) stamps out one straight loop
+ * per model for the including translation unit. Stereographic,
+ * equisolid and orthogonal need no trigonometry this way; equidistant,
+ * and the angles fed to the table-driven models, use a branch-free
+ * atan2. The loops vectorize for whatever ISA the unit is built for,
+ * and every ISA gives the same results as long as the build does not
+ * contract to FMA.
+ */
+
+#ifndef SPHERE_LENS_KERNEL_H_
+#define SPHERE_LENS_KERNEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* low part of pi/2 */
+#define  LENS_KERNEL_PIO2_LO  (6.123233995736765886130e-17)
+
+/**
+ * atan2(p, c) for p >= 0, within 2 ulp of libm: Cephes' atan on the
+ * ratio of the smaller to the larger component, reduced once more above
+ * 0.66, with every branch turned into a select so the loops vectorize.
+ */
+static inline double
+lens_kernel_angle(double p, double c)
+{
+	const double ac = fabs(c);
+	const double hi = (p > ac) ? p : ac;
+	const double lo = (p > ac) ? ac : p;
+	const double q = lo / ((hi > 0.0) ? hi : 1.0);
+	const double r = (q - 1.0) / (q + 1.0);
+	const double x = (q > 0.66) ? r : q;
+	const double z = x*x;
+	const double num = (((-8.750608600031904122785e-1*z - 1.615753718733365076637e1)*z
+						 - 7.500855792314704667340e1)*z - 1.228866684490136173410e2)*z
+		- 6.485021904942025371773e1;
+	const double den = ((((z + 2.485846490142306297962e1)*z + 1.650270098316988542046e2)*z
+						 + 4.328810604912902668951e2)*z + 4.853903996359136964868e2)*z
+		+ 1.945506571482613964425e2;
+	/* every candidate is computed, then selected: no conditional FP op */
+	const double a0 = x + x*(z*num/den);
+	const double r1 = (0.25*M_PI) + (a0 + 0.5*LENS_KERNEL_PIO2_LO);
+	const double a1 = (q > 0.66) ? r1 : a0;
+	const double r2 = (0.5*M_PI - a1) + LENS_KERNEL_PIO2_LO;
+	const double a2 = (p > ac) ? r2 : a1;
+	const double r3 = (M_PI - a2) + 2.0*LENS_KERNEL_PIO2_LO;
+
+	return (c < 0.0) ? r3 : a2;
+}
+
+#define  LENS_SPAN_ANGLE(p, c, l)          lens_kernel_angle((p), (c))
+#define  LENS_SPAN_STEREOGRAPHIC(p, c, l)  ((p) / ((l) + (c)))
+#define  LENS_SPAN_EQUIDISTANT(p, c, l)    (lens_kernel_angle((p), (c)) * (2.0/M_PI))
+#define  LENS_SPAN_EQUISOLID(p, c, l)      ((p) / sqrt((l) * ((l) + (c))))
+#define  LENS_SPAN_ORTHOGONAL(p, c, l)     ((p) / (l))
+
+#define  LENS_SPAN_LOOP(name, isa, model)								\
+	void																\
+	lens_span_##name##_##isa(const double * __restrict rho, const double * __restrict z, \
+							 double * __restrict sr, int32_t n)			\
+	{																	\
+		int32_t i;														\
+		for (i=0; i<n; i++) {											\
+			const double p = rho[i];									\
+			const double c = z[i];										\
+			const double l = sqrt(p*p + c*c);							\
+			(void)l;													\
+			sr[i] = model(p, c, l);										\
+		}																\
+	}
+
+#define  LENS_SPAN_KERNELS(isa)											\
+	LENS_SPAN_LOOP(angle, isa, LENS_SPAN_ANGLE)							\
+	LENS_SPAN_LOOP(stereographic, isa, LENS_SPAN_STEREOGRAPHIC)			\
+	LENS_SPAN_LOOP(equidistant, isa, LENS_SPAN_EQUIDISTANT)				\
+	LENS_SPAN_LOOP(equisolid, isa, LENS_SPAN_EQUISOLID)					\
+	LENS_SPAN_LOOP(orthogonal, isa, LENS_SPAN_ORTHOGONAL)
+
+#define  LENS_SPAN_DECLARE(isa)											\
+	extern void lens_span_angle_##isa(const double *, const double *, double *, int32_t); \
+	extern void lens_span_stereographic_##isa(const double *, const double *, double *, int32_t); \
+	extern void lens_span_equidistant_##isa(const double *, const double *, double *, int32_t); \
+	extern void lens_span_equisolid_##isa(const double *, const double *, double *, int32_t); \
+	extern void lens_span_orthogonal_##isa(const double *, const double *, double *, int32_t);
+
+LENS_SPAN_DECLARE(c)
+LENS_SPAN_DECLARE(avx2)
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_LENS_KERNEL_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
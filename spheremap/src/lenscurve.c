@@ -0,0 +1,506 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lenscurve.c
+ * @brief Lens projection curve loaded at run time (LENS_CURVE).
+ *
+ * A curve file gives the normalized image radius (in units of
+ * lens_param_t.r) as a function of the angle from the optical axis,
+ * either as samples or as polynomial coefficients:
+ *
+ *   # comment
+ *   12.5 0.1375           theta in degrees, radius; increasing theta
+ *   ...
+ *
+ *   max 100               range of the polynomial in degrees (default 90)
+ *   poly c1 c2 c3 ...     r = c1 t + c2 t^2 + c3 t^3 + ..., t in radians
+ *
+ * Samples are joined by a cubic spline, natural at theta = 0 where lens
+ * curves are odd, and clamped at the last sample to the slope of a
+ * parabola through the last three. Whatever the source, it is resampled
+ * into cubic Hermite segments on uniform knots, so evaluation is an
+ * index computation and one cubic with no search, and beyond the range
+ * the curve continues along its end tangent. The inverse gets a table
+ * of its own, polished by one Newton step on the forward curve.
+ *
+ * The curve is process-wide like the MADOKA table; install it before
+ * any thread evaluates LENS_CURVE. Until then it is the equidistant
+ * projection.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "lenscurve.h"
+
+#define  CURVE_INTERVALS  (256)
+#define  CURVE_MAX_LINE   (1024)	/* fits LENS_CURVE_MAX_COEFS full-precision coefficients */
+
+/**
+ * Cubic per interval of width h on [0, x_max], in powers of the offset
+ * into the interval. Row n holds the end value and slope for the tail.
+ */
+typedef struct {
+	int32_t n;
+	double x_max;
+	double h;
+	double inv_h;
+	double c[CURVE_INTERVALS+1][4];
+} hermite_tbl_t;
+
+/* Source the tables are resampled from */
+typedef struct {
+	int32_t ncoefs;				/* polynomial if > 0 */
+	double coefs[LENS_CURVE_MAX_COEFS];
+	int32_t n;					/* spline samples otherwise */
+	const double * x;
+	const double * y;
+	double * m;					/* second derivatives */
+} curve_src_t;
+
+/* equidistant: r = 2 theta / pi */
+static hermite_tbl_t s_fwd = {
+	1, M_PI, M_PI, 1.0/M_PI, {{0.0, 2.0/M_PI, 0.0, 0.0}, {2.0, 2.0/M_PI, 0.0, 0.0}},
+};
+static hermite_tbl_t s_inv = {
+	1, 2.0, 2.0, 0.5, {{0.0, 0.5*M_PI, 0.0, 0.0}, {M_PI, 0.5*M_PI, 0.0, 0.0}},
+};
+static int32_t s_loaded = 0;
+static uint64_t s_id = 0;
+
+static inline double
+hermite_eval(const hermite_tbl_t * t, double x, double * dy)
+{
+	const double * c;
+	int32_t i = (int32_t)(x * t->inv_h);
+
+	if (i >= t->n) {
+		c = t->c[t->n];
+		x -= t->x_max;
+		*dy = c[1];
+		return c[0] + c[1]*x;
+	}
+	i = (i < 0) ? 0 : i;
+	c = t->c[i];
+	x -= i * t->h;
+	*dy = (3.0*c[3]*x + 2.0*c[2])*x + c[1];
+
+	return ((c[3]*x + c[2])*x + c[1])*x + c[0];
+}
+
+static void
+hermite_build(hermite_tbl_t * t, const double * v, const double * m, int32_t n, double x_max)
+{
+	double h = x_max / n;
+	int32_t i;
+
+	t->n = n;
+	t->x_max = x_max;
+	t->h = h;
+	t->inv_h = 1.0 / h;
+	for (i=0; i<n; i++) {
+		double s = (v[i+1] - v[i]) / h;
+		t->c[i][0] = v[i];
+		t->c[i][1] = m[i];
+		t->c[i][2] = (3.0*s - 2.0*m[i] - m[i+1]) / h;
+		t->c[i][3] = (m[i] + m[i+1] - 2.0*s) / (h*h);
+	}
+	t->c[n][0] = v[n];
+	t->c[n][1] = m[n];
+	t->c[n][2] = 0.0;
+	t->c[n][3] = 0.0;
+}
+
+/* Value and slope of the source at x */
+static double
+source_eval(const curve_src_t * src, double x, double * dy)
+{
+	double y = 0.0;
+	double a, b, h;
+	int32_t lo, hi, i;
+
+	if (src->ncoefs > 0) {
+		*dy = 0.0;
+		for (i=src->ncoefs-1; i>=0; i--) {
+			*dy = *dy*x + y;
+			y = y*x + src->coefs[i];
+		}
+		*dy = *dy*x + y;
+		return y*x;
+	}
+
+	lo = 0;
+	hi = src->n - 1;
+	while (hi - lo > 1) {
+		i = (lo + hi) / 2;
+		if (src->x[i] > x) {
+			hi = i;
+		}
+		else {
+			lo = i;
+		}
+	}
+	h = src->x[hi] - src->x[lo];
+	a = src->x[hi] - x;
+	b = x - src->x[lo];
+	*dy = (-src->m[lo]*a*a + src->m[hi]*b*b) / (2.0*h)
+		+ (src->y[hi] - src->y[lo]) / h - (src->m[hi] - src->m[lo]) * h / 6.0;
+
+	return (src->m[lo]*a*a*a + src->m[hi]*b*b*b) / (6.0*h)
+		+ (src->y[lo]/h - src->m[lo]*h/6.0)*a + (src->y[hi]/h - src->m[hi]*h/6.0)*b;
+}
+
+/**
+ * Second derivatives of the spline through the samples: zero at the
+ * first, and at the last the slope of the parabola through the last
+ * three. Tridiagonal, solved in place in m with d as scratch.
+ */
+static void
+spline_moments(const double * x, const double * y, double * m, double * d, int32_t n)
+{
+	double h1 = x[n-2] - x[n-3];
+	double h2 = x[n-1] - x[n-2];
+	double s2 = (y[n-1] - y[n-2]) / h2;
+	double slope = s2 + (s2 - (y[n-2] - y[n-3])/h1) * h2/(h1 + h2);
+	double diag, rhs;
+	int32_t i;
+
+	/* forward sweep; m[i] holds the modified upper diagonal */
+	m[0] = 0.0;
+	d[0] = 0.0;
+	for (i=1; i<n; i++) {
+		double hl = x[i] - x[i-1];
+		double hr = (i < n-1) ? x[i+1] - x[i] : 0.0;
+
+		if (i < n-1) {
+			diag = 2.0*(hl + hr);
+			rhs = 6.0*((y[i+1] - y[i])/hr - (y[i] - y[i-1])/hl);
+		}
+		else {
+			diag = 2.0*hl;
+			rhs = 6.0*(slope - (y[i] - y[i-1])/hl);
+		}
+		diag -= hl*m[i-1];
+		m[i] = hr / diag;
+		d[i] = (rhs - hl*d[i-1]) / diag;
+	}
+
+	/* back substitution */
+	m[n-1] = d[n-1];
+	for (i=n-2; i>0; i--) {
+		m[i] = d[i] - m[i]*m[i+1];
+	}
+	m[0] = 0.0;
+}
+
+static uint64_t
+fnv1a64(const void * data, size_t len)
+{
+	const uint8_t * p = data;
+	uint64_t h = 0xcbf29ce484222325ull;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+/**
+ * Resample the source into the forward and inverse tables on
+ * [0, x_max] and install them. The curve must rise throughout.
+ */
+static int
+install(const curve_src_t * src, double x_max)
+{
+	static hermite_tbl_t fwd;
+	static hermite_tbl_t inv;
+	double v[CURVE_INTERVALS+1];
+	double m[CURVE_INTERVALS+1];
+	double r_max;
+	int32_t i, k;
+
+	for (i=0; i<=CURVE_INTERVALS; i++) {
+		v[i] = source_eval(src, x_max*i/CURVE_INTERVALS, &m[i]);
+		if (m[i] <= 0.0 || (i > 0 && v[i] <= v[i-1])) {
+			fprintf(stderr, "Lens curve does not rise at %.2f degrees\n",
+					x_max*i/CURVE_INTERVALS * (180.0/M_PI));
+			return -1;
+		}
+	}
+	hermite_build(&fwd, v, m, CURVE_INTERVALS, x_max);
+
+	/* inverse knots by bisection on the forward table */
+	r_max = v[CURVE_INTERVALS];
+	for (i=0; i<=CURVE_INTERVALS; i++) {
+		double r = r_max*i/CURVE_INTERVALS;
+		double lo = 0.0, hi = x_max;
+		double dy;
+
+		for (k=0; k<64; k++) {
+			double mid = 0.5*(lo + hi);
+			if (hermite_eval(&fwd, mid, &dy) < r) {
+				lo = mid;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		v[i] = 0.5*(lo + hi);
+		hermite_eval(&fwd, v[i], &dy);
+		m[i] = 1.0 / dy;
+	}
+	hermite_build(&inv, v, m, CURVE_INTERVALS, r_max);
+
+	s_fwd = fwd;
+	s_inv = inv;
+	s_loaded = 1;
+	s_id = fnv1a64(&s_fwd, sizeof(s_fwd));
+
+	return 0;
+}
+
+/**
+ * Install a curve through samples of the radius r at angles theta
+ * (radians, increasing). The origin is added when theta[0] > 0.
+ */
+int
+lens_curve_from_samples(const double * theta, const double * r, int32_t n)
+{
+	curve_src_t src;
+	double * buf;
+	int32_t off = (n > 0 && theta[0] > 0.0) ? 1 : 0;
+	int32_t i;
+	int rc;
+
+	if (n + off < 3) {
+		fprintf(stderr, "Lens curve needs at least 3 samples\n");
+		return -1;
+	}
+	for (i=0; i<n; i++) {
+		if (theta[i] < 0.0 || (i > 0 && theta[i] <= theta[i-1])) {
+			fprintf(stderr, "Lens curve angles must be positive and increasing\n");
+			return -1;
+		}
+	}
+
+	buf = malloc(sizeof(double)*(n + off)*4);
+	if (buf == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+	memset(&src, 0, sizeof(src));
+	src.n = n + off;
+	src.x = buf;
+	src.y = buf + src.n;
+	src.m = buf + 2*src.n;
+	buf[0] = 0.0;
+	buf[src.n] = 0.0;
+	memcpy(buf + off, theta, sizeof(double)*n);
+	memcpy(buf + src.n + off, r, sizeof(double)*n);
+	spline_moments(src.x, src.y, src.m, buf + 3*src.n, src.n);
+
+	rc = install(&src, theta[n-1]);
+	free(buf);
+
+	return rc;
+}
+
+/**
+ * Install the curve r = c[0] t + c[1] t^2 + ..., tabulated on
+ * [0, theta_max].
+ */
+int
+lens_curve_from_poly(const double * c, int32_t nc, double theta_max)
+{
+	curve_src_t src;
+
+	if (nc < 1 || nc > LENS_CURVE_MAX_COEFS || theta_max <= 0.0) {
+		fprintf(stderr, "Lens curve needs 1 to %d coefficients and a positive range\n",
+				LENS_CURVE_MAX_COEFS);
+		return -1;
+	}
+	memset(&src, 0, sizeof(src));
+	src.ncoefs = nc;
+	memcpy(src.coefs, c, sizeof(double)*nc);
+
+	return install(&src, theta_max);
+}
+
+/**
+ * Read a curve file (see above) and install it.
+ */
+int
+lens_curve_load(const char * path)
+{
+	double coefs[LENS_CURVE_MAX_COEFS];
+	double * theta = NULL;
+	double * r = NULL;
+	double max_deg = 90.0;
+	int32_t nc = 0, n = 0, cap = 0;
+	int32_t lineno = 0;
+	char line[CURVE_MAX_LINE];
+	int rc = 0;
+	FILE * fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return -1;
+	}
+
+	while (rc == 0 && fgets(line, sizeof(line), fp) != NULL) {
+		char * p = strchr(line, '#');
+		double a, b;
+		int len;
+
+		lineno++;
+		if (strchr(line, '\n') == NULL && !feof(fp)) {
+			fprintf(stderr, "%s:%d: line too long\n", path, lineno);
+			rc = -1;
+			break;
+		}
+		if (p != NULL) {
+			*p = '\0';
+		}
+		p = line + strspn(line, " \t\r\n");
+		if (*p == '\0') {
+			continue;
+		}
+
+		if (strncmp(p, "max", 3) == 0 && sscanf(p+3, "%lf", &max_deg) == 1) {
+			continue;
+		}
+		if (strncmp(p, "poly", 4) == 0) {
+			p += 4;
+			while (nc < LENS_CURVE_MAX_COEFS && sscanf(p, "%lf%n", &coefs[nc], &len) == 1) {
+				p += len;
+				nc++;
+			}
+			p += strspn(p, " \t\r\n");
+			if (*p != '\0') {
+				if (nc == LENS_CURVE_MAX_COEFS) {
+					fprintf(stderr, "%s:%d: more than %d coefficients\n", path, lineno, LENS_CURVE_MAX_COEFS);
+				}
+				else {
+					fprintf(stderr, "%s:%d: expected a coefficient\n", path, lineno);
+				}
+				rc = -1;
+				break;
+			}
+			continue;
+		}
+		if (sscanf(p, "%lf %lf", &a, &b) != 2) {
+			fprintf(stderr, "%s:%d: expected \"theta r\", \"poly c1 c2 ...\" or \"max theta\"\n",
+					path, lineno);
+			rc = -1;
+			break;
+		}
+		if (n == cap) {
+			double * t2;
+			double * r2;
+			cap = (cap > 0) ? cap*2 : 64;
+			t2 = realloc(theta, sizeof(double)*cap);
+			theta = (t2 != NULL) ? t2 : theta;
+			r2 = realloc(r, sizeof(double)*cap);
+			r = (r2 != NULL) ? r2 : r;
+			if (t2 == NULL || r2 == NULL) {
+				fprintf(stderr, "Failed to allocate memory...\n");
+				rc = -1;
+				break;
+			}
+		}
+		theta[n] = a * (M_PI/180.0);
+		r[n] = b;
+		n++;
+	}
+	fclose(fp);
+
+	if (rc == 0) {
+		if ((nc > 0) == (n > 0)) {
+			fprintf(stderr, "%s: give either samples or poly coefficients\n", path);
+			rc = -1;
+		}
+		else if (nc > 0) {
+			rc = lens_curve_from_poly(coefs, nc, max_deg * (M_PI/180.0));
+		}
+		else {
+			rc = lens_curve_from_samples(theta, r, n);
+		}
+	}
+	free(theta);
+	free(r);
+
+	return rc;
+}
+
+int
+lens_curve_loaded(void)
+{
+	return s_loaded;
+}
+
+/**
+ * Identifies the installed curve, e.g. in cache keys; 0 for the default.
+ */
+uint64_t
+lens_curve_id(void)
+{
+	return s_id;
+}
+
+double
+lens_curve_theta_to_radius(double th)
+{
+	double dy;
+	return hermite_eval(&s_fwd, th, &dy);
+}
+
+void
+lens_curve_theta_to_radius_array(const double * th, double * r, int32_t n)
+{
+	double dy;
+	int32_t i;
+
+	for (i=0; i<n; i++) {
+		r[i] = hermite_eval(&s_fwd, th[i], &dy);
+	}
+}
+
+/**
+ * Inverse of lens_curve_theta_to_radius(). Negative radii give 0.
+ */
+double
+lens_curve_radius_to_theta(double r)
+{
+	double dth, dy, y, th;
+
+	r = (r < 0.0) ? 0.0 : r;
+	th = hermite_eval(&s_inv, r, &dth);
+	y = hermite_eval(&s_fwd, th, &dy);
+	th -= (y - r) / dy;
+
+	return (th < 0.0) ? 0.0 : th;
+}
+
+void
+lens_curve_radius_to_theta_array(const double * r, double * th, int32_t n)
+{
+	int32_t i;
+
+	for (i=0; i<n; i++) {
+		th[i] = lens_curve_radius_to_theta(r[i]);
+	}
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
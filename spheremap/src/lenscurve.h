@@ -0,0 +1,37 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lenscurve.h
+ * @brief Lens projection curve loaded at run time (LENS_CURVE).
+ *
+ */
+
+#ifndef SPHERE_LENSCURVE_H_
+#define SPHERE_LENSCURVE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define  LENS_CURVE_MAX_COEFS  (16)
+
+extern int lens_curve_load(const char * path);
+extern int lens_curve_from_samples(const double * theta, const double * r, int32_t n);
+extern int lens_curve_from_poly(const double * c, int32_t nc, double theta_max);
+extern int lens_curve_loaded(void);
+extern uint64_t lens_curve_id(void);
+extern double lens_curve_theta_to_radius(double th);
+extern void lens_curve_theta_to_radius_array(const double * th, double * r, int32_t n);
+extern double lens_curve_radius_to_theta(double r);
+extern void lens_curve_radius_to_theta_array(const double * r, double * th, int32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_LENSCURVE_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
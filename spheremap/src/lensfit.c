@@ -0,0 +1,513 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lensfit.c
+ * @brief Projection model fitting from pixel / ray angle correspondences.
+ *
+ * Every model predicts the image radius of an observation as a linear
+ * combination of basis values that depend on theta alone: r*f(theta)
+ * for the fixed projections, and odd powers of theta for the free
+ * polynomial. For a given lens center the best coefficients are then a
+ * small linear least squares problem whose Gram matrix does not depend
+ * on the center, so a grid of centers is searched in closed form, one
+ * pass over the observations per grid point for all models together.
+ * The best grid point of each model is refined by Levenberg-Marquardt
+ * on the radial residuals, center and coefficients jointly.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "pool.h"
+#include "lensfit.h"
+
+#define  FIXED_MODELS   (LENS_FIT_POLY)
+#define  BASIS_COLS     (FIXED_MODELS + LENS_FIT_POLY_TERMS)
+#define  MAX_PARAMS     (2 + LENS_FIT_POLY_TERMS)
+#define  GRID_SIZE      (33)		/* centers per axis */
+#define  GRID_SPAN      (0.125)		/* half width, of the largest observed radius */
+#define  LM_ITERATIONS  (100)
+#define  POLY_GAIN      (0.9)		/* rms the polynomial must beat to be chosen */
+
+typedef struct {
+	const lens_obs_t * obs;
+	int32_t n;
+	double * basis;					/* BASIS_COLS per observation */
+	double gram[BASIS_COLS][BASIS_COLS];
+	double poly_inv[LENS_FIT_POLY_TERMS][LENS_FIT_POLY_TERMS];
+	vec2_t origin;					/* grid corner */
+	double step;
+	double * row_sse;				/* per grid row and model */
+	vec2_t * row_ctr;
+	lens_fit_t * fits;
+} fit_job_t;
+
+/* Columns of the basis a model combines */
+static void
+model_cols(int32_t model, int32_t * col, int32_t * ncols)
+{
+	if (model == LENS_FIT_POLY) {
+		*col = FIXED_MODELS;
+		*ncols = LENS_FIT_POLY_TERMS;
+	}
+	else {
+		*col = model;
+		*ncols = 1;
+	}
+}
+
+/**
+ * Solve a x = b in place by Gaussian elimination with partial pivoting;
+ * b receives x. Returns -1 if a is singular.
+ */
+static int
+solve(double a[MAX_PARAMS][MAX_PARAMS], double * b, int32_t n)
+{
+	int32_t i, j, k;
+
+	for (i=0; i<n; i++) {
+		int32_t p = i;
+
+		for (k=i+1; k<n; k++) {
+			if (fabs(a[k][i]) > fabs(a[p][i])) {
+				p = k;
+			}
+		}
+		if (fabs(a[p][i]) < 1e-300) {
+			return -1;
+		}
+		if (p != i) {
+			double t;
+			for (j=0; j<n; j++) {
+				t = a[i][j];
+				a[i][j] = a[p][j];
+				a[p][j] = t;
+			}
+			t = b[i];
+			b[i] = b[p];
+			b[p] = t;
+		}
+		for (k=i+1; k<n; k++) {
+			double f = a[k][i] / a[i][i];
+			for (j=i; j<n; j++) {
+				a[k][j] -= f*a[i][j];
+			}
+			b[k] -= f*b[i];
+		}
+	}
+	for (i=n-1; i>=0; i--) {
+		for (j=i+1; j<n; j++) {
+			b[i] -= a[i][j]*b[j];
+		}
+		b[i] /= a[i][i];
+	}
+
+	return 0;
+}
+
+/* Closed-form coefficients at the center the sums were taken around */
+static double
+best_coefs(const fit_job_t * job, int32_t model, const double * db, double dd, double * k)
+{
+	double sse = dd;
+	int32_t i, j;
+
+	if (model == LENS_FIT_POLY) {
+		for (i=0; i<LENS_FIT_POLY_TERMS; i++) {
+			k[i] = 0.0;
+			for (j=0; j<LENS_FIT_POLY_TERMS; j++) {
+				k[i] += job->poly_inv[i][j]*db[FIXED_MODELS + j];
+			}
+			sse -= k[i]*db[FIXED_MODELS + i];
+		}
+	}
+	else {
+		k[0] = db[model] / job->gram[model][model];
+		sse -= k[0]*db[model];
+	}
+
+	return sse;
+}
+
+/* Sums of d^2 and d * basis over the observations, d = |p - ctr| */
+static double
+center_sums(const fit_job_t * job, vec2_t ctr, double * db)
+{
+	double dd = 0.0;
+	int32_t i, j;
+
+	for (j=0; j<BASIS_COLS; j++) {
+		db[j] = 0.0;
+	}
+	for (i=0; i<job->n; i++) {
+		const double * b = job->basis + (size_t)i*BASIS_COLS;
+		double dx = job->obs[i].p.x - ctr.x;
+		double dy = job->obs[i].p.y - ctr.y;
+		double d = sqrt(dx*dx + dy*dy);
+
+		dd += d*d;
+		for (j=0; j<BASIS_COLS; j++) {
+			db[j] += d*b[j];
+		}
+	}
+
+	return dd;
+}
+
+/* Pool task: one row of the center grid, all models */
+static void
+grid_row(void * arg, int32_t task, int32_t worker)
+{
+	fit_job_t * job = arg;
+	double * sse = job->row_sse + (size_t)task*LENS_FIT_MODELS;
+	vec2_t * best = job->row_ctr + (size_t)task*LENS_FIT_MODELS;
+	int32_t gx, m;
+
+	(void)worker;
+	for (m=0; m<LENS_FIT_MODELS; m++) {
+		sse[m] = HUGE_VAL;
+	}
+	for (gx=0; gx<GRID_SIZE; gx++) {
+		vec2_t ctr = vec2(job->origin.x + gx*job->step, job->origin.y + task*job->step);
+		double db[BASIS_COLS];
+		double k[LENS_FIT_POLY_TERMS];
+		double dd = center_sums(job, ctr, db);
+
+		for (m=0; m<LENS_FIT_MODELS; m++) {
+			double s = best_coefs(job, m, db, dd, k);
+			if (s < sse[m]) {
+				sse[m] = s;
+				best[m] = ctr;
+			}
+		}
+	}
+}
+
+/* Sum of squared radial residuals and the largest one */
+static double
+model_sse(const fit_job_t * job, int32_t model, vec2_t ctr, const double * k, double * max)
+{
+	double sse = 0.0;
+	int32_t col, ncols;
+	int32_t i, j;
+
+	model_cols(model, &col, &ncols);
+	*max = 0.0;
+	for (i=0; i<job->n; i++) {
+		const double * b = job->basis + (size_t)i*BASIS_COLS + col;
+		double e = hypot(job->obs[i].p.x - ctr.x, job->obs[i].p.y - ctr.y);
+
+		for (j=0; j<ncols; j++) {
+			e -= k[j]*b[j];
+		}
+		sse += e*e;
+		if (fabs(e) > *max) {
+			*max = fabs(e);
+		}
+	}
+
+	return sse;
+}
+
+/**
+ * Levenberg-Marquardt on (center, coefficients) from the given start.
+ * Returns the number of accepted steps.
+ */
+static int32_t
+refine_model(const fit_job_t * job, int32_t model, vec2_t * ctr, double * k, double * sse)
+{
+	int32_t col, ncols, np;
+	double lambda = 1e-3;
+	double max;
+	int32_t it, steps = 0;
+
+	model_cols(model, &col, &ncols);
+	np = 2 + ncols;
+	*sse = model_sse(job, model, *ctr, k, &max);
+
+	for (it=0; it<LM_ITERATIONS; it++) {
+		double a[MAX_PARAMS][MAX_PARAMS] = {{0}};
+		double g[MAX_PARAMS] = {0};
+		double gain = 0.0;
+		int32_t accepted;
+		int32_t i, p, q;
+
+		for (i=0; i<job->n; i++) {
+			const double * b = job->basis + (size_t)i*BASIS_COLS + col;
+			double dx = job->obs[i].p.x - ctr->x;
+			double dy = job->obs[i].p.y - ctr->y;
+			double d = hypot(dx, dy);
+			double jac[MAX_PARAMS];
+			double e = d;
+
+			if (d < 1e-9) {
+				continue;
+			}
+			/* d(e)/d(cx, cy, k...) */
+			jac[0] = -dx/d;
+			jac[1] = -dy/d;
+			for (p=0; p<ncols; p++) {
+				jac[2+p] = -b[p];
+				e -= k[p]*b[p];
+			}
+			for (p=0; p<np; p++) {
+				for (q=0; q<np; q++) {
+					a[p][q] += jac[p]*jac[q];
+				}
+				g[p] -= jac[p]*e;
+			}
+		}
+
+		/* raise the damping until a step lowers the error */
+		accepted = 0;
+		while (!accepted && lambda < 1e12) {
+			double t[MAX_PARAMS][MAX_PARAMS];
+			double delta[MAX_PARAMS];
+			double trial_k[LENS_FIT_POLY_TERMS];
+			vec2_t trial_c;
+			double s;
+
+			for (p=0; p<np; p++) {
+				for (q=0; q<np; q++) {
+					t[p][q] = a[p][q];
+				}
+				t[p][p] += lambda*a[p][p];
+				delta[p] = g[p];
+			}
+			if (solve(t, delta, np) == 0) {
+				trial_c = vec2(ctr->x + delta[0], ctr->y + delta[1]);
+				for (p=0; p<ncols; p++) {
+					trial_k[p] = k[p] + delta[2+p];
+				}
+				s = model_sse(job, model, trial_c, trial_k, &max);
+				if (s < *sse) {
+					gain = *sse - s;
+					*sse = s;
+					*ctr = trial_c;
+					memcpy(k, trial_k, sizeof(double)*ncols);
+					accepted = 1;
+				}
+			}
+			if (!accepted) {
+				lambda *= 10.0;
+			}
+		}
+		if (!accepted) {
+			break;
+		}
+		steps++;
+		lambda *= 0.1;
+		if (gain <= 1e-12 * *sse) {
+			break;
+		}
+	}
+
+	return steps;
+}
+
+/* Pool task: refine one model from its best grid point */
+static void
+refine_task(void * arg, int32_t task, int32_t worker)
+{
+	fit_job_t * job = arg;
+	lens_fit_t * fit = &job->fits[task];
+	double sse = HUGE_VAL;
+	double db[BASIS_COLS];
+	double k[LENS_FIT_POLY_TERMS];
+	vec2_t ctr = vec2(0.0, 0.0);
+	double dd, max;
+	int32_t row, i;
+
+	(void)worker;
+	for (row=0; row<GRID_SIZE; row++) {
+		if (job->row_sse[(size_t)row*LENS_FIT_MODELS + task] < sse) {
+			sse = job->row_sse[(size_t)row*LENS_FIT_MODELS + task];
+			ctr = job->row_ctr[(size_t)row*LENS_FIT_MODELS + task];
+		}
+	}
+	dd = center_sums(job, ctr, db);
+	best_coefs(job, task, db, dd, k);
+	fit->iterations = refine_model(job, task, &ctr, k, &sse);
+
+	model_sse(job, task, ctr, k, &max);
+	fit->rms = sqrt(sse / job->n);
+	fit->max = max;
+	fit->lens.center = ctr;
+	memset(fit->poly, 0, sizeof(fit->poly));
+	if (task == LENS_FIT_POLY) {
+		/* normalize to the radius at theta = pi/2 */
+		double r = 0.0;
+		double t = M_PI/2.0;
+		for (i=0; i<LENS_FIT_POLY_TERMS; i++) {
+			r += k[i]*t;
+			t *= (M_PI/2.0)*(M_PI/2.0);
+		}
+		fit->lens.type = LENS_CURVE;
+		fit->lens.r = r;
+		for (i=0; i<LENS_FIT_POLY_TERMS; i++) {
+			fit->poly[i] = (r != 0.0) ? k[i]/r : 0.0;
+		}
+	}
+	else {
+		fit->lens.type = (lens_type_t)task;
+		fit->lens.r = k[0];
+	}
+}
+
+/**
+ * Fit every projection model and the free polynomial to n observations.
+ * fits receives LENS_FIT_MODELS entries, indexed by lens_type_t and then
+ * LENS_FIT_POLY. Returns the index of the lowest residual, where the
+ * polynomial, having more freedom, has to beat the best fixed model by
+ * a margin; -1 on error.
+ */
+int
+lens_fit_models(lens_fit_t * fits, const lens_obs_t * obs, int32_t n, pool_t * pool)
+{
+	fit_job_t job;
+	double * theta;
+	double * col;
+	double span = 0.0;
+	double inv[MAX_PARAMS][MAX_PARAMS];
+	int32_t best = -1;
+	int ok = 1;
+	int32_t i, j, m;
+
+	if (n < MAX_PARAMS*2) {
+		fprintf(stderr, "lens_fit_models: too few correspondences (%d)\n", n);
+		return -1;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.obs = obs;
+	job.n = n;
+	job.fits = fits;
+	job.basis = malloc(sizeof(double)*BASIS_COLS*n);
+	job.row_sse = malloc(sizeof(double)*GRID_SIZE*LENS_FIT_MODELS);
+	job.row_ctr = malloc(sizeof(vec2_t)*GRID_SIZE*LENS_FIT_MODELS);
+	theta = malloc(sizeof(double)*n*2);
+	if (job.basis == NULL || job.row_sse == NULL || job.row_ctr == NULL || theta == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(job.basis);
+		free(job.row_sse);
+		free(job.row_ctr);
+		free(theta);
+		return -1;
+	}
+	col = theta + n;
+
+	/* basis values, and the extent of the observations for the grid */
+	for (i=0; i<n; i++) {
+		double r = hypot(obs[i].p.x, obs[i].p.y);
+		double t = obs[i].theta;
+		double t2 = t*t;
+
+		theta[i] = t;
+		for (j=0; j<LENS_FIT_POLY_TERMS; j++) {
+			job.basis[(size_t)i*BASIS_COLS + FIXED_MODELS + j] = t;
+			t *= t2;
+		}
+		span = (r > span) ? r : span;
+	}
+	for (m=0; m<FIXED_MODELS; m++) {
+		lens_theta_to_radius_array((lens_type_t)m, theta, col, n);
+		for (i=0; i<n; i++) {
+			job.basis[(size_t)i*BASIS_COLS + m] = col[i];
+		}
+	}
+	for (i=0; i<n; i++) {
+		const double * b = job.basis + (size_t)i*BASIS_COLS;
+		for (m=0; m<BASIS_COLS; m++) {
+			for (j=0; j<BASIS_COLS; j++) {
+				job.gram[m][j] += b[m]*b[j];
+			}
+		}
+	}
+	free(theta);
+
+	/* the polynomial block is inverted once, column by column */
+	for (j=0; j<LENS_FIT_POLY_TERMS && ok; j++) {
+		double e[MAX_PARAMS] = {0};
+		e[j] = 1.0;
+		for (i=0; i<LENS_FIT_POLY_TERMS; i++) {
+			for (m=0; m<LENS_FIT_POLY_TERMS; m++) {
+				inv[i][m] = job.gram[FIXED_MODELS + i][FIXED_MODELS + m];
+			}
+		}
+		ok = (solve(inv, e, LENS_FIT_POLY_TERMS) == 0);
+		for (i=0; i<LENS_FIT_POLY_TERMS; i++) {
+			job.poly_inv[i][j] = e[i];
+		}
+	}
+	for (m=0; m<FIXED_MODELS; m++) {
+		ok = ok && job.gram[m][m] > 0.0;
+	}
+	if (!ok || span <= 0.0) {
+		fprintf(stderr, "lens_fit_models: correspondences do not constrain the models\n");
+	}
+	else {
+		job.step = 2.0*GRID_SPAN*span/(GRID_SIZE - 1);
+		job.origin = vec2(-GRID_SPAN*span, -GRID_SPAN*span);
+		pool_run(pool, GRID_SIZE, grid_row, &job);
+		pool_run(pool, LENS_FIT_MODELS, refine_task, &job);
+
+		for (m=0; m<FIXED_MODELS; m++) {
+			if (best < 0 || fits[m].rms < fits[best].rms) {
+				best = m;
+			}
+		}
+		if (fits[LENS_FIT_POLY].rms < POLY_GAIN*fits[best].rms) {
+			best = LENS_FIT_POLY;
+		}
+	}
+
+	free(job.basis);
+	free(job.row_sse);
+	free(job.row_ctr);
+
+	return best;
+}
+
+/**
+ * Image radius in pixels the fitted model gives a ray at theta.
+ */
+double
+lens_fit_radius(const lens_fit_t * fits, int32_t model, double theta)
+{
+	const lens_fit_t * fit = &fits[model];
+	double sr = 0.0;
+	double t = theta;
+	int32_t i;
+
+	if (model != LENS_FIT_POLY) {
+		return fit->lens.r * lens_theta_to_radius(fit->lens.type, theta);
+	}
+	for (i=0; i<LENS_FIT_POLY_TERMS; i++) {
+		sr += fit->poly[i]*t;
+		t *= theta*theta;
+	}
+
+	return fit->lens.r * sr;
+}
+
+const char *
+lens_fit_model_name(int32_t model)
+{
+	if (model == LENS_FIT_POLY) {
+		return "Polynomial";
+	}
+
+	return lens_type_name((lens_type_t)model);
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,58 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lensfit.h
+ * @brief Projection model fitting from pixel / ray angle correspondences.
+ *
+ */
+
+#ifndef SPHERE_LENSFIT_H_
+#define SPHERE_LENSFIT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define  LENS_FIT_POLY_TERMS  (4)
+#define  LENS_FIT_POLY        (LENS_CURVE)		/* index of the polynomial fit */
+#define  LENS_FIT_MODELS      (LENS_FIT_POLY + 1)
+
+/**
+ * One correspondence: a pixel as an offset from the image center (the
+ * convention of lens_param_t.center) and the known angle of its ray
+ * from the optical axis, in radians.
+ */
+typedef struct {
+	vec2_t p;
+	double theta;
+} lens_obs_t;
+
+/**
+ * Fit of one model. For the fixed projections lens is ready to use as
+ * is. The free model maps theta to
+ * lens.r * sum(poly[j] * theta^(2j+1)), normalized so that theta = pi/2
+ * lands on lens.r like the fixed ones. Its lens.type is LENS_CURVE:
+ * install the coefficients with lens_curve_from_poly() to use it.
+ */
+typedef struct {
+	lens_param_t lens;
+	double poly[LENS_FIT_POLY_TERMS];
+	double rms;					/* radial residual, px */
+	double max;
+	int32_t iterations;			/* Levenberg-Marquardt steps taken */
+} lens_fit_t;
+
+extern int lens_fit_models(lens_fit_t * fits, const lens_obs_t * obs, int32_t n, pool_t * pool);
+extern double lens_fit_radius(const lens_fit_t * fits, int32_t model, double theta);
+extern const char * lens_fit_model_name(int32_t model);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_LENSFIT_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,1005 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lut.c
+ * @brief Precomputed remap lookup tables and their on-disk cache.
+ *
+ * Cache files are named after a 64-bit FNV-1a hash of their header, which
+ * holds every parameter the table depends on. The header is compared in
+ * full after loading, so a hash collision only costs a rebuild.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "lenscurve.h"
+#include "remap.h"
+#include "pool.h"
+#include "tilesrc.h"
+#include "lut.h"
+
+#define LUT_MAGIC   (0x54554c46u)	/* "FLUT" */
+#define LUT_VERSION (4)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	int32_t format;
+	int32_t lens_type;
+	int32_t projection;
+	double lens_r;
+	uint64_t curve_id;
+	double center_x;
+	double center_y;
+	double yaw;
+	double pitch;
+	double fovY;
+	int32_t width;
+	int32_t height;
+	int32_t src_width;
+	int32_t src_height;
+} lut_header_t;
+
+static void
+make_header(lut_header_t * hdr, remap_lut_format_t format,
+			const lens_param_t * lens, const view_param_t * view, int32_t src_w, int32_t src_h)
+{
+	/* zero the padding too, the header is hashed as raw bytes */
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = LUT_MAGIC;
+	hdr->version = LUT_VERSION;
+	hdr->format = (int32_t)format;
+	hdr->lens_type = (int32_t)lens->type;
+	hdr->projection = (int32_t)view->projection;
+	hdr->lens_r = lens->r;
+	hdr->curve_id = (lens->type == LENS_CURVE) ? lens_curve_id( ) : 0;
+	hdr->center_x = lens->center.x;
+	hdr->center_y = lens->center.y;
+	hdr->yaw = view->yaw;
+	hdr->pitch = view->pitch;
+	hdr->fovY = view->fovY;
+	hdr->width = view->width;
+	hdr->height = view->height;
+	hdr->src_width = src_w;
+	hdr->src_height = src_h;
+}
+
+static uint64_t
+fnv1a64(const void * data, size_t len)
+{
+	const uint8_t * p = data;
+	uint64_t h = 0xcbf29ce484222325ull;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+static size_t
+entry_size(remap_lut_format_t format)
+{
+	switch (format) {
+	case REMAP_LUT_FIXED:
+		return 2*sizeof(int16_t) + sizeof(uint16_t);
+	case REMAP_LUT_TILED:
+		return sizeof(uint32_t) + 2*sizeof(int16_t) + sizeof(uint16_t);
+	default:
+		return 2*sizeof(float);
+	}
+}
+
+/* Start of the table's entries: the block set_entries() was given */
+static const void *
+entries(const remap_lut_t * lut)
+{
+	switch (lut->format) {
+	case REMAP_LUT_FIXED:
+		return lut->ixy;
+	case REMAP_LUT_TILED:
+		return lut->tile;
+	default:
+		return lut->sxy;
+	}
+}
+
+/* Point the table at its entries, which start at data */
+static void
+set_entries(remap_lut_t * lut, const void * data)
+{
+	size_t n = (size_t)lut->width*lut->height;
+
+	lut->sxy = NULL;
+	lut->ixy = NULL;
+	lut->frac = NULL;
+	lut->tile = NULL;
+	if (lut->format == REMAP_LUT_FIXED) {
+		lut->ixy = data;
+		lut->frac = (const uint16_t *)(lut->ixy + 2*n);
+	}
+	else if (lut->format == REMAP_LUT_TILED) {
+		lut->tile = data;
+		lut->ixy = (const int16_t *)(lut->tile + n);
+		lut->frac = (const uint16_t *)(lut->ixy + 2*n);
+	}
+	else {
+		lut->sxy = data;
+	}
+}
+
+/**
+ * remap_quantize_row() for REMAP_LUT_TILED: the same pixels and
+ * fractions, with the integer pixel split into its source tile and the
+ * offset within it, so that no coordinate is limited to 16 bits.
+ */
+static void
+quantize_row_tiled(uint32_t * tile, int16_t * ixy, uint16_t * frac, const float * sxy, int32_t n,
+				   int32_t src_w, int32_t src_h)
+{
+	const uint32_t tiles_x = (src_w + TILE_SRC_SIZE - 1) >> TILE_SRC_SHIFT;
+	int32_t x;
+
+	for (x=0; x<n; x++) {
+		float sx = sxy[2*x+0];
+		float sy = sxy[2*x+1];
+
+		if (sx >= 0.0f && sy >= 0.0f && sx < (float)(src_w - 1) && sy < (float)(src_h - 1)) {
+			int32_t xi = (int32_t)(sx*256.0f);
+			int32_t yi = (int32_t)(sy*256.0f);
+			tile[x] = (uint32_t)(yi >> (8 + TILE_SRC_SHIFT))*tiles_x + (uint32_t)(xi >> (8 + TILE_SRC_SHIFT));
+			ixy[2*x+0] = (int16_t)((xi >> 8) & (TILE_SRC_SIZE - 1));
+			ixy[2*x+1] = (int16_t)((yi >> 8) & (TILE_SRC_SIZE - 1));
+			frac[x] = (uint16_t)(((yi & 0xff) << 8) | (xi & 0xff));
+		}
+		else {
+			tile[x] = UINT32_MAX;
+			ixy[2*x+0] = -1;
+			ixy[2*x+1] = -1;
+			frac[x] = 0;
+		}
+	}
+}
+
+typedef struct {
+	const remap_lut_t * lut;
+	float * scratch;
+	const lens_param_t * lens;
+	const view_param_t * view;
+} build_job_t;
+
+static void
+build_row(void * arg, int32_t y, int32_t worker)
+{
+	build_job_t * job = arg;
+	const remap_lut_t * lut = job->lut;
+	size_t row = (size_t)y*lut->width;
+
+	if (lut->format == REMAP_LUT_FIXED) {
+		float * sxy = job->scratch + (size_t)2*worker*lut->width;
+		remap_project_row(sxy, job->lens, job->view, lut->src_width, lut->src_height, y);
+		remap_quantize_row((int16_t *)lut->ixy + 2*row, (uint16_t *)lut->frac + row,
+						   sxy, lut->width, lut->src_width, lut->src_height);
+	}
+	else if (lut->format == REMAP_LUT_TILED) {
+		float * sxy = job->scratch + (size_t)2*worker*lut->width;
+		remap_project_row(sxy, job->lens, job->view, lut->src_width, lut->src_height, y);
+		quantize_row_tiled((uint32_t *)lut->tile + row, (int16_t *)lut->ixy + 2*row,
+						   (uint16_t *)lut->frac + row, sxy, lut->width, lut->src_width, lut->src_height);
+	}
+	else {
+		remap_project_row((float *)lut->sxy + 2*row, job->lens, job->view,
+						  lut->src_width, lut->src_height, y);
+	}
+}
+
+/**
+ * Compute the table one row per task; rows crossing the rim of the
+ * image circle cost more and are balanced by work stealing. Fixed-point
+ * and tiled tables are quantized row by row, so the float table never
+ * exists in full.
+ */
+int
+remap_lut_build(remap_lut_t * lut, pool_t * pool, remap_lut_format_t format,
+				const lens_param_t * lens, const view_param_t * view,
+				int32_t src_w, int32_t src_h)
+{
+	build_job_t job;
+	void * data;
+
+	if (format == REMAP_LUT_FIXED && (src_w > 32767 || src_h > 32767)) {
+		fprintf(stderr, "remap_lut_build: source too large for a fixed-point table, "
+				"use a tiled one\n");
+		return -1;
+	}
+	/* the 8-bit fractions still go through int32 */
+	if (src_w > (INT32_MAX >> 8) || src_h > (INT32_MAX >> 8)) {
+		fprintf(stderr, "remap_lut_build: source too large\n");
+		return -1;
+	}
+
+	data = malloc(entry_size(format)*view->width*view->height);
+	job.scratch = NULL;
+	if (format != REMAP_LUT_FLOAT) {
+		job.scratch = malloc(sizeof(float)*2*view->width*pool_size(pool));
+	}
+	if (data == NULL || (format != REMAP_LUT_FLOAT && job.scratch == NULL)) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(job.scratch);
+		free(data);
+		return -1;
+	}
+
+	lut->width = view->width;
+	lut->height = view->height;
+	lut->src_width = src_w;
+	lut->src_height = src_h;
+	lut->format = format;
+	lut->map_base = NULL;
+	lut->map_len = 0;
+	lut->mapped = 0;
+	set_entries(lut, data);
+
+	/* resolve the span kernel before any worker can race on it */
+	lens_span_kernel(lens->type);
+
+	job.lut = lut;
+	job.lens = lens;
+	job.view = view;
+	pool_run(pool, view->height, build_row, &job);
+
+	free(job.scratch);
+
+	return 0;
+}
+
+void
+remap_lut_free(remap_lut_t * lut)
+{
+	if (lut->mapped) {
+#ifndef _WIN32
+		munmap(lut->map_base, lut->map_len);
+#else
+		free(lut->map_base);
+#endif
+	}
+	else {
+		free((void *)entries(lut));
+	}
+	lut->sxy = NULL;
+	lut->ixy = NULL;
+	lut->frac = NULL;
+	lut->tile = NULL;
+	lut->map_base = NULL;
+	lut->map_len = 0;
+	lut->mapped = 0;
+}
+
+static int
+map_cache_file(remap_lut_t * lut, const char_t * path, const lut_header_t * hdr)
+{
+	size_t len = sizeof(*hdr) + entry_size(hdr->format)*hdr->width*hdr->height;
+	void * base;
+	FILE * fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		return -1;
+	}
+
+#ifndef _WIN32
+	{
+		struct stat st;
+		if (fstat(fileno(fp), &st) < 0 || (size_t)st.st_size != len) {
+			fclose(fp);
+			return -1;
+		}
+		base = mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(fp), 0);
+		fclose(fp);
+		if (base == MAP_FAILED) {
+			return -1;
+		}
+	}
+#else
+	base = malloc(len);
+	if (base == NULL || fread(base, 1, len, fp) != len) {
+		free(base);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+#endif
+
+	lut->format = hdr->format;
+	lut->map_base = base;
+	lut->map_len = len;
+	lut->mapped = 1;
+
+	if (memcmp(base, hdr, sizeof(*hdr)) != 0) {
+		remap_lut_free(lut);
+		return -1;
+	}
+
+	lut->width = hdr->width;
+	lut->height = hdr->height;
+	lut->src_width = hdr->src_width;
+	lut->src_height = hdr->src_height;
+	set_entries(lut, (const uint8_t *)base + sizeof(*hdr));
+
+	return 0;
+}
+
+static int
+write_cache_file(const remap_lut_t * lut, const char_t * path, const lut_header_t * hdr)
+{
+	size_t len = entry_size(lut->format)*lut->width*lut->height;
+	const void * data = entries(lut);
+	char_t tmp[4096];
+	FILE * fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+	tmp[sizeof(tmp)-1] = 0;
+
+	fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to create %s\n", tmp);
+		return -1;
+	}
+
+	if (fwrite(hdr, sizeof(*hdr), 1, fp) != 1 ||
+		fwrite(data, 1, len, fp) != len) {
+		fprintf(stderr, "Failed to write %s\n", tmp);
+		fclose(fp);
+		remove(tmp);
+		return -1;
+	}
+
+	if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+		fprintf(stderr, "Failed to store %s\n", path);
+		remove(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Map the table for the given parameters from cache_dir, or build it and
+ * store it there for the next run. A failure to write the cache is not
+ * fatal; the freshly built table is returned either way.
+ */
+int
+remap_lut_load_cached(remap_lut_t * lut, pool_t * pool, remap_lut_format_t format,
+					  const char_t * cache_dir,
+					  const lens_param_t * lens, const view_param_t * view,
+					  int32_t src_w, int32_t src_h)
+{
+	lut_header_t hdr;
+	char_t path[4000];
+
+	make_header(&hdr, format, lens, view, src_w, src_h);
+	snprintf(path, sizeof(path), "%s/%016llx.lut", cache_dir,
+			 (unsigned long long)fnv1a64(&hdr, sizeof(hdr)));
+	path[sizeof(path)-1] = 0;
+
+	if (map_cache_file(lut, path, &hdr) == 0) {
+		return 0;
+	}
+
+	if (remap_lut_build(lut, pool, format, lens, view, src_w, src_h) < 0) {
+		return -1;
+	}
+
+#ifndef _WIN32
+	if (mkdir(cache_dir, 0777) < 0 && errno != EEXIST) {
+#else
+	if (mkdir(cache_dir) < 0 && errno != EEXIST) {
+#endif
+		fprintf(stderr, "Failed to create cache directory %s\n", cache_dir);
+		return 0;
+	}
+	write_cache_file(lut, path, &hdr);
+
+	return 0;
+}
+
+/**
+ * Sample one REMAP_TILE_W x REMAP_TILE_H output tile of the table.
+ */
+static void
+sample_tile(image_t * dst, const image_t * src, const remap_lut_t * lut, int32_t tile)
+{
+	int32_t tiles_x = (lut->width + REMAP_TILE_W - 1) / REMAP_TILE_W;
+	int32_t x0 = (tile % tiles_x)*REMAP_TILE_W;
+	int32_t y0 = (tile / tiles_x)*REMAP_TILE_H;
+	int32_t x1 = (x0 + REMAP_TILE_W < lut->width) ? x0 + REMAP_TILE_W : lut->width;
+	int32_t y1 = (y0 + REMAP_TILE_H < lut->height) ? y0 + REMAP_TILE_H : lut->height;
+	int32_t nc = src->channels;
+	int32_t y;
+
+	for (y=y0; y<y1; y++) {
+		uint8_t * row = dst->pixels + (size_t)y*dst->stride + x0*nc;
+		size_t k = (size_t)y*lut->width + x0;
+
+		if (lut->format == REMAP_LUT_FIXED) {
+			remap_sample_row_fixed(row, src, lut->ixy + 2*k, lut->frac + k, x1 - x0);
+		}
+		else {
+			remap_sample_row(row, src, lut->sxy + 2*k, x1 - x0);
+		}
+	}
+}
+
+typedef struct {
+	image_t * dst;
+	const image_t * src;
+	const remap_lut_t * lut;
+} apply_job_t;
+
+static void
+apply_tile(void * arg, int32_t task, int32_t worker)
+{
+	apply_job_t * job = arg;
+
+	sample_tile(job->dst, job->src, job->lut, task);
+}
+
+/**
+ * Remap a frame through the table, split into REMAP_TILE_W x REMAP_TILE_H
+ * tiles. A NULL pool processes the tiles on the calling thread.
+ */
+int
+remap_lut_apply(image_t * dst, const image_t * src, const remap_lut_t * lut, pool_t * pool)
+{
+	apply_job_t job;
+	int32_t tiles_x, tiles_y;
+
+	if (lut->format == REMAP_LUT_TILED || dst->channels != src->channels ||
+		dst->width != lut->width || dst->height != lut->height ||
+		src->width != lut->src_width || src->height != lut->src_height) {
+		fprintf(stderr, "remap_lut_apply: image does not match the table\n");
+		return -1;
+	}
+
+	/* select the kernel before any worker can race on it */
+	remap_sample_row(dst->pixels, src, lut->sxy, 0);
+
+	job.dst = dst;
+	job.src = src;
+	job.lut = lut;
+	tiles_x = (lut->width + REMAP_TILE_W - 1) / REMAP_TILE_W;
+	tiles_y = (lut->height + REMAP_TILE_H - 1) / REMAP_TILE_H;
+	pool_run(pool, tiles_x*tiles_y, apply_tile, &job);
+
+	return 0;
+}
+
+/* Output pixels sampled per kernel call in the tiled remap */
+#define  TILED_BATCH  (256)
+
+typedef struct {
+	image_t * dst;				/* one per table */
+	tile_source_t * src;
+	const remap_lut_t * luts;
+	const uint32_t * base;		/* per table, first index into order */
+	int32_t tiles_x;
+	const int32_t * tasks;		/* non-empty source tiles */
+	const uint32_t * start;		/* per source tile, into order */
+	const uint32_t * order;		/* output pixels of all tables by source tile */
+	int16_t * ixy;				/* per worker, TILED_BATCH entries */
+	uint16_t * frac;
+	uint8_t * out;
+	int32_t failed;
+} tiled_job_t;
+
+static void
+apply_source_tile(void * arg, int32_t task, int32_t worker)
+{
+	tiled_job_t * job = arg;
+	const int32_t t = job->tasks[task];
+	const int32_t tx = t % job->tiles_x;
+	const int32_t ty = t / job->tiles_x;
+	const int32_t nc = job->dst->channels;
+	const uint32_t end = job->start[t+1];
+	int16_t * ixy = job->ixy + 2*TILED_BATCH*worker;
+	uint16_t * frac = job->frac + TILED_BATCH*worker;
+	uint8_t * out = job->out + TILED_BATCH*nc*worker;
+	const image_t * tile;
+	uint32_t i, j, n;
+	int32_t v = 0;
+
+	tile = tile_source_acquire(job->src, tx, ty);
+	if (tile == NULL) {
+		job->failed = 1;
+		return;
+	}
+
+	for (i=job->start[t]; i<end; i+=n) {
+		const remap_lut_t * lut;
+		image_t * dst;
+		int32_t ox, oy;
+
+		/* the pixels of a source tile are in table order; a batch stays in one */
+		while (job->order[i] >= job->base[v+1]) {
+			v++;
+		}
+		lut = &job->luts[v];
+		dst = &job->dst[v];
+		/* tiled tables are relative to the tile already */
+		ox = (lut->format == REMAP_LUT_FIXED) ? tx << TILE_SRC_SHIFT : 0;
+		oy = (lut->format == REMAP_LUT_FIXED) ? ty << TILE_SRC_SHIFT : 0;
+
+		/* shift the coordinates into the tile */
+		for (n=0; n<TILED_BATCH && i+n<end && job->order[i+n] < job->base[v+1]; n++) {
+			uint32_t k = job->order[i+n] - job->base[v];
+			ixy[2*n+0] = lut->ixy[2*k+0] - ox;
+			ixy[2*n+1] = lut->ixy[2*k+1] - oy;
+			frac[n] = lut->frac[k];
+		}
+		remap_sample_row_fixed(out, tile, ixy, frac, n);
+
+		for (j=0; j<n; j++) {
+			uint32_t k = job->order[i+j] - job->base[v];
+			memcpy(dst->pixels + (size_t)(k / lut->width)*dst->stride + (k % lut->width)*nc,
+				   out + j*nc, nc);
+		}
+	}
+
+	tile_source_release(job->src, tx, ty);
+}
+
+/* Source tile output pixel k samples from, or -1 outside the source */
+static inline int32_t
+source_tile(const remap_lut_t * lut, size_t k, int32_t tiles_x)
+{
+	if (lut->format == REMAP_LUT_TILED) {
+		return (lut->tile[k] == UINT32_MAX) ? -1 : (int32_t)lut->tile[k];
+	}
+	if (lut->ixy[2*k+0] < 0) {
+		return -1;
+	}
+	return (lut->ixy[2*k+1] >> TILE_SRC_SHIFT)*tiles_x + (lut->ixy[2*k+0] >> TILE_SRC_SHIFT);
+}
+
+/**
+ * Remap nluts tables from a tiled source in one pass. Output pixels of
+ * every table are sorted by the source tile their sample starts in, and
+ * every source tile with pixels is one pool task, so each tile is read
+ * once per call however many tables need it and the cache only needs a
+ * tile per worker. Tasks go in row-major tile order, keeping the workers
+ * on neighbouring parts of the file. The tables must be fixed-point or
+ * tiled and match dst and the source; the callers check.
+ */
+static int
+apply_tiled(image_t * dst, tile_source_t * src, const remap_lut_t * luts, int32_t nluts, pool_t * pool)
+{
+	tile_source_info_t info;
+	tiled_job_t job;
+	uint32_t * base;
+	uint32_t * start;
+	uint32_t * order;
+	int32_t * tasks;
+	int32_t ntiles;
+	int32_t ntasks = 0;
+	int32_t nworkers = pool_size(pool);
+	size_t total = 0;
+	size_t k;
+	int32_t t, v;
+
+	for (v=0; v<nluts; v++) {
+		total += (size_t)luts[v].width*luts[v].height;
+	}
+	if (total > UINT32_MAX) {
+		fprintf(stderr, "remap: output too large for a tiled source\n");
+		return -1;
+	}
+
+	tile_source_get_info(src, &info);
+	ntiles = info.tiles_x*info.tiles_y;
+	base = malloc(sizeof(uint32_t)*(nluts + 1));
+	start = calloc(ntiles + 1, sizeof(uint32_t));
+	order = malloc(sizeof(uint32_t)*total);
+	tasks = malloc(sizeof(int32_t)*ntiles);
+	job.ixy = malloc(sizeof(int16_t)*2*TILED_BATCH*nworkers);
+	job.frac = malloc(sizeof(uint16_t)*TILED_BATCH*nworkers);
+	job.out = malloc((size_t)TILED_BATCH*dst->channels*nworkers);
+	if (base == NULL || start == NULL || order == NULL || tasks == NULL ||
+		job.ixy == NULL || job.frac == NULL || job.out == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(base);
+		free(start);
+		free(order);
+		free(tasks);
+		free(job.ixy);
+		free(job.frac);
+		free(job.out);
+		return -1;
+	}
+
+	base[0] = 0;
+	for (v=0; v<nluts; v++) {
+		base[v+1] = base[v] + (uint32_t)luts[v].width*luts[v].height;
+	}
+
+	/* counting sort of the output pixels by source tile */
+	for (v=0; v<nluts; v++) {
+		const remap_lut_t * lut = &luts[v];
+		size_t n = (size_t)lut->width*lut->height;
+
+		for (k=0; k<n; k++) {
+			int32_t st = source_tile(lut, k, info.tiles_x);
+
+			if (st < 0) {
+				memset(dst[v].pixels + (k / lut->width)*dst[v].stride + (k % lut->width)*dst[v].channels,
+					   0, dst[v].channels);
+				continue;
+			}
+			start[st + 1]++;
+		}
+	}
+	for (t=0; t<ntiles; t++) {
+		if (start[t+1] > 0) {
+			tasks[ntasks++] = t;
+		}
+		start[t+1] += start[t];
+	}
+	for (v=0; v<nluts; v++) {
+		const remap_lut_t * lut = &luts[v];
+		size_t n = (size_t)lut->width*lut->height;
+
+		for (k=0; k<n; k++) {
+			int32_t st = source_tile(lut, k, info.tiles_x);
+
+			if (st >= 0) {
+				order[start[st]++] = base[v] + (uint32_t)k;
+			}
+		}
+	}
+	/* the scatter advanced every start to the next tile's */
+	for (t=ntiles; t>0; t--) {
+		start[t] = start[t-1];
+	}
+	start[0] = 0;
+
+	/* select the kernel before any worker can race on it */
+	remap_sample_row_fixed(job.out, dst, job.ixy, job.frac, 0);
+
+	job.dst = dst;
+	job.src = src;
+	job.luts = luts;
+	job.base = base;
+	job.tiles_x = info.tiles_x;
+	job.tasks = tasks;
+	job.start = start;
+	job.order = order;
+	job.failed = 0;
+	pool_run(pool, ntasks, apply_source_tile, &job);
+
+	free(base);
+	free(start);
+	free(order);
+	free(tasks);
+	free(job.ixy);
+	free(job.frac);
+	free(job.out);
+
+	return job.failed ? -1 : 0;
+}
+
+static int
+tiled_matches(const image_t * dst, const tile_source_info_t * info, const remap_lut_t * lut)
+{
+	return (lut->format == REMAP_LUT_FIXED || lut->format == REMAP_LUT_TILED) &&
+		dst->channels == info->channels &&
+		dst->width == lut->width && dst->height == lut->height &&
+		info->width == lut->src_width && info->height == lut->src_height;
+}
+
+/**
+ * Remap from a tiled source, reading each source tile once. Fixed-point
+ * or tiled tables only; sources past 32767 pixels need a tiled one.
+ */
+int
+remap_lut_apply_tiled(image_t * dst, tile_source_t * src, const remap_lut_t * lut, pool_t * pool)
+{
+	tile_source_info_t info;
+
+	tile_source_get_info(src, &info);
+	if (!tiled_matches(dst, &info, lut)) {
+		fprintf(stderr, "remap_lut_apply_tiled: image does not match the table\n");
+		return -1;
+	}
+
+	return apply_tiled(dst, src, lut, 1, pool);
+}
+
+/* Source blocks the view schedule is ordered by, 64 x 64 pixels */
+#define  SCHED_SHIFT  (6)
+/* Output pixels a tile's source position is estimated from, every 8th each way */
+#define  SCHED_STEP   (8)
+
+typedef struct {
+	uint32_t key;
+	int32_t view;
+	int32_t tile;
+} sched_entry_t;
+
+/**
+ * Interleave the bits of two 16-bit block coordinates (Z order), so
+ * that nearby blocks get nearby keys in both directions.
+ */
+static uint32_t
+morton2(uint32_t x, uint32_t y)
+{
+	x = (x | (x << 8)) & 0x00ff00ffu;
+	x = (x | (x << 4)) & 0x0f0f0f0fu;
+	x = (x | (x << 2)) & 0x33333333u;
+	x = (x | (x << 1)) & 0x55555555u;
+	y = (y | (y << 8)) & 0x00ff00ffu;
+	y = (y | (y << 4)) & 0x0f0f0f0fu;
+	y = (y | (y << 2)) & 0x33333333u;
+	y = (y | (y << 1)) & 0x55555555u;
+
+	return x | (y << 1);
+}
+
+/**
+ * Schedule key of an output tile: the Z order of the source block under
+ * the mean of its sampled source positions. Tiles that read nothing
+ * only clear their pixels and go last.
+ */
+static uint32_t
+tile_key(const remap_lut_t * lut, int32_t tile)
+{
+	int32_t tiles_x = (lut->width + REMAP_TILE_W - 1) / REMAP_TILE_W;
+	int32_t x0 = (tile % tiles_x)*REMAP_TILE_W;
+	int32_t y0 = (tile / tiles_x)*REMAP_TILE_H;
+	int32_t x1 = (x0 + REMAP_TILE_W < lut->width) ? x0 + REMAP_TILE_W : lut->width;
+	int32_t y1 = (y0 + REMAP_TILE_H < lut->height) ? y0 + REMAP_TILE_H : lut->height;
+	double sx = 0.0, sy = 0.0;
+	int32_t n = 0;
+	int32_t x, y;
+	uint32_t bx, by;
+
+	for (y=y0; y<y1; y+=SCHED_STEP) {
+		for (x=x0; x<x1; x+=SCHED_STEP) {
+			size_t k = (size_t)y*lut->width + x;
+			double px, py;
+
+			if (lut->format == REMAP_LUT_FIXED) {
+				px = lut->ixy[2*k+0];
+				py = lut->ixy[2*k+1];
+			}
+			else if (lut->format == REMAP_LUT_TILED) {
+				uint32_t src_tiles_x = (lut->src_width + TILE_SRC_SIZE - 1) >> TILE_SRC_SHIFT;
+				if (lut->tile[k] == UINT32_MAX) {
+					continue;
+				}
+				px = (double)(((lut->tile[k] % src_tiles_x) << TILE_SRC_SHIFT) + lut->ixy[2*k+0]);
+				py = (double)(((lut->tile[k] / src_tiles_x) << TILE_SRC_SHIFT) + lut->ixy[2*k+1]);
+			}
+			else {
+				px = lut->sxy[2*k+0];
+				py = lut->sxy[2*k+1];
+			}
+			if (px >= 0.0 && py >= 0.0 && px < lut->src_width && py < lut->src_height) {
+				sx += px;
+				sy += py;
+				n++;
+			}
+		}
+	}
+	if (n == 0) {
+		return UINT32_MAX;
+	}
+
+	bx = (uint32_t)(sx/n) >> SCHED_SHIFT;
+	by = (uint32_t)(sy/n) >> SCHED_SHIFT;
+
+	return morton2((bx < 0xffff) ? bx : 0xffff, (by < 0xffff) ? by : 0xffff);
+}
+
+static int
+compare_sched(const void * a, const void * b)
+{
+	const sched_entry_t * p = a;
+	const sched_entry_t * q = b;
+
+	if (p->key != q->key) {
+		return (p->key < q->key) ? -1 : 1;
+	}
+	if (p->view != q->view) {
+		return p->view - q->view;
+	}
+	return p->tile - q->tile;
+}
+
+/**
+ * Build (or, with a cache_dir, load) one table per view and the shared
+ * tile schedule. The schedule only depends on the tables, so it is made
+ * once here and every frame just runs it.
+ */
+int
+remap_views_build(remap_views_t * views, pool_t * pool, remap_lut_format_t format,
+				  const char_t * cache_dir, const lens_param_t * lens,
+				  const view_param_t * view, int32_t nviews, int32_t src_w, int32_t src_h)
+{
+	sched_entry_t * sched;
+	int32_t ntasks = 0;
+	int32_t i, v, t;
+
+	views->nviews = 0;
+	views->ntasks = 0;
+	views->tasks = NULL;
+	views->luts = malloc(sizeof(remap_lut_t)*nviews);
+	if (views->luts == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	for (v=0; v<nviews; v++) {
+		int rc;
+
+		if (cache_dir != NULL) {
+			rc = remap_lut_load_cached(&views->luts[v], pool, format, cache_dir,
+									   lens, &view[v], src_w, src_h);
+		}
+		else {
+			rc = remap_lut_build(&views->luts[v], pool, format, lens, &view[v], src_w, src_h);
+		}
+		if (rc < 0) {
+			remap_views_free(views);
+			return -1;
+		}
+		views->nviews++;
+		ntasks += ((view[v].width + REMAP_TILE_W - 1) / REMAP_TILE_W)*
+			((view[v].height + REMAP_TILE_H - 1) / REMAP_TILE_H);
+	}
+
+	sched = malloc(sizeof(sched_entry_t)*ntasks);
+	views->tasks = malloc(sizeof(int32_t)*2*ntasks);
+	if (sched == NULL || views->tasks == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(sched);
+		remap_views_free(views);
+		return -1;
+	}
+
+	i = 0;
+	for (v=0; v<nviews; v++) {
+		const remap_lut_t * lut = &views->luts[v];
+		int32_t n = ((lut->width + REMAP_TILE_W - 1) / REMAP_TILE_W)*
+			((lut->height + REMAP_TILE_H - 1) / REMAP_TILE_H);
+
+		for (t=0; t<n; t++) {
+			sched[i].key = tile_key(lut, t);
+			sched[i].view = v;
+			sched[i].tile = t;
+			i++;
+		}
+	}
+	qsort(sched, ntasks, sizeof(sched_entry_t), compare_sched);
+
+	for (i=0; i<ntasks; i++) {
+		views->tasks[2*i+0] = sched[i].view;
+		views->tasks[2*i+1] = sched[i].tile;
+	}
+	views->ntasks = ntasks;
+	free(sched);
+
+	return 0;
+}
+
+void
+remap_views_free(remap_views_t * views)
+{
+	int32_t v;
+
+	for (v=0; v<views->nviews; v++) {
+		remap_lut_free(&views->luts[v]);
+	}
+	free(views->luts);
+	free(views->tasks);
+	views->luts = NULL;
+	views->tasks = NULL;
+	views->nviews = 0;
+	views->ntasks = 0;
+}
+
+typedef struct {
+	image_t * dst;
+	const image_t * src;
+	const remap_views_t * views;
+} views_job_t;
+
+static void
+apply_view_tile(void * arg, int32_t task, int32_t worker)
+{
+	views_job_t * job = arg;
+	int32_t v = job->views->tasks[2*task+0];
+
+	sample_tile(&job->dst[v], job->src, &job->views->luts[v], job->views->tasks[2*task+1]);
+}
+
+/**
+ * Remap one frame into every view, dst[i] receiving view i. All tiles
+ * of all views run as one pool job in schedule order; the pool hands
+ * each worker a contiguous run of it, so a worker stays on one area of
+ * the source across views.
+ */
+int
+remap_views_apply(image_t * dst, const image_t * src, const remap_views_t * views, pool_t * pool)
+{
+	views_job_t job;
+	int32_t v;
+
+	for (v=0; v<views->nviews; v++) {
+		const remap_lut_t * lut = &views->luts[v];
+
+		if (lut->format == REMAP_LUT_TILED || dst[v].channels != src->channels ||
+			dst[v].width != lut->width || dst[v].height != lut->height ||
+			src->width != lut->src_width || src->height != lut->src_height) {
+			fprintf(stderr, "remap_views_apply: image %d does not match its table\n", v);
+			return -1;
+		}
+	}
+	if (views->nviews == 0) {
+		return 0;
+	}
+
+	/* select the kernel before any worker can race on it */
+	remap_sample_row(dst[0].pixels, src, views->luts[0].sxy, 0);
+
+	job.dst = dst;
+	job.src = src;
+	job.views = views;
+	pool_run(pool, views->ntasks, apply_view_tile, &job);
+
+	return 0;
+}
+
+/**
+ * Remap one frame from a tiled source into every view, dst[i] receiving
+ * view i. The pixels of all views are gathered by source tile, so each
+ * tile is read once for all of them. Fixed-point or tiled tables only.
+ */
+int
+remap_views_apply_tiled(image_t * dst, tile_source_t * src, const remap_views_t * views,
+						pool_t * pool)
+{
+	tile_source_info_t info;
+	int32_t v;
+
+	tile_source_get_info(src, &info);
+	for (v=0; v<views->nviews; v++) {
+		if (!tiled_matches(&dst[v], &info, &views->luts[v])) {
+			fprintf(stderr, "remap_views_apply_tiled: image %d does not match its table\n", v);
+			return -1;
+		}
+	}
+	if (views->nviews == 0) {
+		return 0;
+	}
+
+	return apply_tiled(dst, src, views->luts, views->nviews, pool);
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,93 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file lut.h
+ * @brief Precomputed remap lookup tables and their on-disk cache.
+ *
+ */
+
+#ifndef SPHERE_LUT_H_
+#define SPHERE_LUT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	REMAP_LUT_FLOAT = 0,	/* float (x, y), 8 bytes per pixel */
+	REMAP_LUT_FIXED,		/* int16 (x, y) + 8-bit fractions, 6 bytes per pixel */
+	REMAP_LUT_TILED,		/* source tile + int16 (x, y) in it + fractions, 10 bytes */
+} remap_lut_format_t;
+
+/**
+ * Source (x, y) coordinate pair for every output pixel, row major.
+ * REMAP_LUT_FLOAT tables fill sxy; REMAP_LUT_FIXED tables fill ixy and
+ * frac as produced by remap_quantize_row(), which limits the source to
+ * 32767 pixels each way. REMAP_LUT_TILED tables, for tiled sources of
+ * any size, also fill tile with the TILE_SRC_SIZE tile each sample
+ * starts in (UINT32_MAX outside the source) and keep ixy relative to
+ * it. When the table came from the cache, they point into a read-only
+ * mapping of the cache file.
+ */
+typedef struct {
+	int32_t width;
+	int32_t height;
+	int32_t src_width;
+	int32_t src_height;
+	remap_lut_format_t format;
+	const float * sxy;
+	const int16_t * ixy;
+	const uint16_t * frac;
+	const uint32_t * tile;
+	void * map_base;
+	size_t map_len;
+	int32_t mapped;
+} remap_lut_t;
+
+/* Output tile processed as one pool task */
+#define  REMAP_TILE_W  (128)
+#define  REMAP_TILE_H  (32)
+
+/**
+ * Several views of one lens remapped together. Each view keeps its own
+ * table; their output tiles form one schedule ordered by the part of
+ * the source they read, so views that look at the same area sample it
+ * back to back while it is still in cache.
+ */
+typedef struct {
+	int32_t nviews;
+	remap_lut_t * luts;
+	int32_t ntasks;
+	int32_t * tasks;			/* (view, output tile) pairs in schedule order */
+} remap_views_t;
+
+extern int remap_lut_build(remap_lut_t * lut, pool_t * pool, remap_lut_format_t format,
+						   const lens_param_t * lens, const view_param_t * view,
+						   int32_t src_w, int32_t src_h);
+extern int remap_lut_load_cached(remap_lut_t * lut, pool_t * pool, remap_lut_format_t format,
+								 const char_t * cache_dir,
+								 const lens_param_t * lens, const view_param_t * view,
+								 int32_t src_w, int32_t src_h);
+extern void remap_lut_free(remap_lut_t * lut);
+extern int remap_lut_apply(image_t * dst, const image_t * src, const remap_lut_t * lut, pool_t * pool);
+extern int remap_lut_apply_tiled(image_t * dst, tile_source_t * src, const remap_lut_t * lut,
+								 pool_t * pool);
+extern int remap_views_build(remap_views_t * views, pool_t * pool, remap_lut_format_t format,
+							 const char_t * cache_dir, const lens_param_t * lens,
+							 const view_param_t * view, int32_t nviews, int32_t src_w, int32_t src_h);
+extern void remap_views_free(remap_views_t * views);
+extern int remap_views_apply(image_t * dst, const image_t * src, const remap_views_t * views,
+							 pool_t * pool);
+extern int remap_views_apply_tiled(image_t * dst, tile_source_t * src, const remap_views_t * views,
+								   pool_t * pool);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_LUT_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -12,6 +12,9 @@ extern "C" {
 #endif
 
 extern double madoka_theta_to_radius(double th);
+extern void madoka_theta_to_radius_array(const double * th, double * r, int32_t n);
+extern double madoka_radius_to_theta(double r);
+extern void madoka_radius_to_theta_array(const double * r, double * th, int32_t n);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,134 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file madoka_avx2.c
+ * @brief AVX2 MADOKA evaluation, 4 angles per iteration.
+ *
+ * Built with -mavx2 but without FMA, so every Horner step rounds exactly
+ * like the scalar code and the results are bit-identical.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "common.h"
+#include "madoka.h"
+#include "madoka_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* lo and hi are read with aligned loads: keep them first and aligned */
+typedef struct {
+	double lo[MADOKA_NTERMS+1][4] __attribute__((aligned(32)));
+	double hi[MADOKA_NTERMS+1][4] __attribute__((aligned(32)));
+	__m256d b[MADOKA_NSEGS-1];
+	const double * tbl;
+} madoka_soa_t;
+
+static inline __m256d
+eval4(const madoka_soa_t * t, __m256d x)
+{
+	__m256i seg = _mm256_setzero_si256( );
+	__m256i perm, sel;
+	__m256d w;
+	int32_t s, k;
+
+	/* segment = number of bounds below x; the compare yields -1 per hit */
+	for (s=0; s<MADOKA_NSEGS-1; s++) {
+		seg = _mm256_sub_epi64(seg, _mm256_castpd_si256(_mm256_cmp_pd(x, t->b[s], _CMP_GT_OQ)));
+	}
+
+	/* neighbouring angles usually share a segment: broadcast its terms */
+	if (_mm256_movemask_pd(_mm256_castsi256_pd(
+							   _mm256_cmpeq_epi64(seg, _mm256_permute4x64_epi64(seg, 0)))) == 0xf) {
+		const double * c = t->tbl + _mm256_extract_epi64(seg, 0)*(MADOKA_NTERMS+1);
+		x = _mm256_sub_pd(x, _mm256_broadcast_sd(&c[0]));
+		w = _mm256_broadcast_sd(&c[MADOKA_NTERMS]);
+		for (k=MADOKA_NTERMS-1; k>0; k--) {
+			w = _mm256_add_pd(_mm256_mul_pd(w, x), _mm256_broadcast_sd(&c[k]));
+		}
+		return w;
+	}
+
+	/* 32-bit permute indices (2*seg, 2*seg+1) and the high-half selector */
+	perm = _mm256_and_si256(_mm256_add_epi64(seg, seg), _mm256_set1_epi64x(6));
+	perm = _mm256_or_si256(perm, _mm256_slli_epi64(_mm256_add_epi64(perm, _mm256_set1_epi64x(1)), 32));
+	sel = _mm256_cmpgt_epi64(seg, _mm256_set1_epi64x(3));
+
+#define SELECT(k) _mm256_blendv_pd(														\
+		_mm256_castsi256_pd(_mm256_permutevar8x32_epi32(_mm256_load_si256((const __m256i *)t->lo[k]), perm)), \
+		_mm256_castsi256_pd(_mm256_permutevar8x32_epi32(_mm256_load_si256((const __m256i *)t->hi[k]), perm)), \
+		_mm256_castsi256_pd(sel))
+
+	x = _mm256_sub_pd(x, SELECT(0));
+	w = SELECT(MADOKA_NTERMS);
+	for (k=MADOKA_NTERMS-1; k>0; k--) {
+		w = _mm256_add_pd(_mm256_mul_pd(w, x), SELECT(k));
+	}
+
+#undef SELECT
+
+	return w;
+}
+
+void
+madoka_array_avx2(const double * tbl, const double * bounds,
+				  const double * th, double * r, int32_t n)
+{
+	/*
+	 * Coefficients transposed to one row per term, segments 0-3 in the
+	 * low vector and 4-5 in the high one, so that a term is selected with
+	 * two permutes and a blend instead of a gather.
+	 */
+	madoka_soa_t t __attribute__((aligned(32)));
+	int32_t i, k, s;
+
+	t.tbl = tbl;
+	for (k=0; k<MADOKA_NTERMS+1; k++) {
+		for (s=0; s<4; s++) {
+			t.lo[k][s] = tbl[s*(MADOKA_NTERMS+1) + k];
+			t.hi[k][s] = (s+4 < MADOKA_NSEGS) ? tbl[(s+4)*(MADOKA_NTERMS+1) + k] : 0.0;
+		}
+	}
+	for (s=0; s<MADOKA_NSEGS-1; s++) {
+		t.b[s] = _mm256_set1_pd(bounds[s]);
+	}
+
+	for (i=0; i+8<=n; i+=8) {
+		__m256d w0 = eval4(&t, _mm256_loadu_pd(th + i));
+		__m256d w1 = eval4(&t, _mm256_loadu_pd(th + i + 4));
+		_mm256_storeu_pd(r + i, w0);
+		_mm256_storeu_pd(r + i + 4, w1);
+	}
+	for (; i+4<=n; i+=4) {
+		_mm256_storeu_pd(r + i, eval4(&t, _mm256_loadu_pd(th + i)));
+	}
+
+	for (; i<n; i++) {
+		r[i] = madoka_theta_to_radius(th[i]);
+	}
+}
+
+#else
+
+void
+madoka_array_avx2(const double * tbl, const double * bounds,
+				  const double * th, double * r, int32_t n)
+{
+	int32_t i;
+
+	for (i=0; i<n; i++) {
+		r[i] = madoka_theta_to_radius(th[i]);
+	}
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,35 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file madoka_kernel.h
+ * @brief Vector kernels behind madoka_theta_to_radius_array().
+ *
+ */
+
+#ifndef SPHERE_MADOKA_KERNEL_H_
+#define SPHERE_MADOKA_KERNEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define  MADOKA_NSEGS   (6)
+#define  MADOKA_NTERMS  (17)
+
+/**
+ * tbl holds MADOKA_NSEGS records of (x_off, c[0..MADOKA_NTERMS-1]),
+ * bounds the MADOKA_NSEGS-1 upper segment limits (inclusive).
+ */
+extern void madoka_array_avx2(const double * tbl, const double * bounds,
+							  const double * th, double * r, int32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_MADOKA_KERNEL_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -9,6 +9,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
 #include <math.h>
 
 #include <SDL.h>
@@ -18,8 +20,13 @@
 #include "common.h"
 #include "vector.h"
 #include "lens.h"
-#include "madoka.h"
+#include "lenscurve.h"
+#include "mesh.h"
+#include "meshbuf.h"
+#include "meshworker.h"
 #include "textwin.h"
+#include "texset.h"
+#include "trace.h"
 
 
 static void
@@ -28,7 +35,7 @@ toggle_lens_type(lens_param_t * lens, int fw)
 	lens_type_t nxt_type = LENS_EQUISOLID;
 	switch (lens->type) {
 	case LENS_STEREOGRAPHIC:
-		nxt_type = fw ? LENS_EQUIDISTANT : LENS_MADOKA;
+		nxt_type = fw ? LENS_EQUIDISTANT : (lens_curve_loaded( ) ? LENS_CURVE : LENS_MADOKA);
 		break;
 
 	case LENS_EQUIDISTANT:
@@ -44,7 +51,11 @@ toggle_lens_type(lens_param_t * lens, int fw)
 		break;
 
 	case LENS_MADOKA:
-		nxt_type = fw ? LENS_STEREOGRAPHIC : LENS_ORTHOGONAL;
+		nxt_type = fw ? (lens_curve_loaded( ) ? LENS_CURVE : LENS_STEREOGRAPHIC) : LENS_ORTHOGONAL;
+		break;
+
+	case LENS_CURVE:
+		nxt_type = fw ? LENS_STEREOGRAPHIC : LENS_MADOKA;
 		break;
 	}
 
@@ -52,278 +63,95 @@ toggle_lens_type(lens_param_t * lens, int fw)
 }
 
 
-static GLuint
-LoadTexture(char_t * tex_name)
+/**
+ * Frame timing: render plus swap per frame, and from the first input
+ * event of a batch to the end of the swap that shows it.
+ */
+typedef struct {
+	double t_start;
+	clock_t cpu_start;
+	int32_t frames;
+	double frame_sum;
+	double frame_max;
+	int32_t inputs;
+	double latency_sum;
+	double latency_max;
+} frame_stats_t;
+
+static double
+now_sec(void)
 {
-	GLuint tex_num;
-
-	SDL_Surface * bmp_img;
-
-	glGenTextures(1, &tex_num);
-
-	bmp_img = (SDL_Surface *) IMG_Load(tex_name);
-	
-	if (bmp_img != NULL) {
-		SDL_Surface * tex_img = SDL_CreateRGBSurface(SDL_SWSURFACE, 2048, 2048, 24,
-													 0x000000ff, 0x0000ff00, 0x00ff0000, 0x00000000);
-
-		SDL_FillRect(tex_img, NULL, 0x00ff0000);
-
-		{
-			SDL_Rect dst_rect;
-			dst_rect.x = (2048 - bmp_img->w)/2;
-			dst_rect.y = (2048 - bmp_img->h)/2;
-			dst_rect.w = bmp_img->w;
-			dst_rect.h = bmp_img->h;
-			SDL_BlitSurface(bmp_img, NULL, tex_img, &dst_rect);
-		}
-
-        glBindTexture(GL_TEXTURE_2D, tex_num);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-		if ((tex_img->format)->Amask) {
-	        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_img->w, tex_img->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, tex_img->pixels);
-		} else {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tex_img->w, tex_img->h, 0, GL_RGB, GL_UNSIGNED_BYTE, tex_img->pixels);
-		}
-
-		SDL_FreeSurface (bmp_img);
-        SDL_FreeSurface (tex_img);
-	}
-	else {
-		fprintf(stderr, "Failed to load texture: %s\n", tex_name);
-	}
-
-	return tex_num;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ts.tv_nsec*1e-9;
 }
 
-#define  NDIV_V  (18)
-#define  NDIV_H  (9)
-#define  NSTRIPS (NDIV_V*NDIV_H)
-
-#define  TEXSCALE_X (1.0/1.0*0.5)
-#define  TEXSCALE_Y (1.0/1.0*0.5)
-
-static int32_t
-alloc_vertex_array_sphere(int32_t ** vcnts, vec3_t ** vertices, vec2_t ** coords)
+static void
+frame_stats_reset(frame_stats_t * st)
 {
-	int32_t nvertices = (NDIV_V * (3+2*NDIV_V+1) / 2)*NDIV_H;
-
-	vec3_t * vtxs;
-	vec2_t * crds;
-	int32_t * cnts;
-
-	vtxs = malloc(sizeof(vec3_t)*nvertices);
-	if (vtxs == NULL) {
-		fprintf(stderr, "Failed to allocate memory...\n");
-		return -1;
-	}
-
-	crds = malloc(sizeof(vec2_t)*nvertices);
-	if (crds == NULL) {
-		fprintf(stderr, "Failed to allocate memory...\n");
-		free(vtxs);
-		return -1;
-	}
-
-	cnts = malloc(sizeof(int32_t)*NSTRIPS);
-	if (cnts == NULL) {
-		fprintf(stderr, "Failed to allocate memory...\n");
-		free(vtxs);
-		free(crds);
-		return -1;
-	}
-
-	*vcnts = cnts;
-	*vertices = vtxs;
-	*coords = crds;
-
-	return nvertices;
+	st->t_start = now_sec( );
+	st->cpu_start = clock( );
+	st->frames = 0;
+	st->frame_sum = 0.0;
+	st->frame_max = 0.0;
+	st->inputs = 0;
+	st->latency_sum = 0.0;
+	st->latency_max = 0.0;
 }
 
-static int32_t
-alloc_vertex_array_wireframe(int32_t ** vcnts, vec3_t ** vertices)
+static void
+frame_stats_report(const frame_stats_t * st)
 {
-	int32_t nvertices = (NDIV_V * (4+3*NDIV_V+1) / 2)*NDIV_H;
-
-	vec3_t * vtxs;
-	int32_t * cnts;
-
-	vtxs = malloc(sizeof(vec3_t)*nvertices);
-	if (vtxs == NULL) {
-		fprintf(stderr, "Failed to allocate memory...\n");
-		return -1;
-	}
-
-	cnts = malloc(sizeof(int32_t)*NSTRIPS);
-	if (cnts == NULL) {
-		fprintf(stderr, "Failed to allocate memory...\n");
-		free(vtxs);
-		return -1;
-	}
-
-	*vcnts = cnts;
-	*vertices = vtxs;
-
-	return nvertices;
+	double t = now_sec( ) - st->t_start;
+	double cpu = (double)(clock( ) - st->cpu_start) / CLOCKS_PER_SEC;
+
+	printf("frames: %d in %.1f s (%.1f fps), cpu %.1f%%\n",
+		   st->frames, t, (t > 0.0) ? st->frames/t : 0.0, (t > 0.0) ? 100.0*cpu/t : 0.0);
+	printf("frame time: %.2f ms avg, %.2f ms max\n",
+		   (st->frames > 0) ? 1e3*st->frame_sum/st->frames : 0.0, 1e3*st->frame_max);
+	printf("input to swap: %.2f ms avg, %.2f ms max over %d inputs\n",
+		   (st->inputs > 0) ? 1e3*st->latency_sum/st->inputs : 0.0, 1e3*st->latency_max,
+		   st->inputs);
 }
 
-static void
-update_sphere_object(int32_t * nstrips, const lens_param_t * lens, int32_t cnts[], vec3_t vtxs[], vec2_t crds[])
+/**
+ * Take the newest mesh from the worker and hand what changed to the
+ * buffers: everything for new geometry, else the vertices.
+ */
+static const mesh_set_t *
+sync_mesh(mesh_worker_t * worker, mesh_buffers_t * mb, uint32_t * uploaded)
 {
-	vec3_t vary[2*(NDIV_V+1)];
-	vec2_t cary[2*(NDIV_V+1)];
-	/* The number of vertices
-	 *     Top
-	 *     /\    2*1+1
-	 *
-	 *    /\/\   2*2+1
-	 *
-	 *   /\/\/\  2*3+1
-	 * ...
-	 *
-	 */
-	double r = 30.0;
-	double cx = 0.5 + lens->center.x / 1024.0 * 0.5;
-	double cy = 0.5 + lens->center.y / 1024.0 * 0.5;
-	double t_r = lens->r / 1024.0;
-	vec2_t center = vec2(cx, cy);
-	
-	int32_t scnt;
-	int32_t vcnt;
-	int32_t i, j, k;
-
-	scnt = 0;
-	vcnt = 0;
-	for (i=0; i<NDIV_H; i++) {
-		vary[0*(NDIV_V+1)+0] = vec3(0.0, 0.0, -r);
-		cary[0*(NDIV_V+1)+0] = center;
-
-		for (j=1; j<NDIV_V+1; j++) {
-			int32_t slot_n = (j+0)&1;
-			int32_t slot_p = (j+1)&1;
-			double th_r = j*(1.0/NDIV_V);
-			double theta = th_r*0.5*M_PI;
-			double zn = cos(theta);
-			double zz = -zn*r;
-			double rr = sin(theta);
-
-			for (k=0; k<j+1; k++) {
-				double phi = (i*j+k)*2.0*M_PI*(1.0/NDIV_H)*(1.0/j);
-				double xx = rr*cos(phi)*r;
-				double yy = rr*sin(phi)*r;
-
-				vec2_t tcr = vec2(cos(phi)*TEXSCALE_X*t_r, -sin(phi)*TEXSCALE_Y*t_r);
-				vec2_t tc;
-
-				switch (lens->type) {
-				case LENS_STEREOGRAPHIC: {
-					/* stereographic projection */
-					tc = add2d(mult2d(rr*(1.0/(1.0+zn)), tcr), center);
-					break;
-				}
-
-				case LENS_EQUIDISTANT: {
-					/* equidistant projection */
-					tc = add2d(mult2d(th_r, tcr), center);
-					break;
-				}
-
-				case LENS_EQUISOLID: {
-					/* equisolid projection */
-					double esr = sin(theta*0.5) / sin(0.25*M_PI);
-					tc = add2d(mult2d(esr, tcr), center);
-					break;
-				}
+	int32_t fresh;
+	const mesh_set_t * set = mesh_worker_acquire(worker, &fresh);
 
-				case LENS_ORTHOGONAL: {
-					/* orthogonal projection */
-					tc = add2d(mult2d(rr, tcr), center);
-					break;
-				}
-
-				case LENS_MADOKA: {
-					/* MADOKA */
-					double sr = madoka_theta_to_radius(theta);
-					tc = add2d(mult2d(sr, tcr), center);
-					break;
-				}
-				}
-
-				vary[slot_n*(NDIV_V+1)+k] = vec3(xx, yy, zz);
-				cary[slot_n*(NDIV_V+1)+k] = tc;
-			}
-
-			cnts[scnt] = 2*j+1;
-			for (k=0; k<j; k++) {
-				vtxs[vcnt] = vary[slot_n*(NDIV_V+1)+k];
-				crds[vcnt] = cary[slot_n*(NDIV_V+1)+k];
-				vcnt++;
-
-				vtxs[vcnt] = vary[slot_p*(NDIV_V+1)+k];
-				crds[vcnt] = cary[slot_p*(NDIV_V+1)+k];
-				vcnt++;
-			}
-			vtxs[vcnt] = vary[slot_n*(NDIV_V+1)+j];
-			crds[vcnt] = cary[slot_n*(NDIV_V+1)+j];
-			vcnt++;
-
-			scnt++;
-		}		
-	}	
+	if (fresh) {
+		if (set->serial != *uploaded) {
+			mesh_buffers_geometry(mb, &set->sphere, &set->wf);
+			*uploaded = set->serial;
+		}
+		else {
+			mesh_buffers_vertices(mb, &set->sphere);
+		}
+	}
 
-	*nstrips = scnt;
+	return set;
 }
 
 static void
-update_sphere_wireframe(int32_t * nstrips, int32_t cnts[], vec3_t vtxs[])
+usage(const char_t * prog)
 {
-	vec3_t vary[2*(NDIV_V+1)];
-	double r = 30.0f;
-	int32_t scnt;
-	int32_t vcnt;
-	int32_t i, j, k;
-
-	scnt = 0;
-	vcnt = 0;
-	for (i=0; i<NDIV_H; i++) {
-		vary[0*(NDIV_V+1)+0] = vec3(0.0, 0.0, -r);
-
-		for (j=1; j<NDIV_V+1; j++) {
-			int32_t slot_n = (j+0)&1;
-			int32_t slot_p = (j+1)&1;
-			double theta = (NDIV_V-j)*0.5*M_PI*(1.0/NDIV_V);
-			double zn = sin(theta);
-			double zz = -zn*r;
-			double rr = cos(theta);
-
-			for (k=0; k<j+1; k++) {
-				double phi = (i*j+k)*2.0*M_PI*(1.0/NDIV_H)*(1.0/j);
-				double xx = rr*cos(phi)*r;
-				double yy = rr*sin(phi)*r;
-				vary[slot_n*(NDIV_V+1)+k] = vec3(xx, yy, zz);
-			}
-
-			cnts[scnt] = 3*j+1;
-			for (k=0; k<j; k++) {
-				vtxs[vcnt] = vary[slot_n*(NDIV_V+1)+k];
-				vcnt++;
-
-				vtxs[vcnt] = vary[slot_p*(NDIV_V+1)+k];
-				vcnt++;
-			}
-			
-			for (k=0; k<j+1; k++) {
-				vtxs[vcnt] = vary[slot_n*(NDIV_V+1)+(j-k)];
-				vcnt++;
-			}
-
-			scnt++;
-		}		
-	}
-
-	*nstrips = scnt;
+	fprintf(stderr,
+			"Usage: %s [options] image\n"
+			"  -v ndiv   rings from the pole to the rim (default: %d)\n"
+			"  -s ndiv   sectors around the pole (default: %d)\n"
+			"  -a tol    adaptive tessellation, max texture error in pixels\n"
+			"  -n        draw from client arrays, no vertex buffer objects\n"
+			"  -V        wait for vertical sync on swap\n"
+			"  -c        redraw continuously instead of on changes\n"
+			"  -t px     split the image into textures of at most px square\n"
+			"  -L file   load a lens curve file and start with it\n"
+			"  -T file   trace written on 't' and at exit (default: %s)\n",
+			prog, NDIV_V, NDIV_H, TRACE_FILE);
 }
 
 static void
@@ -340,43 +168,47 @@ set_viewangle(double fovY, int32_t width, int32_t height)
 	glMatrixMode(GL_MODELVIEW);
 }
 
+/**
+ * Draw the sphere once per texture tile. With several tiles each pass
+ * adds its part of the image, black elsewhere; the depth test keeps
+ * only the nearest surface in every pass.
+ */
 static void
-draw_sphere(GLuint tid, int32_t nstrips, int32_t vcnts[], vec3_t vertices[], vec2_t coords[])
+draw_sphere(const texture_set_t * ts, const mesh_buffers_t * mb, const sphere_mesh_t * mesh)
 {
-	int32_t vc = 0;
-	int32_t i;
-
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 	glEnable(GL_TEXTURE_2D);
 	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glBindTexture(GL_TEXTURE_2D, tid);
-	glVertexPointer(3, GL_DOUBLE, sizeof(double)*3, &vertices[0].x);
-	glTexCoordPointer(2, GL_DOUBLE, sizeof(double)*2, &coords[0].x);
+	if (ts->ntiles > 1) {
+		glBlendFunc(GL_ONE, GL_ONE);
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LEQUAL);
+	}
+	else {
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
 	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
 
-	for (i=0; i<nstrips; i++) {
-		glDrawArrays(GL_TRIANGLE_STRIP, vc, vcnts[i]);
-		vc += vcnts[i];
+	TRACE_BEGIN("draw_sphere");
+	for (int32_t i=0; i<ts->ntiles; i+=1) {
+		texture_set_bind(ts, i);
+		mesh_buffers_draw_sphere(mb, mesh);
 	}
+	texture_set_unbind( );
+	TRACE_END( );
+
+	glDisable(GL_DEPTH_TEST);
 }
 
 static void
-draw_wireframe(int32_t nstrips, int32_t wf_vcnts[], vec3_t wf_vtxs[])
+draw_wireframe(const mesh_buffers_t * mb, const sphere_mesh_t * sphere, const wireframe_mesh_t * mesh)
 {
-	int32_t vc = 0;
-	int32_t i;
-
 	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_BLEND);
-	glVertexPointer(3, GL_DOUBLE, sizeof(double)*3, &wf_vtxs[0].x);
 	glColor3f(0.0f, 1.0f, 0.0f);
 
-	for (i=0; i<nstrips; i++) {
-		glDrawArrays(GL_LINE_STRIP, vc, wf_vcnts[i]);
-		vc += wf_vcnts[i];
-	}
+	mesh_buffers_draw_wireframe(mb, sphere, mesh);
 }
 
 int
@@ -392,14 +224,70 @@ main(int argc, char ** argv)
 	int32_t bpp = 0;
 	int32_t flags = 0;
 	double fovY = 45.0;
-	GLuint tid_sphere;
+	texture_set_t texset;
+	int32_t tile_limit = 0;
 	GLuint tid_font;
+	textwin_t overlay;
+	mesh_config_t cfg = {NDIV_V, NDIV_H, 0, 0.5};
+	mesh_worker_t worker;
+	mesh_buffers_t mb;
+	uint32_t uploaded = 0;
+	int32_t use_vbo = 1;
+	int32_t vsync = 0;
+	int32_t continuous = 0;
+	frame_stats_t stats;
+	const char_t * trace_file = TRACE_FILE;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "v:s:a:nVct:L:T:h")) != -1) {
+		switch (opt) {
+		case 'v':
+			cfg.ndiv_v = atoi(optarg);
+			break;
+		case 's':
+			cfg.ndiv_h = atoi(optarg);
+			break;
+		case 'a':
+			cfg.adaptive = 1;
+			cfg.tol = atof(optarg);
+			break;
+		case 'n':
+			use_vbo = 0;
+			break;
+		case 'V':
+			vsync = 1;
+			break;
+		case 'c':
+			continuous = 1;
+			break;
+		case 't':
+			tile_limit = atoi(optarg);
+			break;
+		case 'L':
+			if (lens_curve_load(optarg) < 0) {
+				exit(1);
+			}
+			break;
+		case 'T':
+			trace_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
 
-	if (argc < 2) {
+	if (argc - optind < 1) {
 		fprintf(stderr, "filename required.\n");
+		usage(argv[0]);
 		exit(-1);
 	}
 
+	if (cfg.ndiv_v < 1 || cfg.ndiv_h < 1 || cfg.tol <= 0.0 || tile_limit < 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+
 	if(SDL_Init(SDL_INIT_VIDEO) < 0) {
 		fprintf(stderr, "Video initialization failed: %s\n", SDL_GetError());
 		exit(-1);
@@ -407,10 +295,14 @@ main(int argc, char ** argv)
 
 	atexit(SDL_Quit);
 
+	TRACE_THREAD_NAME("render");
+
 	info = SDL_GetVideoInfo();
 	bpp = info->vfmt->BitsPerPixel;
 
 	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 16);
+	SDL_GL_SetAttribute(SDL_GL_SWAP_CONTROL, vsync);
 
 	flags = SDL_OPENGL;
 
@@ -431,20 +323,23 @@ main(int argc, char ** argv)
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-	tid_sphere = LoadTexture(argv[1]);
+	mesh_buffers_init(&mb, use_vbo);
+
+	if (load_texture_set(&texset, argv[optind], tile_limit) < 0) {
+		exit(1);
+	}
 	tid_font   = load_font_image( );
+	if (init_textwindow(&overlay) < 0) {
+		exit(1);
+	}
 
 	{
-		vec3_t * vertices;
-		vec2_t * coords;
-		vec3_t * wf_vtxs;
-		int32_t * vcnts;
-		int32_t * wf_vcnts;
-		int32_t nstrips;
-		int32_t frames = 0;
+		int32_t dirty = 1;
+		double t_input = 0.0;
 		GLfloat depth = 0.0f;
 		int32_t wireframe = 0;
 		int32_t textwin_en = 0;
+		uint32_t shown_serial = 0;	/* mesh on the overlay; set->cfg changes with it */
 		int32_t drag_p = 0;
 		int32_t xorg, yorg;
 		lens_param_t lens = {LENS_EQUIDISTANT, 1024.0, {0.0, 0.0}};
@@ -453,19 +348,40 @@ main(int argc, char ** argv)
 		float last_yaw = 0.0f;
 		float yaw = 0.0f;
 
-		if (alloc_vertex_array_sphere(&vcnts, &vertices, &coords) < 0) {
-			exit(1);
+		/* frames past the old 2048 limit: start from the inscribed circle */
+		if (texset.width > TEXSET_SPAN || texset.height > TEXSET_SPAN) {
+			lens.r = (texset.width < texset.height ? texset.width : texset.height)/2;
+		}
+		if (lens_curve_loaded( )) {
+			lens.type = LENS_CURVE;
 		}
 
-		if (alloc_vertex_array_wireframe(&wf_vcnts, &wf_vtxs) < 0) {
+		if (mesh_worker_start(&worker) < 0) {
 			exit(1);
 		}
+		mesh_worker_request(&worker, &cfg, &lens);
+		frame_stats_reset(&stats);
 
-		update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
-		update_sphere_wireframe(&nstrips, wf_vcnts, wf_vtxs);
-		
 		while (!quit) {
-			while (SDL_PollEvent(&event)) {
+			int32_t got;
+			double t_frame;
+
+			/* sleep in the event queue until something needs a frame */
+			if (continuous || dirty) {
+				got = SDL_PollEvent(&event);
+			}
+			else {
+				got = SDL_WaitEvent(&event);
+			}
+
+			TRACE_BEGIN("events");
+			while (got) {
+				if (event.type != SDL_USEREVENT &&
+					(event.type != SDL_MOUSEMOTION || drag_p) && t_input == 0.0) {
+					t_input = now_sec( );
+				}
+				dirty |= (event.type != SDL_MOUSEMOTION || drag_p);
+
 				switch (event.type) {
 				case SDL_QUIT:
 					quit = 1;
@@ -532,7 +448,7 @@ main(int argc, char ** argv)
 							last_yaw = 0.0f;
 							yaw = 0.0f;
 							lens.type = LENS_EQUIDISTANT;
-							update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
+							mesh_worker_request(&worker, &cfg, &lens);
 							fovY = 45.0;
 							set_viewangle(fovY, width, height);
 						}
@@ -544,9 +460,15 @@ main(int argc, char ** argv)
 						break;
 
 					case SDLK_p: {
+						int32_t requests, builds;
+
 						printf("cx: %f\n", lens.center.x);
 						printf("cy: %f\n", lens.center.y);
 						printf("r : %f\n", lens.r);
+						mesh_worker_stats(&worker, &requests, &builds);
+						printf("mesh requests: %d, builds: %d\n", requests, builds);
+						frame_stats_report(&stats);
+						printf("text overlay rebuilds: %d\n", overlay.rebuilds);
 						break;
 					}
 
@@ -576,7 +498,7 @@ main(int argc, char ** argv)
 						else {
 							lens.center.x -= 1.0;
 						}
-						update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
+						mesh_worker_request(&worker, &cfg, &lens);
 						break;
 					}
 
@@ -587,7 +509,7 @@ main(int argc, char ** argv)
 						else {
 							lens.center.y += 1.0;
 						}
-						update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
+						mesh_worker_request(&worker, &cfg, &lens);
 						break;
 					}
 
@@ -598,7 +520,7 @@ main(int argc, char ** argv)
 						else {
 							lens.center.y -= 1.0;
 						}
-						update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
+						mesh_worker_request(&worker, &cfg, &lens);
 						break;
 					}
 
@@ -609,7 +531,7 @@ main(int argc, char ** argv)
 						else {
 							lens.center.x += 1.0;
 						}
-						update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
+						mesh_worker_request(&worker, &cfg, &lens);
 						break;
 					}
 
@@ -634,7 +556,7 @@ main(int argc, char ** argv)
 						else {
 							lens.r -= 1.0;
 						}
-						update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
+						mesh_worker_request(&worker, &cfg, &lens);
 						break;
 					}
 
@@ -645,7 +567,7 @@ main(int argc, char ** argv)
 						else {
 							lens.r += 1.0;
 						}
-						update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
+						mesh_worker_request(&worker, &cfg, &lens);
 						break;
 					}
 
@@ -656,14 +578,47 @@ main(int argc, char ** argv)
 						else {
 							toggle_lens_type(&lens, 1);
 						}
-						update_sphere_object(&nstrips, &lens, vcnts, vertices, coords);
+						mesh_worker_request(&worker, &cfg, &lens);
 						break;
 					}
 
+					case SDLK_t:
+#ifdef SPHERE_TRACE
+						TRACE_DUMP(trace_file);
+#else
+						fprintf(stderr, "%s: built without tracing (make TRACE=1)\n", trace_file);
+#endif
+						break;
+
 					case SDLK_SPACE:
 						wireframe = 1 - wireframe;
 						break;
 
+					case SDLK_m: {
+						/* finer, or coarser with shift */
+						if (cfg.adaptive) {
+							cfg.tol = shift_p ? cfg.tol*2.0 : cfg.tol*0.5;
+						}
+						else if (shift_p) {
+							if (cfg.ndiv_v > 1 && cfg.ndiv_h > 1) {
+								cfg.ndiv_v /= 2;
+								cfg.ndiv_h /= 2;
+							}
+						}
+						else if (cfg.ndiv_v < 8*NDIV_V) {
+							cfg.ndiv_v *= 2;
+							cfg.ndiv_h *= 2;
+						}
+						mesh_worker_request(&worker, &cfg, &lens);
+						break;
+					}
+
+					case SDLK_a: {
+						cfg.adaptive = 1 - cfg.adaptive;
+						mesh_worker_request(&worker, &cfg, &lens);
+						break;
+					}
+
 					case SDLK_UP:
 						depth += 5.0f;
 						if (depth > 0.0f) {
@@ -685,12 +640,23 @@ main(int argc, char ** argv)
 					break;
 				}
 				}
+
+				got = SDL_PollEvent(&event);
+			}
+			TRACE_END( );
+
+			if (quit || (!dirty && !continuous)) {
+				continue;
 			}
 
-			glClear(GL_COLOR_BUFFER_BIT);
+			t_frame = now_sec( );
+
+			TRACE_BEGIN("frame");
+			glClear(texset.ntiles > 1 ? GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT);
 
 			{
 				/* Uint32 t = SDL_GetTicks( ); */
+				const mesh_set_t * set;
 
 				glEnableClientState(GL_VERTEX_ARRAY);
 				glLoadIdentity( );
@@ -698,23 +664,63 @@ main(int argc, char ** argv)
 				glRotatef(yaw, 0.0f, 1.0f, 0.0f);
 				glRotatef(pitch, 1.0f, 0.0f, 0.0f);
 
-				if (wireframe) {
-					draw_sphere(tid_sphere, nstrips, vcnts, vertices, coords);
-					draw_wireframe(nstrips, wf_vcnts, wf_vtxs);
-				}
-				else {
-					draw_sphere(tid_sphere, nstrips, vcnts, vertices, coords);
+				set = sync_mesh(&worker, &mb, &uploaded);
+
+				if (set->valid) {
+					draw_sphere(&texset, &mb, &set->sphere);
+					if (wireframe) {
+						draw_wireframe(&mb, &set->sphere, &set->wf);
+					}
 				}
 
 				if (textwin_en) {
-					draw_textwindow(tid_font, &lens);
+					TRACE_BEGIN("draw_textwindow");
+					if (set->valid && set->serial != shown_serial) {
+						shown_serial = set->serial;
+						textwindow_line(&overlay, TEXTWIN_LENS_LINES, "Mesh: %d x %d%s, %d vertices",
+										set->sphere.ndiv_v, set->sphere.ndiv_h,
+										set->cfg.adaptive ? " adaptive" : "", set->sphere.nvertices);
+					}
+					draw_textwindow(&overlay, tid_font, &lens);
+					TRACE_END( );
 				}
 			}
 
-			frames++;
+			TRACE_BEGIN("SDL_GL_SwapBuffers");
 			SDL_GL_SwapBuffers();
-			SDL_Delay(10);
+			TRACE_END( );
+			TRACE_END( );
+			dirty = 0;
+
+			{
+				double t_done = now_sec( );
+
+				stats.frames++;
+				stats.frame_sum += t_done - t_frame;
+				if (t_done - t_frame > stats.frame_max) {
+					stats.frame_max = t_done - t_frame;
+				}
+				if (t_input != 0.0) {
+					stats.inputs++;
+					stats.latency_sum += t_done - t_input;
+					if (t_done - t_input > stats.latency_max) {
+						stats.latency_max = t_done - t_input;
+					}
+					t_input = 0.0;
+				}
+			}
+
+			if (continuous) {
+				SDL_Delay(10);
+			}
 		}
+
+		frame_stats_report(&stats);
+		mesh_worker_stop(&worker);
+		TRACE_DUMP(trace_file);
+		free_textwindow(&overlay);
+		free_texture_set(&texset);
+		mesh_buffers_free(&mb);
 	}
 	
 	return 0;
@@ -0,0 +1,741 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file mesh.c
+ * @brief Hemisphere meshes drawn by the viewer.
+ *
+ * Kept free of GL so that the mesh generation can be benchmarked
+ * without a display.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "mesh.h"
+
+#define  TEXSCALE_X (1.0/1.0*0.5)
+#define  TEXSCALE_Y (1.0/1.0*0.5)
+
+#define  SPHERE_R   (30.0)
+
+/* Rings projected per call of the span kernel */
+#define  RING_CHUNK  (64)
+
+/* Limits of the adaptive planner */
+#define  ADAPT_MAX_RINGS    (1024)
+#define  ADAPT_MIN_SECTORS  (3)
+#define  ADAPT_MAX_SECTORS  (128)
+#define  ADAPT_MAX_RETRIES  (10)
+
+/**
+ * Vertices of ring @a theta within sector @a i, with @a m segments per
+ * sector: positions into @a v and texture-space directions into @a d.
+ */
+static void
+ring_vertices(vec3_t * v, vec2_t * d, double theta, int32_t i, int32_t m, int32_t ndiv_h)
+{
+	double r = SPHERE_R;
+	double zn = cos(theta);
+	double zz = -zn*r;
+	double rr = sin(theta);
+	int32_t k;
+
+	if (m == 0) {
+		v[0] = vec3(0.0, 0.0, -r);
+		d[0] = vec2(0.0, 0.0);
+		return;
+	}
+
+	for (k=0; k<m+1; k++) {
+		double phi = (i*m+k)*2.0*M_PI*(1.0/ndiv_h)*(1.0/m);
+		double xx = rr*cos(phi)*r;
+		double yy = rr*sin(phi)*r;
+
+		v[k] = vec3(xx, yy, zz);
+		d[k] = vec2(cos(phi)*TEXSCALE_X, -sin(phi)*TEXSCALE_Y);
+	}
+}
+
+/**
+ * Vertices of the strip between ring j-1 and ring j in one sector. A
+ * ring has either one segment more than the previous one or the same
+ * number; both zigzag without degenerate triangles.
+ */
+static int32_t
+strip_vertices(const int32_t * segs, int32_t j)
+{
+	int32_t m = segs[j];
+
+	return (m > segs[j-1]) ? 2*m+1 : 2*m+2;
+}
+
+/**
+ * Index of vertex k of ring j in sector i. Ring j starts at base, and
+ * its last vertex in the last sector wraps around to the first.
+ */
+static uint32_t
+vertex_index(const uint32_t * ring_base, const int32_t * segs, int32_t ndiv_h,
+			 int32_t j, int32_t i, int32_t k)
+{
+	int32_t m = segs[j];
+
+	if (m == 0) {
+		return ring_base[j];
+	}
+
+	return ring_base[j] + (i*m + k) % (ndiv_h*m);
+}
+
+/**
+ * Lay out the mesh once: shared positions, the ring of every vertex
+ * and its direction in texture space, and the triangles of each strip
+ * as indices. Vertex q of a strip is vertex q/2 of ring j for even q
+ * and of ring j-1 for odd q; every other triangle is flipped to keep
+ * the winding of the strip.
+ */
+static int
+build_sphere_geometry(sphere_mesh_t * mesh)
+{
+	const int32_t ndiv_v = mesh->ndiv_v;
+	const int32_t ndiv_h = mesh->ndiv_h;
+	const int32_t * segs = mesh->ring_segs;
+	const int32_t nmax = segs[ndiv_v]+1;
+	mesh_vertex_t * vtxs = mesh->vertices;
+	vec2_t * dirs = mesh->dirs;
+	int32_t * rings = mesh->rings;
+	uint32_t * idxs = mesh->indices;
+	uint32_t * ring_base;
+	vec3_t * vary;
+	vec2_t * dary;
+	/* The number of strip vertices, a ring with one more segment
+	 *     Top
+	 *     /\    2*1+1
+	 *
+	 *    /\/\   2*2+1
+	 *
+	 *   /\/\/\  2*3+1
+	 * ...
+	 *
+	 * and a ring with as many segments as the previous one
+	 *
+	 *   |/|/|/| 2*3+2
+	 */
+	int32_t vcnt;
+	int32_t icnt;
+	int32_t i, j, k, t;
+
+	ring_base = malloc(sizeof(uint32_t)*(ndiv_v+1));
+	vary = malloc(sizeof(vec3_t)*nmax);
+	dary = malloc(sizeof(vec2_t)*nmax);
+	if (ring_base == NULL || vary == NULL || dary == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(ring_base);
+		free(vary);
+		free(dary);
+		return -1;
+	}
+
+	vcnt = 0;
+	for (j=0; j<ndiv_v+1; j++) {
+		ring_base[j] = vcnt;
+		for (i=0; i<((j == 0) ? 1 : ndiv_h); i++) {
+			ring_vertices(vary, dary, mesh->ring_theta[j], i, segs[j], ndiv_h);
+			for (k=0; k<((j == 0) ? 1 : segs[j]); k++) {
+				vtxs[vcnt].x = (float)vary[k].x;
+				vtxs[vcnt].y = (float)vary[k].y;
+				vtxs[vcnt].z = (float)vary[k].z;
+				dirs[vcnt] = dary[k];
+				rings[vcnt] = j;
+				vcnt++;
+			}
+		}
+	}
+
+	icnt = 0;
+	for (i=0; i<ndiv_h; i++) {
+		for (j=1; j<ndiv_v+1; j++) {
+			int32_t n = strip_vertices(segs, j);
+
+			for (t=0; t<n-2; t++) {
+				int32_t q[3] = {t+(t&1), t+1-(t&1), t+2};
+
+				for (k=0; k<3; k++) {
+					idxs[icnt++] = vertex_index(ring_base, segs, ndiv_h,
+												j - (q[k]&1), i, q[k]>>1);
+				}
+			}
+		}
+	}
+
+	free(ring_base);
+	free(vary);
+	free(dary);
+
+	return 0;
+}
+
+/**
+ * Allocate a mesh for the ring layout already stored in ring_theta and
+ * ring_segs, and build its geometry.
+ */
+static int
+alloc_sphere_layout(sphere_mesh_t * mesh)
+{
+	const int32_t ndiv_v = mesh->ndiv_v;
+	const int32_t ndiv_h = mesh->ndiv_h;
+	int32_t nvertices = 0;
+	int32_t ntriangles = 0;
+	int32_t j;
+
+	for (j=1; j<ndiv_v+1; j++) {
+		nvertices += mesh->ring_segs[j];
+		ntriangles += strip_vertices(mesh->ring_segs, j) - 2;
+	}
+	nvertices = 1 + nvertices*ndiv_h;
+	ntriangles *= ndiv_h;
+
+	mesh->nvertices = nvertices;
+	mesh->nindices = 3*ntriangles;
+	mesh->vertices = malloc(sizeof(mesh_vertex_t)*nvertices);
+	mesh->indices = malloc(sizeof(uint32_t)*3*ntriangles);
+	mesh->dirs = malloc(sizeof(vec2_t)*nvertices);
+	mesh->rings = malloc(sizeof(int32_t)*nvertices);
+	mesh->ring_sr = malloc(sizeof(double)*(ndiv_v+1));
+	mesh->ring_s = malloc(sizeof(double)*(ndiv_v+1));
+	mesh->sr_valid = 0;
+	mesh->sr_type = LENS_EQUIDISTANT;
+
+	if (mesh->vertices == NULL || mesh->indices == NULL || mesh->dirs == NULL ||
+		mesh->rings == NULL || mesh->ring_sr == NULL || mesh->ring_s == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free_sphere_object(mesh);
+		return -1;
+	}
+
+	if (build_sphere_geometry(mesh) < 0) {
+		free_sphere_object(mesh);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Uniform tessellation: ndiv_v rings evenly spaced in theta, ring j
+ * split into j segments in each of the ndiv_h sectors.
+ */
+int
+alloc_sphere_object(sphere_mesh_t * mesh, int32_t ndiv_v, int32_t ndiv_h)
+{
+	int32_t j;
+
+	mesh->ndiv_v = ndiv_v;
+	mesh->ndiv_h = ndiv_h;
+	mesh->vertices = NULL;
+	mesh->indices = NULL;
+	mesh->dirs = NULL;
+	mesh->rings = NULL;
+	mesh->ring_sr = NULL;
+	mesh->ring_s = NULL;
+	mesh->ring_theta = malloc(sizeof(double)*(ndiv_v+1));
+	mesh->ring_segs = malloc(sizeof(int32_t)*(ndiv_v+1));
+
+	if (mesh->ring_theta == NULL || mesh->ring_segs == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free_sphere_object(mesh);
+		return -1;
+	}
+
+	for (j=0; j<ndiv_v+1; j++) {
+		mesh->ring_theta[j] = j*(1.0/ndiv_v)*0.5*M_PI;
+		mesh->ring_segs[j] = j;
+	}
+
+	return alloc_sphere_layout(mesh);
+}
+
+/**
+ * Largest error in source pixels of the texture positions t (relative
+ * to the lens center) interpolated across triangle p, against the
+ * exact projection of the direction through the same point. Sampled
+ * at the edge midpoints and the centroid.
+ */
+static double
+triangle_error(lens_type_t type, double r, const vec3_t * p, const vec2_t * t)
+{
+	static const double w[4][3] = {
+		{0.5, 0.5, 0.0}, {0.0, 0.5, 0.5}, {0.5, 0.0, 0.5},
+		{1.0/3.0, 1.0/3.0, 1.0/3.0},
+	};
+	double err = 0.0;
+	int32_t k;
+
+	for (k=0; k<4; k++) {
+		vec3_t q = add3d(add3d(mult3d(w[k][0], p[0]), mult3d(w[k][1], p[1])), mult3d(w[k][2], p[2]));
+		vec2_t u = add2d(add2d(mult2d(w[k][0], t[0]), mult2d(w[k][1], t[1])), mult2d(w[k][2], t[2]));
+		double theta = atan2(sqrt(q.x*q.x + q.y*q.y), -q.z);
+		double phi = atan2(q.y, q.x);
+		double s = lens_theta_to_radius(type, theta) * r;
+		double e = norm2d(sub2d(u, vec2(cos(phi)*s, -sin(phi)*s)));
+
+		if (e > err) {
+			err = e;
+		}
+	}
+
+	return err;
+}
+
+/**
+ * Scratch of the adaptive planner, sized for its largest ring.
+ */
+typedef struct {
+	lens_type_t type;
+	double r;
+	int32_t ndiv_h;
+	vec3_t * ring_v;	/* two rings */
+	vec2_t * ring_d;
+	vec3_t * strip_v;
+	vec2_t * strip_t;
+} planner_t;
+
+/**
+ * Error in pixels of interpolating the image radius linearly along a
+ * meridian from ta to tb. The chord midpoint looks along (ta+tb)/2.
+ */
+static double
+radial_error(const planner_t * pl, double ta, double tb)
+{
+	double sa = lens_theta_to_radius(pl->type, ta);
+	double sb = lens_theta_to_radius(pl->type, tb);
+	double sm = lens_theta_to_radius(pl->type, 0.5*(ta+tb));
+
+	return pl->r*fabs(sm - 0.5*(sa+sb));
+}
+
+/**
+ * Error in pixels at the middle of a segment of ring theta spanning
+ * dphi. The chord midpoint lies inside the sphere, and looks along a
+ * smaller theta than the ring.
+ */
+static double
+lateral_error(const planner_t * pl, double theta, double dphi)
+{
+	double c = cos(0.5*dphi);
+	double tm = atan2(sin(theta)*c, cos(theta));
+
+	return pl->r*fabs(lens_theta_to_radius(pl->type, tm) - lens_theta_to_radius(pl->type, theta)*c);
+}
+
+/**
+ * Exact error over one sector of the strip between ring ta (ma
+ * segments) and ring tb (mb segments). Every sector is the same up to
+ * a rotation.
+ */
+static double
+band_error(const planner_t * pl, double ta, double tb, int32_t ma, int32_t mb)
+{
+	const int32_t nmax = mb+1;
+	double sa = lens_theta_to_radius(pl->type, ta) * pl->r;
+	double sb = lens_theta_to_radius(pl->type, tb) * pl->r;
+	double err = 0.0;
+	int32_t n, k;
+
+	ring_vertices(&pl->ring_v[0], &pl->ring_d[0], ta, 0, ma, pl->ndiv_h);
+	ring_vertices(&pl->ring_v[nmax], &pl->ring_d[nmax], tb, 0, mb, pl->ndiv_h);
+	n = (mb > ma) ? 2*mb+1 : 2*mb+2;
+
+	/* the strip as build_sphere_geometry() lays it out */
+	for (k=0; k<n; k++) {
+		int32_t q = (k&1) ? (k>>1) : nmax + (k>>1);
+		double s = (k&1) ? sa : sb;
+
+		pl->strip_v[k] = pl->ring_v[q];
+		pl->strip_t[k] = vec2(pl->ring_d[q].x/TEXSCALE_X*s, pl->ring_d[q].y/TEXSCALE_Y*s);
+	}
+
+	for (k=0; k<n-2; k++) {
+		double e = triangle_error(pl->type, pl->r, &pl->strip_v[k], &pl->strip_t[k]);
+		if (e > err) {
+			err = e;
+		}
+	}
+
+	return err;
+}
+
+/**
+ * Greedy ring placement: each ring is pushed as far from the previous
+ * one as the error bound allows, and gains a segment per sector only
+ * when it has to. The cheap radial and lateral estimates place the
+ * ring, and the exact band error pulls it back where they fall short.
+ * Returns the number of rings, or -1 if no layout fits in maxrings.
+ */
+static int32_t
+plan_rings(const planner_t * pl, double * theta, int32_t * segs, int32_t maxrings, double tol)
+{
+	int32_t n = 0;
+
+	theta[0] = 0.0;
+	segs[0] = 0;
+
+	while (theta[n] < 0.5*M_PI) {
+		double ta = theta[n];
+		int32_t ma = segs[n];
+		double dphi = 2.0*M_PI/(pl->ndiv_h*(ma+1));
+		double lo = ta;
+		double hi = 0.5*M_PI;
+		double tb;
+		int32_t k;
+
+		if (n == maxrings) {
+			return -1;
+		}
+
+		if (radial_error(pl, ta, hi) <= tol && lateral_error(pl, hi, dphi) <= tol) {
+			tb = hi;
+		}
+		else {
+			for (k=0; k<32; k++) {
+				double t = 0.5*(lo+hi);
+				if (radial_error(pl, ta, t) <= tol && lateral_error(pl, t, dphi) <= tol) {
+					lo = t;
+				}
+				else {
+					hi = t;
+				}
+			}
+			tb = lo;
+		}
+
+		while (band_error(pl, ta, tb, ma, ma+1) > tol) {
+			tb = ta + 0.8*(tb - ta);
+			if (tb - ta < 1e-6) {
+				return -1;
+			}
+		}
+
+		n++;
+		theta[n] = tb;
+		segs[n] = ma+1;
+		if (ma > 0 && band_error(pl, ta, tb, ma, ma) <= tol) {
+			segs[n] = ma;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Adaptive tessellation for one lens: rings and sectors are chosen so
+ * that the texture coordinates interpolated across each triangle stay
+ * within tol pixels of the exact projection, with as few vertices as
+ * the planner finds. The sector count is searched, and the bound is
+ * checked on the whole mesh with sphere_object_error().
+ */
+int
+alloc_sphere_object_adaptive(sphere_mesh_t * mesh, const lens_param_t * lens, double tol)
+{
+	const int32_t nmax = ADAPT_MAX_RINGS+1;
+	double * theta = malloc(sizeof(double)*nmax*2);
+	int32_t * segs = malloc(sizeof(int32_t)*nmax*2);
+	planner_t pl;
+	double goal = tol;
+	double err = 0.0;
+	int32_t retry;
+
+	pl.type = lens->type;
+	pl.r = lens->r;
+	pl.ring_v = malloc(sizeof(vec3_t)*nmax*2);
+	pl.ring_d = malloc(sizeof(vec2_t)*nmax*2);
+	pl.strip_v = malloc(sizeof(vec3_t)*nmax*2);
+	pl.strip_t = malloc(sizeof(vec2_t)*nmax*2);
+
+	mesh->vertices = NULL;
+	mesh->indices = NULL;
+	mesh->dirs = NULL;
+	mesh->rings = NULL;
+	mesh->ring_theta = NULL;
+	mesh->ring_segs = NULL;
+	mesh->ring_sr = NULL;
+	mesh->ring_s = NULL;
+
+	if (theta == NULL || segs == NULL || pl.ring_v == NULL || pl.ring_d == NULL ||
+		pl.strip_v == NULL || pl.strip_t == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		goto fail;
+	}
+
+	for (retry=0; retry<ADAPT_MAX_RETRIES; retry++) {
+		int64_t best_cost = INT64_MAX;
+		int32_t best_n = -1;
+		int32_t best_h = 0;
+		int32_t h, j;
+
+		for (h=ADAPT_MIN_SECTORS; h<=ADAPT_MAX_SECTORS; h+=(h < 16) ? 1 : h/8) {
+			double * th = &theta[nmax];
+			int32_t * sg = &segs[nmax];
+			int64_t cost = 0;
+			int32_t n;
+
+			pl.ndiv_h = h;
+			n = plan_rings(&pl, th, sg, ADAPT_MAX_RINGS, goal);
+			if (n < 0) {
+				continue;
+			}
+			for (j=1; j<n+1; j++) {
+				cost += strip_vertices(sg, j);
+			}
+			cost *= h;
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_n = n;
+				best_h = h;
+				for (j=0; j<n+1; j++) {
+					theta[j] = th[j];
+					segs[j] = sg[j];
+				}
+			}
+		}
+
+		if (best_n < 0) {
+			fprintf(stderr, "No tessellation within %g pixels.\n", tol);
+			goto fail;
+		}
+
+		free_sphere_object(mesh);
+		mesh->ndiv_v = best_n;
+		mesh->ndiv_h = best_h;
+		mesh->ring_theta = malloc(sizeof(double)*(best_n+1));
+		mesh->ring_segs = malloc(sizeof(int32_t)*(best_n+1));
+		if (mesh->ring_theta == NULL || mesh->ring_segs == NULL) {
+			fprintf(stderr, "Failed to allocate memory...\n");
+			goto fail;
+		}
+		for (j=0; j<best_n+1; j++) {
+			mesh->ring_theta[j] = theta[j];
+			mesh->ring_segs[j] = segs[j];
+		}
+
+		if (alloc_sphere_layout(mesh) < 0) {
+			goto fail;
+		}
+
+		update_sphere_object(mesh, lens);
+		err = sphere_object_error(mesh, lens);
+		if (err <= tol) {
+			break;
+		}
+
+		/* a triangle between the sampled points went over */
+		goal *= 0.8;
+	}
+
+	if (err > tol) {
+		fprintf(stderr, "Tessellation error %g exceeds %g pixels.\n", err, tol);
+	}
+
+	free(theta);
+	free(segs);
+	free(pl.ring_v);
+	free(pl.ring_d);
+	free(pl.strip_v);
+	free(pl.strip_t);
+
+	return 0;
+
+fail:
+	free_sphere_object(mesh);
+	free(theta);
+	free(segs);
+	free(pl.ring_v);
+	free(pl.ring_d);
+	free(pl.strip_v);
+	free(pl.strip_t);
+
+	return -1;
+}
+
+void
+free_sphere_object(sphere_mesh_t * mesh)
+{
+	free(mesh->vertices);
+	free(mesh->indices);
+	free(mesh->dirs);
+	free(mesh->rings);
+	free(mesh->ring_theta);
+	free(mesh->ring_segs);
+	free(mesh->ring_sr);
+	free(mesh->ring_s);
+	mesh->vertices = NULL;
+	mesh->indices = NULL;
+	mesh->dirs = NULL;
+	mesh->rings = NULL;
+	mesh->ring_theta = NULL;
+	mesh->ring_segs = NULL;
+	mesh->ring_sr = NULL;
+	mesh->ring_s = NULL;
+}
+
+/**
+ * Edges of the sphere's triangles as index pairs into its vertices.
+ * The triangles share one winding, so an inner edge shows up once in
+ * each direction and is kept only in the ascending one; rim edges have
+ * a single triangle and are always kept.
+ */
+static int32_t
+collect_edges(const sphere_mesh_t * sphere, uint32_t * edges)
+{
+	const uint32_t * idxs = sphere->indices;
+	const int32_t * rings = sphere->rings;
+	int32_t n = 0;
+	int32_t t, k;
+
+	for (t=0; t<sphere->nindices; t+=3) {
+		for (k=0; k<3; k++) {
+			uint32_t a = idxs[t+k];
+			uint32_t b = idxs[t+(k+1)%3];
+
+			if (a < b || (rings[a] == sphere->ndiv_v && rings[b] == sphere->ndiv_v)) {
+				if (edges != NULL) {
+					edges[2*n+0] = a;
+					edges[2*n+1] = b;
+				}
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
+int
+alloc_sphere_wireframe(wireframe_mesh_t * mesh, const sphere_mesh_t * sphere)
+{
+	int32_t nedges = collect_edges(sphere, NULL);
+
+	mesh->nindices = 2*nedges;
+	mesh->indices = malloc(sizeof(uint32_t)*2*nedges);
+	if (mesh->indices == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	collect_edges(sphere, mesh->indices);
+
+	return 0;
+}
+
+void
+free_sphere_wireframe(wireframe_mesh_t * mesh)
+{
+	free(mesh->indices);
+	mesh->indices = NULL;
+}
+
+/**
+ * Texture coordinates for the lens. Only a change of lens type costs a
+ * projection, one per ring; otherwise this is a multiply-add per vertex.
+ */
+void
+update_sphere_object(sphere_mesh_t * mesh, const lens_param_t * lens)
+{
+	const int32_t n = mesh->nvertices;
+	const vec2_t * dirs = mesh->dirs;
+	const int32_t * rings = mesh->rings;
+	const double * ring_s = mesh->ring_s;
+	mesh_vertex_t * vtxs = mesh->vertices;
+	double cx = 0.5 + lens->center.x / 1024.0 * 0.5;
+	double cy = 0.5 + lens->center.y / 1024.0 * 0.5;
+	double t_r = lens->r / 1024.0;
+	int32_t j, v;
+
+	if (!mesh->sr_valid || mesh->sr_type != lens->type) {
+		/* the same kernel as remap_project_row() */
+		lens_span_fn_t project = lens_span_kernel(lens->type);
+		double rho[RING_CHUNK];
+		double z[RING_CHUNK];
+		int32_t k, m;
+
+		for (j=0; j<mesh->ndiv_v+1; j+=m) {
+			m = (mesh->ndiv_v+1 - j < RING_CHUNK) ? mesh->ndiv_v+1 - j : RING_CHUNK;
+			for (k=0; k<m; k++) {
+				rho[k] = sin(mesh->ring_theta[j+k]);
+				z[k] = cos(mesh->ring_theta[j+k]);
+			}
+			project(rho, z, mesh->ring_sr + j, m);
+		}
+		/* the pole stays exactly on the center */
+		mesh->ring_sr[0] = 0.0;
+		mesh->sr_type = lens->type;
+		mesh->sr_valid = 1;
+	}
+
+	for (j=0; j<mesh->ndiv_v+1; j++) {
+		mesh->ring_s[j] = mesh->ring_sr[j] * t_r;
+	}
+
+	for (v=0; v<n; v++) {
+		double s = ring_s[rings[v]];
+		vtxs[v].u = (float)(dirs[v].x * s + cx);
+		vtxs[v].v = (float)(dirs[v].y * s + cy);
+	}
+}
+
+/**
+ * Largest distance in source pixels between the texture coordinates GL
+ * interpolates across a triangle and the exact projection of the
+ * direction through that point, over every triangle of the mesh. The
+ * texture coordinates must be up to date for lens.
+ */
+double
+sphere_object_error(const sphere_mesh_t * mesh, const lens_param_t * lens)
+{
+	const mesh_vertex_t * vtxs = mesh->vertices;
+	const uint32_t * idxs = mesh->indices;
+	double cx = 0.5 + lens->center.x / 1024.0 * 0.5;
+	double cy = 0.5 + lens->center.y / 1024.0 * 0.5;
+	double err = 0.0;
+	int32_t t, k;
+
+	for (t=0; t<mesh->nindices; t+=3) {
+		vec3_t p[3];
+		vec2_t tp[3];
+		double e;
+
+		for (k=0; k<3; k++) {
+			const mesh_vertex_t * v = &vtxs[idxs[t+k]];
+			p[k] = vec3(v->x, v->y, v->z);
+			tp[k] = vec2((v->u - cx)/TEXSCALE_X*1024.0, (v->v - cy)/TEXSCALE_Y*1024.0);
+		}
+		e = triangle_error(lens->type, lens->r, p, tp);
+		if (e > err) {
+			err = e;
+		}
+	}
+
+	return err;
+}
+
+/**
+ * Bytes held by the mesh: shared vertices with their update data,
+ * indices and per-ring tables.
+ */
+size_t
+sphere_object_bytes(const sphere_mesh_t * mesh)
+{
+	return mesh->nvertices*(sizeof(mesh_vertex_t) + sizeof(vec2_t) + sizeof(int32_t))
+		+ mesh->nindices*sizeof(uint32_t)
+		+ (mesh->ndiv_v+1)*(3*sizeof(double) + sizeof(int32_t));
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
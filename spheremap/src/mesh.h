@@ -0,0 +1,87 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file mesh.h
+ * @brief Hemisphere meshes drawn by the viewer.
+ *
+ */
+
+#ifndef SPHERE_MESH_H_
+#define SPHERE_MESH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default tessellation: rings from the pole to the rim, sectors around it */
+#define  NDIV_V  (18)
+#define  NDIV_H  (9)
+
+/**
+ * Interleaved vertex as GL takes it: position, then texture
+ * coordinates.
+ */
+typedef struct {
+	float x, y, z;
+	float u, v;
+} mesh_vertex_t;
+
+/**
+ * Textured hemisphere as an indexed triangle list over shared
+ * vertices, three indices per triangle. Ring j lies at ring_theta[j]
+ * from the pole and is split into ring_segs[j] segments per sector,
+ * either as many as ring j-1 or one more; the uniform layout has
+ * ring_segs[j] == j.
+ *
+ * The geometry does not depend on the lens and is built once. Each
+ * vertex keeps its ring and its texture-space direction, so a change
+ * of lens center or radius is an affine pass over the texture
+ * coordinates; the projection is evaluated once per ring, and only
+ * when the lens type changes.
+ */
+typedef struct {
+	int32_t ndiv_v;
+	int32_t ndiv_h;
+	int32_t nvertices;
+	int32_t nindices;
+	mesh_vertex_t * vertices;
+	uint32_t * indices;
+	vec2_t * dirs;		/* (cos(phi), -sin(phi)) times TEXSCALE */
+	int32_t * rings;	/* ring of each vertex, 0 at the pole */
+	double * ring_theta;	/* ndiv_v+1 angles from the pole, ring_theta[0] == 0 */
+	int32_t * ring_segs;	/* segments per sector on each ring */
+	double * ring_sr;	/* lens_theta_to_radius() of each ring */
+	double * ring_s;	/* scratch: ring_sr scaled by the lens radius */
+	int32_t sr_valid;
+	lens_type_t sr_type;
+} sphere_mesh_t;
+
+/**
+ * Wireframe of a sphere mesh: each edge once, as index pairs into the
+ * sphere's vertices.
+ */
+typedef struct {
+	int32_t nindices;
+	uint32_t * indices;
+} wireframe_mesh_t;
+
+extern int alloc_sphere_object(sphere_mesh_t * mesh, int32_t ndiv_v, int32_t ndiv_h);
+extern int alloc_sphere_object_adaptive(sphere_mesh_t * mesh, const lens_param_t * lens, double tol);
+extern void free_sphere_object(sphere_mesh_t * mesh);
+extern void update_sphere_object(sphere_mesh_t * mesh, const lens_param_t * lens);
+extern double sphere_object_error(const sphere_mesh_t * mesh, const lens_param_t * lens);
+extern size_t sphere_object_bytes(const sphere_mesh_t * mesh);
+
+extern int alloc_sphere_wireframe(wireframe_mesh_t * mesh, const sphere_mesh_t * sphere);
+extern void free_sphere_wireframe(wireframe_mesh_t * mesh);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_MESH_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,240 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file meshbuf.c
+ * @brief Buffer objects holding the viewer's meshes on the GL side.
+ *
+ * The entry points are GL 1.5 (or ARB_vertex_buffer_object) and are
+ * looked up at run time, so the viewer still links against a GL 1.1
+ * library and falls back to client arrays where they are missing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include <SDL.h>
+#include <GL/gl.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "mesh.h"
+#include "meshbuf.h"
+#include "trace.h"
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER          0x8892
+#define GL_ELEMENT_ARRAY_BUFFER  0x8893
+#define GL_STATIC_DRAW           0x88E4
+#define GL_DYNAMIC_DRAW          0x88E8
+#endif
+
+typedef void (APIENTRY * gen_buffers_fn_t)(GLsizei n, GLuint * buffers);
+typedef void (APIENTRY * delete_buffers_fn_t)(GLsizei n, const GLuint * buffers);
+typedef void (APIENTRY * bind_buffer_fn_t)(GLenum target, GLuint buffer);
+typedef void (APIENTRY * buffer_data_fn_t)(GLenum target, ptrdiff_t size, const GLvoid * data, GLenum usage);
+
+static gen_buffers_fn_t s_gen_buffers;
+static delete_buffers_fn_t s_delete_buffers;
+static bind_buffer_fn_t s_bind_buffer;
+static buffer_data_fn_t s_buffer_data;
+
+static void *
+get_proc(const char_t * name, const char_t * suffix)
+{
+	char_t buf[64];
+
+	snprintf(buf, sizeof(buf), "%s%s", name, suffix);
+
+	return SDL_GL_GetProcAddress(buf);
+}
+
+/**
+ * Resolve the buffer object entry points, core names from GL 1.5 on
+ * and the ARB ones before. Returns the suffix used, or NULL.
+ */
+static const char_t *
+load_procs( void )
+{
+	const char_t * version = (const char_t *)glGetString(GL_VERSION);
+	const char_t * exts = (const char_t *)glGetString(GL_EXTENSIONS);
+	const char_t * suffix = NULL;
+	int major = 0;
+	int minor = 0;
+
+	if (version != NULL && sscanf(version, "%d.%d", &major, &minor) == 2 &&
+		(major > 1 || (major == 1 && minor >= 5))) {
+		suffix = "";
+	}
+	else if (exts != NULL && strstr(exts, "GL_ARB_vertex_buffer_object") != NULL) {
+		suffix = "ARB";
+	}
+	else {
+		return NULL;
+	}
+
+	s_gen_buffers = (gen_buffers_fn_t)get_proc("glGenBuffers", suffix);
+	s_delete_buffers = (delete_buffers_fn_t)get_proc("glDeleteBuffers", suffix);
+	s_bind_buffer = (bind_buffer_fn_t)get_proc("glBindBuffer", suffix);
+	s_buffer_data = (buffer_data_fn_t)get_proc("glBufferData", suffix);
+
+	if (s_gen_buffers == NULL || s_delete_buffers == NULL ||
+		s_bind_buffer == NULL || s_buffer_data == NULL) {
+		return NULL;
+	}
+
+	return suffix;
+}
+
+/**
+ * Set up the buffers on the current context. With enable clear, or
+ * without buffer object support, the meshes stay in client memory.
+ */
+int
+mesh_buffers_init(mesh_buffers_t * mb, int32_t enable)
+{
+	const char_t * suffix = NULL;
+
+	mb->enabled = 0;
+	mb->cur = 0;
+
+	if (enable) {
+		suffix = load_procs( );
+		if (suffix == NULL) {
+			fprintf(stderr, "Vertex buffer objects unavailable, using client arrays.\n");
+		}
+	}
+
+	if (suffix != NULL) {
+		GLuint ids[4];
+
+		s_gen_buffers(4, ids);
+		mb->vbo[0] = ids[0];
+		mb->vbo[1] = ids[1];
+		mb->ibo = ids[2];
+		mb->wf_ibo = ids[3];
+		mb->enabled = 1;
+	}
+
+	printf("vertex buffers: %s\n", (suffix == NULL) ? "off" : (suffix[0] ? "ARB" : "GL 1.5"));
+
+	return 0;
+}
+
+void
+mesh_buffers_free(mesh_buffers_t * mb)
+{
+	if (mb->enabled) {
+		GLuint ids[4] = {mb->vbo[0], mb->vbo[1], mb->ibo, mb->wf_ibo};
+
+		s_delete_buffers(4, ids);
+		mb->enabled = 0;
+	}
+}
+
+/**
+ * New topology: indices of both meshes, then the vertices.
+ */
+void
+mesh_buffers_geometry(mesh_buffers_t * mb, const sphere_mesh_t * sphere,
+					  const wireframe_mesh_t * wf)
+{
+	if (mb->enabled) {
+		TRACE_BEGIN("index upload");
+		s_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mb->ibo);
+		s_buffer_data(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t)*sphere->nindices,
+					  sphere->indices, GL_STATIC_DRAW);
+		s_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mb->wf_ibo);
+		s_buffer_data(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t)*wf->nindices,
+					  wf->indices, GL_STATIC_DRAW);
+		s_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		TRACE_END( );
+	}
+
+	mesh_buffers_vertices(mb, sphere);
+}
+
+/**
+ * New texture coordinates: fill the buffer the last frame did not
+ * draw from and make it current.
+ */
+void
+mesh_buffers_vertices(mesh_buffers_t * mb, const sphere_mesh_t * sphere)
+{
+	if (mb->enabled) {
+		int32_t nxt = mb->cur ^ 1;
+
+		TRACE_BEGIN("vertex upload");
+		s_bind_buffer(GL_ARRAY_BUFFER, mb->vbo[nxt]);
+		s_buffer_data(GL_ARRAY_BUFFER, sizeof(mesh_vertex_t)*sphere->nvertices,
+					  sphere->vertices, GL_DYNAMIC_DRAW);
+		s_bind_buffer(GL_ARRAY_BUFFER, 0);
+		TRACE_END( );
+		mb->cur = nxt;
+	}
+}
+
+/**
+ * Point the vertex (and texture coordinate) arrays at the current
+ * vertices, as offsets into the bound buffer or in client memory.
+ */
+static void
+bind_vertices(const mesh_buffers_t * mb, const sphere_mesh_t * sphere, int32_t texcoords)
+{
+	const GLubyte * base = (const GLubyte *)sphere->vertices;
+
+	if (mb->enabled) {
+		s_bind_buffer(GL_ARRAY_BUFFER, mb->vbo[mb->cur]);
+		base = NULL;
+	}
+
+	glVertexPointer(3, GL_FLOAT, sizeof(mesh_vertex_t), base + offsetof(mesh_vertex_t, x));
+	if (texcoords) {
+		glTexCoordPointer(2, GL_FLOAT, sizeof(mesh_vertex_t), base + offsetof(mesh_vertex_t, u));
+	}
+}
+
+static void
+draw_indexed(const mesh_buffers_t * mb, GLenum mode, GLuint ibo,
+			 int32_t nindices, const uint32_t * indices)
+{
+	if (mb->enabled) {
+		s_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glDrawElements(mode, nindices, GL_UNSIGNED_INT, NULL);
+		/* leave client arrays usable for everybody else */
+		s_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		s_bind_buffer(GL_ARRAY_BUFFER, 0);
+	}
+	else {
+		glDrawElements(mode, nindices, GL_UNSIGNED_INT, indices);
+	}
+}
+
+void
+mesh_buffers_draw_sphere(const mesh_buffers_t * mb, const sphere_mesh_t * sphere)
+{
+	bind_vertices(mb, sphere, 1);
+	draw_indexed(mb, GL_TRIANGLES, mb->ibo, sphere->nindices, sphere->indices);
+}
+
+void
+mesh_buffers_draw_wireframe(const mesh_buffers_t * mb, const sphere_mesh_t * sphere,
+							const wireframe_mesh_t * wf)
+{
+	bind_vertices(mb, sphere, 0);
+	draw_indexed(mb, GL_LINES, mb->wf_ibo, wf->nindices, wf->indices);
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,48 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file meshbuf.h
+ * @brief Buffer objects holding the viewer's meshes on the GL side.
+ *
+ */
+
+#ifndef SPHERE_MESHBUF_H_
+#define SPHERE_MESHBUF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Sphere vertices in two buffers used in turn: a new upload goes to
+ * the one the last frame did not draw from, then becomes current.
+ * Indices only change with the geometry. Without buffer objects the
+ * meshes are drawn from client memory as before.
+ */
+typedef struct {
+	int32_t enabled;
+	GLuint vbo[2];		/* sphere vertices, alternating */
+	GLuint ibo;			/* sphere triangles */
+	GLuint wf_ibo;		/* wireframe edges */
+	int32_t cur;		/* vbo drawn from */
+} mesh_buffers_t;
+
+extern int mesh_buffers_init(mesh_buffers_t * mb, int32_t enable);
+extern void mesh_buffers_free(mesh_buffers_t * mb);
+extern void mesh_buffers_geometry(mesh_buffers_t * mb, const sphere_mesh_t * sphere,
+								  const wireframe_mesh_t * wf);
+extern void mesh_buffers_vertices(mesh_buffers_t * mb, const sphere_mesh_t * sphere);
+extern void mesh_buffers_draw_sphere(const mesh_buffers_t * mb, const sphere_mesh_t * sphere);
+extern void mesh_buffers_draw_wireframe(const mesh_buffers_t * mb, const sphere_mesh_t * sphere,
+										const wireframe_mesh_t * wf);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_MESHBUF_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
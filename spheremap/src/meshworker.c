@@ -0,0 +1,267 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file meshworker.c
+ * @brief Viewer meshes rebuilt on a worker thread.
+ *
+ * A dense or adaptive tessellation takes long enough to stall the
+ * event loop while a key is held down. The worker builds meshes off
+ * the render thread, coalescing bursts of lens changes, and the render
+ * thread keeps drawing the previous mesh until the new one is handed
+ * over.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "mesh.h"
+#include "meshworker.h"
+#include "trace.h"
+
+static void
+free_mesh_set(mesh_set_t * set)
+{
+	free_sphere_wireframe(&set->wf);
+	free_sphere_object(&set->sphere);
+	set->valid = 0;
+}
+
+/**
+ * Whether the geometry of set can be reused for the request. An
+ * adaptive mesh is planned for the lens type and radius as well.
+ */
+static int32_t
+same_geometry(const mesh_set_t * set, const mesh_config_t * cfg, const lens_param_t * lens)
+{
+	if (!set->valid || set->cfg.adaptive != cfg->adaptive) {
+		return 0;
+	}
+	if (cfg->adaptive) {
+		return (set->cfg.tol == cfg->tol && set->type == lens->type && set->r == lens->r);
+	}
+
+	return (set->cfg.ndiv_v == cfg->ndiv_v && set->cfg.ndiv_h == cfg->ndiv_h);
+}
+
+static int
+build_mesh_set(mesh_set_t * set, const mesh_config_t * cfg, const lens_param_t * lens,
+			   uint32_t serial)
+{
+	if (!same_geometry(set, cfg, lens)) {
+		free_mesh_set(set);
+
+		if (cfg->adaptive) {
+			if (alloc_sphere_object_adaptive(&set->sphere, lens, cfg->tol) < 0) {
+				return -1;
+			}
+		}
+		else {
+			if (alloc_sphere_object(&set->sphere, cfg->ndiv_v, cfg->ndiv_h) < 0) {
+				return -1;
+			}
+		}
+
+		if (alloc_sphere_wireframe(&set->wf, &set->sphere) < 0) {
+			free_sphere_object(&set->sphere);
+			return -1;
+		}
+
+		set->valid = 1;
+		set->cfg = *cfg;
+		set->type = lens->type;
+		set->r = lens->r;
+		set->serial = serial;
+		TRACE_BEGIN("update_sphere_object");
+		update_sphere_object(&set->sphere, lens);
+		TRACE_END( );
+
+		printf("mesh: %d rings x %d sectors%s, %d vertices, %d triangles, %d kB, max error %.2f px\n",
+			   set->sphere.ndiv_v, set->sphere.ndiv_h, cfg->adaptive ? " (adaptive)" : "",
+			   set->sphere.nvertices, set->sphere.nindices/3,
+			   (int32_t)(sphere_object_bytes(&set->sphere)/1024),
+			   sphere_object_error(&set->sphere, lens));
+		return 0;
+	}
+
+	TRACE_BEGIN("update_sphere_object");
+	update_sphere_object(&set->sphere, lens);
+	TRACE_END( );
+
+	return 0;
+}
+
+static int
+worker_main(void * arg)
+{
+	mesh_worker_t * w = (mesh_worker_t *)arg;
+
+	TRACE_THREAD_NAME("mesh worker");
+	SDL_LockMutex(w->lock);
+	for (;;) {
+		mesh_config_t cfg;
+		lens_param_t lens;
+		mesh_set_t * set;
+		uint32_t serial;
+		int32_t t;
+
+		while (!w->pending && !w->quit) {
+			SDL_CondWait(w->wake, w->lock);
+		}
+		if (w->quit) {
+			break;
+		}
+
+		/* only the latest request counts */
+		cfg = w->cfg;
+		lens = w->lens;
+		w->pending = 0;
+		serial = ++w->serial;
+		set = &w->sets[w->back];
+		SDL_UnlockMutex(w->lock);
+
+		TRACE_BEGIN("mesh build");
+		if (build_mesh_set(set, &cfg, &lens, serial) < 0) {
+			free_mesh_set(set);
+		}
+		TRACE_END( );
+
+		SDL_LockMutex(w->lock);
+		if (set->valid) {
+			t = w->mid;
+			w->mid = w->back;
+			w->back = t;
+			w->fresh = 1;
+		}
+		w->builds++;
+
+		if (set->valid) {
+			/* wake a render loop sleeping in SDL_WaitEvent */
+			SDL_Event ev;
+
+			ev.type = SDL_USEREVENT;
+			ev.user.code = MESH_WORKER_EVENT;
+			ev.user.data1 = NULL;
+			ev.user.data2 = NULL;
+			SDL_PushEvent(&ev);
+		}
+	}
+	SDL_UnlockMutex(w->lock);
+
+	return 0;
+}
+
+int
+mesh_worker_start(mesh_worker_t * w)
+{
+	memset(w, 0, sizeof(*w));
+	w->front = 0;
+	w->mid = 1;
+	w->back = 2;
+
+	w->lock = SDL_CreateMutex( );
+	w->wake = SDL_CreateCond( );
+	if (w->lock == NULL || w->wake == NULL) {
+		fprintf(stderr, "Failed to create a lock: %s\n", SDL_GetError());
+		return -1;
+	}
+
+	w->thread = SDL_CreateThread(worker_main, w);
+	if (w->thread == NULL) {
+		fprintf(stderr, "Failed to create a thread: %s\n", SDL_GetError());
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+mesh_worker_stop(mesh_worker_t * w)
+{
+	int32_t i;
+
+	if (w->thread != NULL) {
+		SDL_LockMutex(w->lock);
+		w->quit = 1;
+		SDL_CondSignal(w->wake);
+		SDL_UnlockMutex(w->lock);
+		SDL_WaitThread(w->thread, NULL);
+		w->thread = NULL;
+	}
+
+	for (i=0; i<3; i++) {
+		free_mesh_set(&w->sets[i]);
+	}
+
+	if (w->wake != NULL) {
+		SDL_DestroyCond(w->wake);
+	}
+	if (w->lock != NULL) {
+		SDL_DestroyMutex(w->lock);
+	}
+}
+
+/**
+ * Ask for a mesh for the lens. Replaces a request still waiting.
+ */
+void
+mesh_worker_request(mesh_worker_t * w, const mesh_config_t * cfg, const lens_param_t * lens)
+{
+	SDL_LockMutex(w->lock);
+	w->cfg = *cfg;
+	w->lens = *lens;
+	w->pending = 1;
+	w->requests++;
+	SDL_CondSignal(w->wake);
+	SDL_UnlockMutex(w->lock);
+}
+
+/**
+ * The set to draw: the newest finished one, if any, swapped in for
+ * the previous front. *fresh tells whether it changed since the last
+ * call. The set stays untouched until the next call; it is invalid
+ * until the first build is done.
+ */
+const mesh_set_t *
+mesh_worker_acquire(mesh_worker_t * w, int32_t * fresh)
+{
+	int32_t t;
+
+	SDL_LockMutex(w->lock);
+	*fresh = w->fresh;
+	if (w->fresh) {
+		t = w->front;
+		w->front = w->mid;
+		w->mid = t;
+		w->fresh = 0;
+	}
+	SDL_UnlockMutex(w->lock);
+
+	return &w->sets[w->front];
+}
+
+/**
+ * Requests made and meshes built so far.
+ */
+void
+mesh_worker_stats(mesh_worker_t * w, int32_t * requests, int32_t * builds)
+{
+	SDL_LockMutex(w->lock);
+	*requests = w->requests;
+	*builds = w->builds;
+	SDL_UnlockMutex(w->lock);
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,84 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file meshworker.h
+ * @brief Viewer meshes rebuilt on a worker thread.
+ *
+ */
+
+#ifndef SPHERE_MESHWORKER_H_
+#define SPHERE_MESHWORKER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* SDL_USEREVENT code posted when a new mesh is ready */
+#define  MESH_WORKER_EVENT  (1)
+
+/**
+ * Tessellation: ndiv_v rings by ndiv_h sectors, or adaptive to the
+ * lens within tol pixels.
+ */
+typedef struct {
+	int32_t ndiv_v;
+	int32_t ndiv_h;
+	int32_t adaptive;
+	double tol;
+} mesh_config_t;
+
+/**
+ * A sphere and its wireframe as built for one request.
+ */
+typedef struct {
+	int32_t valid;
+	mesh_config_t cfg;	/* tessellation of the geometry */
+	lens_type_t type;	/* lens an adaptive mesh was planned for */
+	double r;
+	uint32_t serial;	/* changes with every new geometry */
+	sphere_mesh_t sphere;
+	wireframe_mesh_t wf;
+} mesh_set_t;
+
+/**
+ * Requests overwrite each other, so the worker only builds the latest
+ * one. Results go through three sets like a triple buffer: the render
+ * thread draws from front, the worker builds into back, and a finished
+ * back is swapped with mid, which the render thread swaps with front
+ * when it picks the result up. Neither side ever waits for the other
+ * to finish a mesh.
+ */
+typedef struct {
+	SDL_Thread * thread;
+	SDL_mutex * lock;
+	SDL_cond * wake;
+	mesh_set_t sets[3];
+	int32_t front;
+	int32_t mid;
+	int32_t back;
+	int32_t fresh;		/* mid holds a result not yet taken */
+	int32_t pending;	/* a request is waiting */
+	int32_t quit;
+	mesh_config_t cfg;	/* latest request */
+	lens_param_t lens;
+	uint32_t serial;
+	int32_t requests;
+	int32_t builds;
+} mesh_worker_t;
+
+extern int mesh_worker_start(mesh_worker_t * w);
+extern void mesh_worker_stop(mesh_worker_t * w);
+extern void mesh_worker_request(mesh_worker_t * w, const mesh_config_t * cfg, const lens_param_t * lens);
+extern const mesh_set_t * mesh_worker_acquire(mesh_worker_t * w, int32_t * fresh);
+extern void mesh_worker_stats(mesh_worker_t * w, int32_t * requests, int32_t * builds);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_MESHWORKER_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
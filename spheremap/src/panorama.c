@@ -0,0 +1,363 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file panorama.c
+ * @brief Batch fisheye to equirectangular panorama converter.
+ *
+ * Every input shares one lens calibration, so the remap table is built
+ * once per source resolution and reused for the whole batch. Images are
+ * converted in parallel, one image per pool task.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "lenscurve.h"
+#include "remap.h"
+#include "pool.h"
+#include "tilesrc.h"
+#include "lut.h"
+#include "pnm.h"
+
+#define  MAX_LUTS  (16)
+
+typedef struct {
+	lens_param_t lens;
+	view_param_t view;
+	const char_t * out_dir;
+	const char_t * cache_dir;
+
+	char_t ** files;
+	int32_t nfiles;
+	int32_t cap;
+
+	pthread_mutex_t lut_lock;
+	remap_lut_t luts[MAX_LUTS];
+	int32_t nluts;
+
+	pthread_mutex_t err_lock;
+	int32_t nerrors;
+} batch_t;
+
+static void
+usage(const char_t * prog)
+{
+	fprintf(stderr,
+			"Usage: %s [options] (image.pnm | directory) ...\n"
+			"  -t type   lens type (default: equidistant)\n"
+			"  -L file   load a lens curve file and use it (-t curve)\n"
+			"  -x cx     lens center offset x in pixels (default: 0)\n"
+			"  -y cy     lens center offset y in pixels (default: 0)\n"
+			"  -r r      image circle radius in pixels (default: half the short side)\n"
+			"  -Y yaw    panorama yaw in degrees (default: 0)\n"
+			"  -P pitch  panorama pitch in degrees (default: 0)\n"
+			"  -2        half (180 degree) equirectangular output\n"
+			"  -H height output height (default: image circle diameter)\n"
+			"  -o dir    output directory (default: .)\n"
+			"  -C dir    keep remap tables in a cache directory\n"
+			"  -j n      worker threads (default: one per CPU)\n",
+			prog);
+}
+
+static int
+add_file(batch_t * b, const char_t * path)
+{
+	char_t * dup;
+
+	if (b->nfiles == b->cap) {
+		int32_t cap = (b->cap > 0) ? b->cap*2 : 64;
+		char_t ** files = realloc(b->files, sizeof(char_t *)*cap);
+		if (files == NULL) {
+			fprintf(stderr, "Failed to allocate memory...\n");
+			return -1;
+		}
+		b->files = files;
+		b->cap = cap;
+	}
+
+	dup = malloc(strlen(path) + 1);
+	if (dup == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+	strcpy(dup, path);
+	b->files[b->nfiles++] = dup;
+
+	return 0;
+}
+
+static int
+has_pnm_suffix(const char_t * name)
+{
+	static const char_t * const exts[] = {".pnm", ".ppm", ".pgm", ".pam"};
+	size_t len = strlen(name);
+	size_t i;
+
+	for (i=0; i<sizeof(exts)/sizeof(exts[0]); i++) {
+		if (len > 4 && strcmp(name + len - 4, exts[i]) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+add_path(batch_t * b, const char_t * path)
+{
+	DIR * dir = opendir(path);
+	struct dirent * ent;
+
+	if (dir == NULL) {
+		/* not a directory, take it as an image */
+		return add_file(b, path);
+	}
+
+	while ((ent = readdir(dir)) != NULL) {
+		char_t buf[4096];
+		if (!has_pnm_suffix(ent->d_name)) {
+			continue;
+		}
+		snprintf(buf, sizeof(buf), "%s/%s", path, ent->d_name);
+		buf[sizeof(buf)-1] = 0;
+		if (add_file(b, buf) < 0) {
+			closedir(dir);
+			return -1;
+		}
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+static int
+cmp_path(const void * a, const void * b)
+{
+	return strcmp(*(char_t * const *)a, *(char_t * const *)b);
+}
+
+/**
+ * Table for a given source size and the lens/view derived from it.
+ * Built by the first task that needs it; the others wait on lut_lock.
+ */
+static const remap_lut_t *
+get_lut(batch_t * b, const lens_param_t * lens, const view_param_t * view,
+		int32_t src_w, int32_t src_h)
+{
+	const remap_lut_t * found = NULL;
+	int32_t i;
+
+	pthread_mutex_lock(&b->lut_lock);
+	for (i=0; i<b->nluts; i++) {
+		if (b->luts[i].src_width == src_w && b->luts[i].src_height == src_h) {
+			found = &b->luts[i];
+			break;
+		}
+	}
+
+	if (found == NULL && b->nluts < MAX_LUTS) {
+		remap_lut_t * lut = &b->luts[b->nluts];
+		int rc;
+
+		if (b->cache_dir != NULL) {
+			rc = remap_lut_load_cached(lut, NULL, REMAP_LUT_FIXED, b->cache_dir,
+									   lens, view, src_w, src_h);
+		}
+		else {
+			rc = remap_lut_build(lut, NULL, REMAP_LUT_FIXED, lens, view, src_w, src_h);
+		}
+		if (rc == 0) {
+			found = lut;
+			b->nluts++;
+		}
+	}
+	else if (found == NULL) {
+		fprintf(stderr, "Too many distinct source sizes (max %d)\n", MAX_LUTS);
+	}
+	pthread_mutex_unlock(&b->lut_lock);
+
+	return found;
+}
+
+static void
+output_path(char_t * buf, size_t len, const batch_t * b, const char_t * in, int32_t channels)
+{
+	const char_t * base = strrchr(in, '/');
+	const char_t * dot;
+	int32_t stem;
+
+	base = (base != NULL) ? base + 1 : in;
+	dot = strrchr(base, '.');
+	stem = (dot != NULL) ? (int32_t)(dot - base) : (int32_t)strlen(base);
+
+	snprintf(buf, len, "%s/%.*s%s", b->out_dir, stem, base,
+			 (channels == 1) ? ".pgm" : (channels == 3) ? ".ppm" : ".pam");
+	buf[len-1] = 0;
+}
+
+static int
+convert_one(batch_t * b, const char_t * path)
+{
+	lens_param_t lens = b->lens;
+	view_param_t view = b->view;
+	const remap_lut_t * lut;
+	image_t src, dst;
+	char_t out[4096];
+	int rc = -1;
+
+	if (pnm_read(path, &src) < 0) {
+		return -1;
+	}
+
+	if (lens.r <= 0.0) {
+		lens.r = 0.5*((src.width < src.height) ? src.width : src.height);
+	}
+	if (view.height <= 0) {
+		view.height = (int32_t)(2.0*lens.r + 0.5);
+	}
+	view.width = (view.projection == VIEW_HALF_EQUIRECT) ? view.height : 2*view.height;
+
+	lut = get_lut(b, &lens, &view, src.width, src.height);
+	if (lut != NULL && image_alloc(&dst, view.width, view.height, src.channels) == 0) {
+		if (remap_lut_apply(&dst, &src, lut, NULL) == 0) {
+			output_path(out, sizeof(out), b, path, dst.channels);
+			rc = pnm_write(out, &dst);
+		}
+		image_free(&dst);
+	}
+	image_free(&src);
+
+	return rc;
+}
+
+static void
+convert_task(void * arg, int32_t task, int32_t worker)
+{
+	batch_t * b = arg;
+
+	if (convert_one(b, b->files[task]) < 0) {
+		fprintf(stderr, "Failed to convert %s\n", b->files[task]);
+		pthread_mutex_lock(&b->err_lock);
+		b->nerrors++;
+		pthread_mutex_unlock(&b->err_lock);
+	}
+}
+
+int
+main(int argc, char ** argv)
+{
+	batch_t b;
+	int32_t nthreads = 0;
+	pool_t * pool;
+	int32_t i;
+	int opt;
+
+	memset(&b, 0, sizeof(b));
+	b.lens.type = LENS_EQUIDISTANT;
+	b.view.projection = VIEW_EQUIRECT;
+	b.out_dir = ".";
+
+	while ((opt = getopt(argc, argv, "t:L:x:y:r:Y:P:2H:o:C:j:h")) != -1) {
+		switch (opt) {
+		case 't':
+			if (lens_type_from_name(&b.lens.type, optarg) < 0) {
+				exit(1);
+			}
+			break;
+		case 'L':
+			if (lens_curve_load(optarg) < 0) {
+				exit(1);
+			}
+			b.lens.type = LENS_CURVE;
+			break;
+		case 'x':
+			b.lens.center.x = atof(optarg);
+			break;
+		case 'y':
+			b.lens.center.y = atof(optarg);
+			break;
+		case 'r':
+			b.lens.r = atof(optarg);
+			break;
+		case 'Y':
+			b.view.yaw = atof(optarg);
+			break;
+		case 'P':
+			b.view.pitch = atof(optarg);
+			break;
+		case '2':
+			b.view.projection = VIEW_HALF_EQUIRECT;
+			break;
+		case 'H':
+			b.view.height = atoi(optarg);
+			break;
+		case 'o':
+			b.out_dir = optarg;
+			break;
+		case 'C':
+			b.cache_dir = optarg;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	for (i=optind; i<argc; i++) {
+		if (add_path(&b, argv[i]) < 0) {
+			exit(1);
+		}
+	}
+	qsort(b.files, b.nfiles, sizeof(char_t *), cmp_path);
+
+	pool = pool_create(nthreads);
+	if (pool == NULL) {
+		exit(1);
+	}
+
+	pthread_mutex_init(&b.lut_lock, NULL);
+	pthread_mutex_init(&b.err_lock, NULL);
+
+	/* select the remap kernel before the workers start */
+	remap_select_isa(REMAP_ISA_AUTO);
+	pool_run(pool, b.nfiles, convert_task, &b);
+
+	pool_destroy(pool);
+
+	fprintf(stderr, "%d images, %d failed, %d remap table(s)\n", b.nfiles, b.nerrors, b.nluts);
+
+	for (i=0; i<b.nluts; i++) {
+		remap_lut_free(&b.luts[i]);
+	}
+	for (i=0; i<b.nfiles; i++) {
+		free(b.files[i]);
+	}
+	free(b.files);
+	pthread_mutex_destroy(&b.err_lock);
+	pthread_mutex_destroy(&b.lut_lock);
+
+	return (b.nerrors > 0) ? 1 : 0;
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,245 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file pnm.c
+ * @brief Netpbm (PGM/PPM/PAM) image I/O for the headless tools.
+ *
+ * Only binary 8-bit variants are handled: P5 (gray), P6 (RGB) and
+ * P7 (PAM with depth 1, 3 or 4).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "remap.h"
+#include "pnm.h"
+
+static int
+read_token(FILE * fp, char_t * buf, size_t len)
+{
+	size_t n = 0;
+	int c;
+
+	/* skip white space and comments */
+	for (;;) {
+		c = fgetc(fp);
+		if (c == '#') {
+			while (c != '\n' && c != EOF) {
+				c = fgetc(fp);
+			}
+		}
+		else if (!isspace(c)) {
+			break;
+		}
+	}
+
+	while (c != EOF && !isspace(c)) {
+		if (n+1 < len) {
+			buf[n++] = (char_t)c;
+		}
+		c = fgetc(fp);
+	}
+	buf[n] = 0;
+
+	return (n > 0) ? 0 : -1;
+}
+
+static int
+read_pam_header(FILE * fp, int32_t * w, int32_t * h, int32_t * depth, int32_t * maxval)
+{
+	char_t tok[64];
+
+	for (;;) {
+		if (read_token(fp, tok, sizeof(tok)) < 0) {
+			return -1;
+		}
+		if (strcmp(tok, "ENDHDR") == 0) {
+			break;
+		}
+		else if (strcmp(tok, "TUPLTYPE") == 0) {
+			if (read_token(fp, tok, sizeof(tok)) < 0) {
+				return -1;
+			}
+		}
+		else {
+			char_t val[64];
+			if (read_token(fp, val, sizeof(val)) < 0) {
+				return -1;
+			}
+			if (strcmp(tok, "WIDTH") == 0) {
+				*w = atoi(val);
+			}
+			else if (strcmp(tok, "HEIGHT") == 0) {
+				*h = atoi(val);
+			}
+			else if (strcmp(tok, "DEPTH") == 0) {
+				*depth = atoi(val);
+			}
+			else if (strcmp(tok, "MAXVAL") == 0) {
+				*maxval = atoi(val);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Parse the header and leave fp at the first pixel. Rows follow as
+ * width*depth bytes each, with no padding.
+ */
+int
+pnm_read_header(FILE * fp, int32_t * width, int32_t * height, int32_t * channels)
+{
+	char_t tok[64];
+	int32_t w = 0;
+	int32_t h = 0;
+	int32_t depth = 0;
+	int32_t maxval = 0;
+
+	if (read_token(fp, tok, sizeof(tok)) < 0) {
+		return -1;
+	}
+
+	if (strcmp(tok, "P7") == 0) {
+		if (read_pam_header(fp, &w, &h, &depth, &maxval) < 0) {
+			fprintf(stderr, "Broken PAM header\n");
+			return -1;
+		}
+	}
+	else if (strcmp(tok, "P5") == 0 || strcmp(tok, "P6") == 0) {
+		char_t sw[16], sh[16], sm[16];
+		if (read_token(fp, sw, sizeof(sw)) < 0 ||
+			read_token(fp, sh, sizeof(sh)) < 0 ||
+			read_token(fp, sm, sizeof(sm)) < 0) {
+			fprintf(stderr, "Broken PNM header\n");
+			return -1;
+		}
+		w = atoi(sw);
+		h = atoi(sh);
+		maxval = atoi(sm);
+		depth = (tok[1] == '5') ? 1 : 3;
+	}
+	else {
+		fprintf(stderr, "Unsupported image format: %s\n", tok);
+		return -1;
+	}
+
+	if (maxval != 255 || (depth != 1 && depth != 3 && depth != 4) || w <= 0 || h <= 0) {
+		fprintf(stderr, "Unsupported PNM: depth %d, maxval %d\n", depth, maxval);
+		return -1;
+	}
+
+	*width = w;
+	*height = h;
+	*channels = depth;
+
+	return 0;
+}
+
+int
+pnm_read_file(FILE * fp, image_t * img)
+{
+	int32_t w, h, depth;
+	int32_t y;
+
+	if (pnm_read_header(fp, &w, &h, &depth) < 0) {
+		return -1;
+	}
+
+	if (image_alloc(img, w, h, depth) < 0) {
+		return -1;
+	}
+
+	for (y=0; y<h; y++) {
+		if (fread(img->pixels + (size_t)y*img->stride, 1, (size_t)w*depth, fp) != (size_t)w*depth) {
+			fprintf(stderr, "Unexpected end of image data\n");
+			image_free(img);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int
+pnm_write_file(FILE * fp, const image_t * img)
+{
+	int32_t y;
+
+	switch (img->channels) {
+	case 1:
+		fprintf(fp, "P5\n%d %d\n255\n", img->width, img->height);
+		break;
+	case 3:
+		fprintf(fp, "P6\n%d %d\n255\n", img->width, img->height);
+		break;
+	default:
+		fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+				img->width, img->height, img->channels,
+				(img->channels == 4) ? "RGB_ALPHA" : "GRAYSCALE_ALPHA");
+		break;
+	}
+
+	for (y=0; y<img->height; y++) {
+		size_t len = (size_t)img->width*img->channels;
+		if (fwrite(img->pixels + (size_t)y*img->stride, 1, len, fp) != len) {
+			fprintf(stderr, "Failed to write image data\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int
+pnm_read(const char_t * path, image_t * img)
+{
+	FILE * fp;
+	int rc;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return -1;
+	}
+
+	rc = pnm_read_file(fp, img);
+	fclose(fp);
+
+	return rc;
+}
+
+int
+pnm_write(const char_t * path, const image_t * img)
+{
+	FILE * fp;
+	int rc;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return -1;
+	}
+
+	rc = pnm_write_file(fp, img);
+	if (fclose(fp) != 0) {
+		rc = -1;
+	}
+
+	return rc;
+}
+
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,31 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file pnm.h
+ * @brief Netpbm (PGM/PPM/PAM) image I/O for the headless tools.
+ *
+ */
+
+#ifndef SPHERE_PNM_H_
+#define SPHERE_PNM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int pnm_read_header(FILE * fp, int32_t * width, int32_t * height, int32_t * channels);
+extern int pnm_read_file(FILE * fp, image_t * img);
+extern int pnm_write_file(FILE * fp, const image_t * img);
+extern int pnm_read(const char_t * path, image_t * img);
+extern int pnm_write(const char_t * path, const image_t * img);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_PNM_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,303 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file pool.c
+ * @brief Fixed-size worker pool running indexed tasks with work stealing.
+ *
+ * pool_run() hands every worker a contiguous slice of the task indices,
+ * so neighbouring tiles stay on one core. A worker that runs out steals
+ * the back half of the next non-empty slice, which keeps stolen work
+ * contiguous as well. The calling thread acts as worker 0.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "common.h"
+#include "pool.h"
+
+typedef struct {
+	pthread_mutex_t lock;
+	int32_t begin;
+	int32_t end;
+	/* keep neighbouring queues on separate cache lines */
+	uint8_t pad[64];
+} pool_queue_t;
+
+typedef struct {
+	pool_t * pool;
+	int32_t id;
+} pool_worker_t;
+
+struct pool {
+	int32_t nthreads;
+	pthread_t * threads;
+	pool_worker_t * workers;
+	pool_queue_t * queues;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start_cv;
+	pthread_cond_t done_cv;
+	uint32_t generation;
+	int32_t busy;
+	int32_t quit;
+
+	pool_task_fn_t fn;
+	void * arg;
+};
+
+int32_t
+pool_default_threads(void)
+{
+	long n;
+
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	n = (long)si.dwNumberOfProcessors;
+#else
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return (n > 0) ? (int32_t)n : 1;
+}
+
+static int
+pop_task(pool_queue_t * q, int32_t * task)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->begin < q->end) {
+		*task = q->begin++;
+		found = 1;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return found;
+}
+
+static int
+steal_tasks(pool_t * pool, int32_t id)
+{
+	int32_t i;
+
+	for (i=1; i<pool->nthreads; i++) {
+		pool_queue_t * victim = &pool->queues[(id + i) % pool->nthreads];
+		int32_t b = 0;
+		int32_t e = 0;
+
+		pthread_mutex_lock(&victim->lock);
+		if (victim->begin < victim->end) {
+			int32_t take = (victim->end - victim->begin + 1) / 2;
+			e = victim->end;
+			b = e - take;
+			victim->end = b;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if (b < e) {
+			pool_queue_t * own = &pool->queues[id];
+			pthread_mutex_lock(&own->lock);
+			own->begin = b;
+			own->end = e;
+			pthread_mutex_unlock(&own->lock);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+run_tasks(pool_t * pool, int32_t id)
+{
+	pool_queue_t * own = &pool->queues[id];
+	int32_t task;
+
+	for (;;) {
+		while (pop_task(own, &task)) {
+			pool->fn(pool->arg, task, id);
+		}
+		if (!steal_tasks(pool, id)) {
+			break;
+		}
+	}
+}
+
+static void *
+worker_main(void * p)
+{
+	pool_worker_t * w = p;
+	pool_t * pool = w->pool;
+	uint32_t seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->generation == seen) {
+			pthread_cond_wait(&pool->start_cv, &pool->lock);
+		}
+		if (pool->quit) {
+			break;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_tasks(pool, w->id);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->busy--;
+		if (pool->busy == 0) {
+			pthread_cond_signal(&pool->done_cv);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ * Create a pool of nthreads workers including the caller.
+ * nthreads <= 0 uses one worker per online CPU.
+ */
+pool_t *
+pool_create(int32_t nthreads)
+{
+	pool_t * pool;
+	int32_t i;
+
+	if (nthreads <= 0) {
+		nthreads = pool_default_threads( );
+	}
+
+	pool = calloc(1, sizeof(pool_t));
+	if (pool == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return NULL;
+	}
+
+	pool->nthreads = nthreads;
+	pool->threads = calloc(nthreads, sizeof(pthread_t));
+	pool->workers = calloc(nthreads, sizeof(pool_worker_t));
+	pool->queues = calloc(nthreads, sizeof(pool_queue_t));
+	if (pool->threads == NULL || pool->workers == NULL || pool->queues == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(pool->queues);
+		free(pool->workers);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start_cv, NULL);
+	pthread_cond_init(&pool->done_cv, NULL);
+	for (i=0; i<nthreads; i++) {
+		pthread_mutex_init(&pool->queues[i].lock, NULL);
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+	}
+
+	for (i=1; i<nthreads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->workers[i]) != 0) {
+			fprintf(stderr, "Failed to start worker thread %d\n", i);
+			/* run with the workers started so far */
+			pool->nthreads = i;
+			break;
+		}
+	}
+
+	return pool;
+}
+
+void
+pool_destroy(pool_t * pool)
+{
+	int32_t i;
+
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start_cv);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i=1; i<pool->nthreads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	for (i=0; i<pool->nthreads; i++) {
+		pthread_mutex_destroy(&pool->queues[i].lock);
+	}
+	pthread_cond_destroy(&pool->done_cv);
+	pthread_cond_destroy(&pool->start_cv);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->queues);
+	free(pool->workers);
+	free(pool->threads);
+	free(pool);
+}
+
+int32_t
+pool_size(const pool_t * pool)
+{
+	return (pool != NULL) ? pool->nthreads : 1;
+}
+
+/**
+ * Run fn(arg, task, worker) for every task in [0, ntasks) and return when
+ * all of them have finished. A NULL pool runs the tasks in order on the
+ * calling thread.
+ */
+void
+pool_run(pool_t * pool, int32_t ntasks, pool_task_fn_t fn, void * arg)
+{
+	int32_t i;
+
+	if (pool == NULL || pool->nthreads == 1 || ntasks <= 1) {
+		for (i=0; i<ntasks; i++) {
+			fn(arg, i, 0);
+		}
+		return;
+	}
+
+	pool->fn = fn;
+	pool->arg = arg;
+	for (i=0; i<pool->nthreads; i++) {
+		pool_queue_t * q = &pool->queues[i];
+		pthread_mutex_lock(&q->lock);
+		q->begin = (int32_t)((int64_t)ntasks*i/pool->nthreads);
+		q->end   = (int32_t)((int64_t)ntasks*(i+1)/pool->nthreads);
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->generation++;
+	pool->busy = pool->nthreads - 1;
+	pthread_cond_broadcast(&pool->start_cv);
+	pthread_mutex_unlock(&pool->lock);
+
+	run_tasks(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0) {
+		pthread_cond_wait(&pool->done_cv, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,39 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file pool.h
+ * @brief Fixed-size worker pool running indexed tasks with work stealing.
+ *
+ */
+
+#ifndef SPHERE_POOL_H_
+#define SPHERE_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pool pool_t;
+
+/**
+ * Task body. worker is in [0, pool_size()) and stays the same for the
+ * whole task, so it can index per-thread scratch buffers.
+ */
+typedef void (*pool_task_fn_t)(void * arg, int32_t task, int32_t worker);
+
+extern pool_t * pool_create(int32_t nthreads);
+extern void pool_destroy(pool_t * pool);
+extern int32_t pool_size(const pool_t * pool);
+extern void pool_run(pool_t * pool, int32_t ntasks, pool_task_fn_t fn, void * arg);
+extern int32_t pool_default_threads(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_POOL_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,363 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file remap.c
+ * @brief Headless fisheye to rectilinear remapping.
+ *
+ * Every output pixel is cast as a ray through the output camera, rotated
+ * into the lens frame and projected with the lens model's span kernel,
+ * which the interactive viewer shares for its texture coordinates.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "remap.h"
+#include "remap_kernel.h"
+
+static remap_row_fn_t s_sample_row = NULL;
+static remap_fixed_row_fn_t s_sample_row_fixed = NULL;
+
+int
+image_alloc(image_t * img, int32_t width, int32_t height, int32_t channels)
+{
+	uint8_t * pixels;
+
+	if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+		fprintf(stderr, "Invalid image geometry: %dx%dx%d\n", width, height, channels);
+		return -1;
+	}
+
+	pixels = malloc((size_t)width*height*channels);
+	if (pixels == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	img->width = width;
+	img->height = height;
+	img->channels = channels;
+	img->stride = width*channels;
+	img->pixels = pixels;
+
+	return 0;
+}
+
+void
+image_free(image_t * img)
+{
+	free(img->pixels);
+	img->pixels = NULL;
+}
+
+/* Pixels projected per call of the span kernel */
+#define  PROJ_CHUNK  (64)
+
+/**
+ * Source pixel coordinates for one output row, stored as (x, y) float
+ * pairs. Rays outside the front hemisphere get (-1, -1), which the
+ * sampler treats as outside the image.
+ */
+void
+remap_project_row(float * sxy, const lens_param_t * lens, const view_param_t * view,
+				  int32_t src_w, int32_t src_h, int32_t y)
+{
+	double fH = tan(view->fovY*0.5/180.0*M_PI);
+	double fW = fH*((double)view->width)/((double)view->height);
+	double span = (view->projection == VIEW_HALF_EQUIRECT) ? M_PI : 2.0*M_PI;
+	double cyaw = cos(-view->yaw/180.0*M_PI);
+	double syaw = sin(-view->yaw/180.0*M_PI);
+	double cpitch = cos(-view->pitch/180.0*M_PI);
+	double spitch = sin(-view->pitch/180.0*M_PI);
+	double cx = 0.5*src_w + lens->center.x - 0.5;
+	double cy = 0.5*src_h + lens->center.y - 0.5;
+	double ey = (1.0 - 2.0*(y + 0.5)/view->height)*fH;
+	double lat = (0.5 - (y + 0.5)/view->height)*M_PI;
+	lens_span_fn_t project = lens_span_kernel(lens->type);
+	int32_t x0;
+
+	for (x0=0; x0<view->width; x0+=PROJ_CHUNK) {
+		double rho[PROJ_CHUNK];
+		double z[PROJ_CHUNK];
+		double sr[PROJ_CHUNK];
+		double ux[PROJ_CHUNK];
+		double uy[PROJ_CHUNK];
+		int32_t m = (view->width - x0 < PROJ_CHUNK) ? view->width - x0 : PROJ_CHUNK;
+		int32_t k;
+
+		for (k=0; k<m; k++) {
+			int32_t x = x0 + k;
+			double ex, ez;
+
+			if (view->projection == VIEW_RECTILINEAR) {
+				ex = (2.0*(x + 0.5)/view->width - 1.0)*fW;
+				ez = -1.0;
+			}
+			else {
+				double lon = ((x + 0.5)/view->width - 0.5)*span;
+				ex = cos(lat)*sin(lon);
+				ey = sin(lat);
+				ez = -cos(lat)*cos(lon);
+			}
+
+			{
+				/* undo glRotatef(pitch, 1, 0, 0) after glRotatef(yaw, 0, 1, 0) */
+				double ax = ex*cyaw + ez*syaw;
+				double az = -ex*syaw + ez*cyaw;
+				double wx = ax;
+				double wy = ey*cpitch - az*spitch;
+				double wz = ey*spitch + az*cpitch;
+				double d = sqrt(wx*wx + wy*wy);
+
+				rho[k] = d;
+				z[k] = -wz;
+				ux[k] = 0.0;
+				uy[k] = 0.0;
+				if (d > 0.0) {
+					ux[k] =  wx/d;
+					uy[k] = -wy/d;
+				}
+			}
+		}
+
+		project(rho, z, sr, m);
+
+		for (k=0; k<m; k++) {
+			float * p = sxy + 2*(x0 + k);
+			/* behind the lens: theta > pi/2 */
+			if (z[k] < 0.0) {
+				p[0] = -1.0f;
+				p[1] = -1.0f;
+			}
+			else {
+				p[0] = (float)(cx + sr[k]*lens->r*ux[k]);
+				p[1] = (float)(cy + sr[k]*lens->r*uy[k]);
+			}
+		}
+	}
+}
+
+/**
+ * Bilinear fetch with 8-bit sub-pixel weights. Blending is done
+ * horizontally then vertically, rounding after each pass, so that every
+ * intermediate fits in 16 bits.
+ */
+static inline void
+blend_bilinear(uint8_t * dst, const image_t * src, int32_t xi, int32_t yi)
+{
+	const int32_t nc = src->channels;
+	int32_t fx = xi & 0xff;
+	int32_t fy = yi & 0xff;
+	const uint8_t * p0 = src->pixels + (size_t)(yi >> 8)*src->stride + (xi >> 8)*nc;
+	const uint8_t * p1 = p0 + src->stride;
+	int32_t c;
+
+	for (c=0; c<nc; c++) {
+		uint32_t t = (p0[c]*(256-fx) + p0[c+nc]*fx + 128) >> 8;
+		uint32_t b = (p1[c]*(256-fx) + p1[c+nc]*fx + 128) >> 8;
+		dst[c] = (uint8_t)((t*(256-fy) + b*fy + 128) >> 8);
+	}
+}
+
+static inline void
+sample_bilinear(uint8_t * dst, const image_t * src, float sx, float sy)
+{
+	int32_t c;
+
+	if (!(sx >= 0.0f && sy >= 0.0f &&
+		  sx < (float)(src->width - 1) && sy < (float)(src->height - 1))) {
+		for (c=0; c<src->channels; c++) {
+			dst[c] = 0;
+		}
+		return;
+	}
+
+	blend_bilinear(dst, src, (int32_t)(sx*256.0f), (int32_t)(sy*256.0f));
+}
+
+void
+remap_sample_row_c(uint8_t * dst, const image_t * src, const float * sxy, int32_t n)
+{
+	int32_t x;
+
+	for (x=0; x<n; x++) {
+		sample_bilinear(dst + x*src->channels, src, sxy[2*x+0], sxy[2*x+1]);
+	}
+}
+
+/**
+ * Convert source coordinates to the compact table format: the integer
+ * pixel as an int16 (x, y) pair and the 8-bit fractions packed as
+ * (fy << 8) | fx. This is the quantization the samplers apply anyway, so
+ * sampling the compact form gives the same output in 6 bytes per pixel
+ * instead of 8. Coordinates outside the source become (-1, -1); the
+ * source must be smaller than 32768 pixels each way.
+ */
+void
+remap_quantize_row(int16_t * ixy, uint16_t * frac, const float * sxy, int32_t n,
+				   int32_t src_w, int32_t src_h)
+{
+	int32_t x;
+
+	for (x=0; x<n; x++) {
+		float sx = sxy[2*x+0];
+		float sy = sxy[2*x+1];
+
+		if (sx >= 0.0f && sy >= 0.0f && sx < (float)(src_w - 1) && sy < (float)(src_h - 1)) {
+			int32_t xi = (int32_t)(sx*256.0f);
+			int32_t yi = (int32_t)(sy*256.0f);
+			ixy[2*x+0] = (int16_t)(xi >> 8);
+			ixy[2*x+1] = (int16_t)(yi >> 8);
+			frac[x] = (uint16_t)(((yi & 0xff) << 8) | (xi & 0xff));
+		}
+		else {
+			ixy[2*x+0] = -1;
+			ixy[2*x+1] = -1;
+			frac[x] = 0;
+		}
+	}
+}
+
+void
+remap_sample_row_fixed_c(uint8_t * dst, const image_t * src,
+						 const int16_t * ixy, const uint16_t * frac, int32_t n)
+{
+	const int32_t nc = src->channels;
+	int32_t x, c;
+
+	for (x=0; x<n; x++) {
+		if (ixy[2*x+0] < 0) {
+			for (c=0; c<nc; c++) {
+				dst[x*nc + c] = 0;
+			}
+			continue;
+		}
+		blend_bilinear(dst + x*nc, src, (ixy[2*x+0] << 8) | (frac[x] & 0xff),
+					   (ixy[2*x+1] << 8) | (frac[x] >> 8));
+	}
+}
+
+const char *
+remap_isa_name(remap_isa_t isa)
+{
+	const char * name = "auto";
+	switch (isa) {
+	case REMAP_ISA_AUTO:
+		name = "auto";
+		break;
+	case REMAP_ISA_SCALAR:
+		name = "scalar";
+		break;
+	case REMAP_ISA_SSE41:
+		name = "sse4.1";
+		break;
+	case REMAP_ISA_AVX2:
+		name = "avx2";
+		break;
+	}
+
+	return name;
+}
+
+/**
+ * Choose the row sampler. REMAP_ISA_AUTO picks the widest kernel the CPU
+ * supports; an explicit request falls back to the next narrower one when
+ * it is not available. Returns the kernel actually selected.
+ *
+ * This is called implicitly by the first remap; call it before starting
+ * worker threads to avoid racing on the selection.
+ */
+remap_isa_t
+remap_select_isa(remap_isa_t isa)
+{
+	remap_isa_t sel = REMAP_ISA_SCALAR;
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init( );
+	if ((isa == REMAP_ISA_AUTO || isa == REMAP_ISA_AVX2) &&
+		__builtin_cpu_supports("avx2")) {
+		sel = REMAP_ISA_AVX2;
+	}
+	else if (isa != REMAP_ISA_SCALAR && __builtin_cpu_supports("sse4.1")) {
+		sel = REMAP_ISA_SSE41;
+	}
+#endif
+
+	switch (sel) {
+	case REMAP_ISA_AVX2:
+		s_sample_row = remap_sample_row_avx2;
+		s_sample_row_fixed = remap_sample_row_fixed_avx2;
+		break;
+	case REMAP_ISA_SSE41:
+		s_sample_row = remap_sample_row_sse41;
+		s_sample_row_fixed = remap_sample_row_fixed_sse41;
+		break;
+	default:
+		s_sample_row = remap_sample_row_c;
+		s_sample_row_fixed = remap_sample_row_fixed_c;
+		break;
+	}
+
+	return sel;
+}
+
+void
+remap_sample_row(uint8_t * dst, const image_t * src, const float * sxy, int32_t n)
+{
+	if (s_sample_row == NULL) {
+		remap_select_isa(REMAP_ISA_AUTO);
+	}
+	s_sample_row(dst, src, sxy, n);
+}
+
+void
+remap_sample_row_fixed(uint8_t * dst, const image_t * src,
+					   const int16_t * ixy, const uint16_t * frac, int32_t n)
+{
+	if (s_sample_row_fixed == NULL) {
+		remap_select_isa(REMAP_ISA_AUTO);
+	}
+	s_sample_row_fixed(dst, src, ixy, frac, n);
+}
+
+int
+remap_image(image_t * dst, const image_t * src,
+			const lens_param_t * lens, const view_param_t * view)
+{
+	float * sxy;
+	int32_t y;
+
+	if (dst->channels != src->channels ||
+		dst->width != view->width || dst->height != view->height) {
+		fprintf(stderr, "remap_image: output image does not match the view\n");
+		return -1;
+	}
+
+	sxy = malloc(sizeof(float)*2*view->width);
+	if (sxy == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	for (y=0; y<view->height; y++) {
+		remap_project_row(sxy, lens, view, src->width, src->height, y);
+		remap_sample_row(dst->pixels + (size_t)y*dst->stride, src, sxy, view->width);
+	}
+
+	free(sxy);
+
+	return 0;
+}
+
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
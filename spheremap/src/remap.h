@@ -0,0 +1,79 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file remap.h
+ * @brief Headless fisheye to rectilinear remapping.
+ *
+ */
+
+#ifndef SPHERE_REMAP_H_
+#define SPHERE_REMAP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 8-bit interleaved image (1: gray, 3: RGB, 4: RGBA).
+ */
+typedef struct {
+	int32_t width;
+	int32_t height;
+	int32_t channels;
+	int32_t stride;
+	uint8_t * pixels;
+} image_t;
+
+typedef enum {
+	VIEW_RECTILINEAR = 0,
+	VIEW_EQUIRECT,
+	VIEW_HALF_EQUIRECT,
+} view_proj_t;
+
+/**
+ * Output camera. Angles are in degrees and follow the viewer in main.c:
+ * the camera looks down the -z axis, yaw rotates about y, pitch about x.
+ * fovY only applies to VIEW_RECTILINEAR; the equirectangular views span
+ * 360 (or 180) degrees of longitude and 180 degrees of latitude.
+ */
+typedef struct {
+	double yaw;
+	double pitch;
+	double fovY;
+	int32_t width;
+	int32_t height;
+	view_proj_t projection;
+} view_param_t;
+
+typedef enum {
+	REMAP_ISA_AUTO = 0,
+	REMAP_ISA_SCALAR,
+	REMAP_ISA_SSE41,
+	REMAP_ISA_AVX2,
+} remap_isa_t;
+
+extern int image_alloc(image_t * img, int32_t width, int32_t height, int32_t channels);
+extern void image_free(image_t * img);
+
+extern void remap_project_row(float * sxy, const lens_param_t * lens, const view_param_t * view,
+							  int32_t src_w, int32_t src_h, int32_t y);
+extern remap_isa_t remap_select_isa(remap_isa_t isa);
+extern const char * remap_isa_name(remap_isa_t isa);
+extern void remap_sample_row(uint8_t * dst, const image_t * src, const float * sxy, int32_t n);
+extern void remap_quantize_row(int16_t * ixy, uint16_t * frac, const float * sxy, int32_t n,
+							   int32_t src_w, int32_t src_h);
+extern void remap_sample_row_fixed(uint8_t * dst, const image_t * src,
+								   const int16_t * ixy, const uint16_t * frac, int32_t n);
+extern int remap_image(image_t * dst, const image_t * src,
+					   const lens_param_t * lens, const view_param_t * view);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_REMAP_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,253 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file remap_avx2.c
+ * @brief AVX2 row sampler, 8 output pixels per iteration.
+ *
+ * Built with -mavx2 and only entered after a runtime CPU check.
+ * Each lane fetches its two horizontal neighbours with one 64-bit gather;
+ * channels 0/2 and 1/3 are blended in pairs of 16-bit lanes, and unused
+ * channels of 1- to 3-channel images are dropped when storing.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "remap.h"
+#include "remap_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+static inline __m256i
+lerp_pairs(__m256i a, __m256i b, __m256i wa, __m256i wb)
+{
+	const __m256i round = _mm256_set1_epi32(0x00800080);
+	__m256i s = _mm256_add_epi16(_mm256_mullo_epi16(a, wa), _mm256_mullo_epi16(b, wb));
+	return _mm256_srli_epi16(_mm256_add_epi16(s, round), 8);
+}
+
+/**
+ * Fetch two horizontally adjacent pixels per lane with one 64-bit load
+ * and split them into a left and a right vector of 32-bit pixels.
+ */
+static inline void
+gather_pairs(__m256i * left, __m256i * right, const uint8_t * base, __m256i off, int32_t nc)
+{
+	const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	__m256i q0 = _mm256_i32gather_epi64((const long long *)base, _mm256_castsi256_si128(off), 1);
+	__m256i q1 = _mm256_i32gather_epi64((const long long *)base, _mm256_extracti128_si256(off, 1), 1);
+	__m256i l0 = _mm256_permutevar8x32_epi32(q0, even);
+	__m256i l1 = _mm256_permutevar8x32_epi32(q1, even);
+	__m256i r0 = _mm256_permutevar8x32_epi32(_mm256_srli_epi64(q0, 8*nc), even);
+	__m256i r1 = _mm256_permutevar8x32_epi32(_mm256_srli_epi64(q1, 8*nc), even);
+
+	*left  = _mm256_permute2x128_si256(l0, l1, 0x20);
+	*right = _mm256_permute2x128_si256(r0, r1, 0x20);
+}
+
+/**
+ * Blend and store eight pixels whose top-left neighbours sit at byte
+ * offsets off; lanes cleared in valid are written as 0.
+ */
+static inline void
+blend_store8(uint8_t * dst, const uint8_t * base, int32_t stride, int32_t nc,
+			 __m256i off, __m256i fx, __m256i fy, __m256i valid)
+{
+	const __m256i cmask = _mm256_set1_epi32(0x00ff00ff);
+	const __m256i w256 = _mm256_set1_epi32(0x01000100);
+	__m256i wx0, wx1, wy0, wy1;
+	__m256i p00, p01, p10, p11;
+	__m256i t, u, rb, ga, out;
+
+	gather_pairs(&p00, &p01, base, off, nc);
+	gather_pairs(&p10, &p11, base + stride, off, nc);
+
+	wx1 = _mm256_or_si256(fx, _mm256_slli_epi32(fx, 16));
+	wy1 = _mm256_or_si256(fy, _mm256_slli_epi32(fy, 16));
+	wx0 = _mm256_sub_epi16(w256, wx1);
+	wy0 = _mm256_sub_epi16(w256, wy1);
+
+	t = lerp_pairs(_mm256_and_si256(p00, cmask), _mm256_and_si256(p01, cmask), wx0, wx1);
+	u = lerp_pairs(_mm256_and_si256(p10, cmask), _mm256_and_si256(p11, cmask), wx0, wx1);
+	rb = lerp_pairs(t, u, wy0, wy1);
+
+	t = lerp_pairs(_mm256_and_si256(_mm256_srli_epi32(p00, 8), cmask),
+				   _mm256_and_si256(_mm256_srli_epi32(p01, 8), cmask), wx0, wx1);
+	u = lerp_pairs(_mm256_and_si256(_mm256_srli_epi32(p10, 8), cmask),
+				   _mm256_and_si256(_mm256_srli_epi32(p11, 8), cmask), wx0, wx1);
+	ga = lerp_pairs(t, u, wy0, wy1);
+
+	out = _mm256_and_si256(_mm256_or_si256(rb, _mm256_slli_epi16(ga, 8)), valid);
+
+	if (nc == 4) {
+		_mm256_storeu_si256((__m256i *)dst, out);
+	}
+	else if (nc == 3) {
+		const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+											  0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		uint8_t tmp[32];
+		_mm256_storeu_si256((__m256i *)tmp, _mm256_shuffle_epi8(out, pack));
+		memcpy(dst, tmp, 12);
+		memcpy(dst + 12, tmp + 16, 12);
+	}
+	else if (nc == 2) {
+		const __m256i pack = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+											  0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+		uint8_t tmp[32];
+		_mm256_storeu_si256((__m256i *)tmp, _mm256_shuffle_epi8(out, pack));
+		memcpy(dst, tmp, 8);
+		memcpy(dst + 8, tmp + 16, 8);
+	}
+	else {
+		const __m256i pack = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+											  0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+		uint8_t tmp[32];
+		_mm256_storeu_si256((__m256i *)tmp, _mm256_shuffle_epi8(out, pack));
+		memcpy(dst, tmp, 4);
+		memcpy(dst + 4, tmp + 16, 4);
+	}
+}
+
+/*
+ * a 64-bit fetch near the end of the image can read past the last pixel;
+ * only used when remap_offsets_fit(), so the limit fits in 32 bits
+ */
+static inline int32_t
+offset_limit(const image_t * src)
+{
+	return (int32_t)((size_t)(src->height - 1)*src->stride
+					 + (size_t)src->width*src->channels - 8 - src->stride);
+}
+
+void
+remap_sample_row_avx2(uint8_t * dst, const image_t * src, const float * sxy, int32_t n)
+{
+	const int32_t nc = src->channels;
+	const int32_t stride = src->stride;
+	const uint8_t * base = src->pixels;
+	const __m256 xmax = _mm256_set1_ps((float)(src->width - 1));
+	const __m256 ymax = _mm256_set1_ps((float)(src->height - 1));
+	const __m256 scale = _mm256_set1_ps(256.0f);
+	const __m256i vstride = _mm256_set1_epi32(stride);
+	const __m256i vnc = _mm256_set1_epi32(nc);
+	const __m256i fmask = _mm256_set1_epi32(0xff);
+	const __m256i olimit = _mm256_set1_epi32(offset_limit(src));
+	int32_t i = 0;
+
+	if (src->width < 2 || src->height < 2 || !remap_offsets_fit(src)) {
+		remap_sample_row_c(dst, src, sxy, n);
+		return;
+	}
+
+	for (; i+8<=n; i+=8) {
+		__m256 a = _mm256_loadu_ps(sxy + 2*i);
+		__m256 b = _mm256_loadu_ps(sxy + 2*i + 8);
+		__m256 xs = _mm256_castpd_ps(_mm256_permute4x64_pd(
+										 _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+										 _MM_SHUFFLE(3, 1, 2, 0)));
+		__m256 ys = _mm256_castpd_ps(_mm256_permute4x64_pd(
+										 _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))),
+										 _MM_SHUFFLE(3, 1, 2, 0)));
+		__m256 vmask = _mm256_and_ps(
+			_mm256_and_ps(_mm256_cmp_ps(xs, _mm256_setzero_ps( ), _CMP_GE_OQ),
+						  _mm256_cmp_ps(ys, _mm256_setzero_ps( ), _CMP_GE_OQ)),
+			_mm256_and_ps(_mm256_cmp_ps(xs, xmax, _CMP_LT_OQ),
+						  _mm256_cmp_ps(ys, ymax, _CMP_LT_OQ)));
+		__m256i valid = _mm256_castps_si256(vmask);
+		__m256i xi = _mm256_cvttps_epi32(_mm256_mul_ps(xs, scale));
+		__m256i yi = _mm256_cvttps_epi32(_mm256_mul_ps(ys, scale));
+		__m256i off = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(yi, 8), vstride),
+									   _mm256_mullo_epi32(_mm256_srai_epi32(xi, 8), vnc));
+
+		off = _mm256_and_si256(off, valid);
+		if (nc != 4 && !_mm256_testz_si256(_mm256_cmpgt_epi32(off, olimit), _mm256_set1_epi32(-1))) {
+			remap_sample_row_c(dst + i*nc, src, sxy + 2*i, 8);
+			continue;
+		}
+
+		blend_store8(dst + i*nc, base, stride, nc, off,
+					 _mm256_and_si256(xi, fmask), _mm256_and_si256(yi, fmask), valid);
+	}
+
+	/* blend_store8() is not always inlined, and GCC then loses track of
+	 * the dirty upper halves; leaving them set slows down later SSE code
+	 * such as libm */
+	_mm256_zeroupper( );
+
+	if (i < n) {
+		remap_sample_row_c(dst + i*nc, src, sxy + 2*i, n - i);
+	}
+}
+
+void
+remap_sample_row_fixed_avx2(uint8_t * dst, const image_t * src,
+							const int16_t * ixy, const uint16_t * frac, int32_t n)
+{
+	const int32_t nc = src->channels;
+	const int32_t stride = src->stride;
+	const uint8_t * base = src->pixels;
+	const __m256i vstride = _mm256_set1_epi32(stride);
+	const __m256i vnc = _mm256_set1_epi32(nc);
+	const __m256i fmask = _mm256_set1_epi32(0xff);
+	const __m256i olimit = _mm256_set1_epi32(offset_limit(src));
+	int32_t i = 0;
+
+	if (src->width < 2 || src->height < 2 || !remap_offsets_fit(src)) {
+		remap_sample_row_fixed_c(dst, src, ixy, frac, n);
+		return;
+	}
+
+	for (; i+8<=n; i+=8) {
+		__m256i xy = _mm256_loadu_si256((const __m256i *)(ixy + 2*i));
+		__m256i fr = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(frac + i)));
+		__m256i xs = _mm256_srai_epi32(_mm256_slli_epi32(xy, 16), 16);
+		__m256i ys = _mm256_srai_epi32(xy, 16);
+		__m256i valid = _mm256_cmpgt_epi32(xs, _mm256_set1_epi32(-1));
+		__m256i off = _mm256_add_epi32(_mm256_mullo_epi32(ys, vstride), _mm256_mullo_epi32(xs, vnc));
+
+		off = _mm256_and_si256(off, valid);
+		if (nc != 4 && !_mm256_testz_si256(_mm256_cmpgt_epi32(off, olimit), _mm256_set1_epi32(-1))) {
+			remap_sample_row_fixed_c(dst + i*nc, src, ixy + 2*i, frac + i, 8);
+			continue;
+		}
+
+		blend_store8(dst + i*nc, base, stride, nc, off,
+					 _mm256_and_si256(fr, fmask), _mm256_srli_epi32(fr, 8), valid);
+	}
+
+	_mm256_zeroupper( );
+
+	if (i < n) {
+		remap_sample_row_fixed_c(dst + i*nc, src, ixy + 2*i, frac + i, n - i);
+	}
+}
+
+#else
+
+void
+remap_sample_row_avx2(uint8_t * dst, const image_t * src, const float * sxy, int32_t n)
+{
+	remap_sample_row_c(dst, src, sxy, n);
+}
+
+void
+remap_sample_row_fixed_avx2(uint8_t * dst, const image_t * src,
+							const int16_t * ixy, const uint16_t * frac, int32_t n)
+{
+	remap_sample_row_fixed_c(dst, src, ixy, frac, n);
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,54 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file remap_kernel.h
+ * @brief Per-ISA row samplers behind remap_sample_row().
+ *
+ * All kernels implement the same fixed-point bilinear blend as the scalar
+ * one and must produce bit-identical output. The _fixed variants take
+ * coordinates already quantized by remap_quantize_row().
+ */
+
+#ifndef SPHERE_REMAP_KERNEL_H_
+#define SPHERE_REMAP_KERNEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The SIMD kernels address source pixels with 32-bit offsets; sources of
+ * 2 GiB and more are left to the scalar ones.
+ */
+static inline int
+remap_offsets_fit(const image_t * src)
+{
+	return (size_t)src->height*src->stride <= INT32_MAX;
+}
+
+typedef void (*remap_row_fn_t)(uint8_t * dst, const image_t * src, const float * sxy, int32_t n);
+
+extern void remap_sample_row_c(uint8_t * dst, const image_t * src, const float * sxy, int32_t n);
+extern void remap_sample_row_sse41(uint8_t * dst, const image_t * src, const float * sxy, int32_t n);
+extern void remap_sample_row_avx2(uint8_t * dst, const image_t * src, const float * sxy, int32_t n);
+
+typedef void (*remap_fixed_row_fn_t)(uint8_t * dst, const image_t * src,
+									 const int16_t * ixy, const uint16_t * frac, int32_t n);
+
+extern void remap_sample_row_fixed_c(uint8_t * dst, const image_t * src,
+									 const int16_t * ixy, const uint16_t * frac, int32_t n);
+extern void remap_sample_row_fixed_sse41(uint8_t * dst, const image_t * src,
+										 const int16_t * ixy, const uint16_t * frac, int32_t n);
+extern void remap_sample_row_fixed_avx2(uint8_t * dst, const image_t * src,
+										const int16_t * ixy, const uint16_t * frac, int32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_REMAP_KERNEL_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,221 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file remap_sse41.c
+ * @brief SSE4.1 row sampler, 4 output pixels per iteration.
+ *
+ * Same arithmetic as remap_avx2.c with the gathers done as scalar loads.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "remap.h"
+#include "remap_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <smmintrin.h>
+
+static inline __m128i
+lerp_pairs(__m128i a, __m128i b, __m128i wa, __m128i wb)
+{
+	const __m128i round = _mm_set1_epi32(0x00800080);
+	__m128i s = _mm_add_epi16(_mm_mullo_epi16(a, wa), _mm_mullo_epi16(b, wb));
+	return _mm_srli_epi16(_mm_add_epi16(s, round), 8);
+}
+
+static inline __m128i
+gather4(const uint8_t * base, const int32_t off[4])
+{
+	int32_t v[4];
+	memcpy(&v[0], base + off[0], 4);
+	memcpy(&v[1], base + off[1], 4);
+	memcpy(&v[2], base + off[2], 4);
+	memcpy(&v[3], base + off[3], 4);
+	return _mm_loadu_si128((const __m128i *)v);
+}
+
+/**
+ * Blend and store four pixels whose top-left neighbours sit at byte
+ * offsets off; lanes cleared in valid are written as 0.
+ */
+static inline void
+blend_store4(uint8_t * dst, const uint8_t * base, int32_t stride, int32_t nc,
+			 __m128i off, __m128i fx, __m128i fy, __m128i valid)
+{
+	const __m128i cmask = _mm_set1_epi32(0x00ff00ff);
+	const __m128i w256 = _mm_set1_epi32(0x01000100);
+	__m128i wx0, wx1, wy0, wy1;
+	__m128i p00, p01, p10, p11;
+	__m128i t, u, rb, ga, out;
+	int32_t offs[4];
+
+	_mm_storeu_si128((__m128i *)offs, off);
+	p00 = gather4(base, offs);
+	p01 = gather4(base + nc, offs);
+	p10 = gather4(base + stride, offs);
+	p11 = gather4(base + stride + nc, offs);
+
+	wx1 = _mm_or_si128(fx, _mm_slli_epi32(fx, 16));
+	wy1 = _mm_or_si128(fy, _mm_slli_epi32(fy, 16));
+	wx0 = _mm_sub_epi16(w256, wx1);
+	wy0 = _mm_sub_epi16(w256, wy1);
+
+	t = lerp_pairs(_mm_and_si128(p00, cmask), _mm_and_si128(p01, cmask), wx0, wx1);
+	u = lerp_pairs(_mm_and_si128(p10, cmask), _mm_and_si128(p11, cmask), wx0, wx1);
+	rb = lerp_pairs(t, u, wy0, wy1);
+
+	t = lerp_pairs(_mm_and_si128(_mm_srli_epi32(p00, 8), cmask),
+				   _mm_and_si128(_mm_srli_epi32(p01, 8), cmask), wx0, wx1);
+	u = lerp_pairs(_mm_and_si128(_mm_srli_epi32(p10, 8), cmask),
+				   _mm_and_si128(_mm_srli_epi32(p11, 8), cmask), wx0, wx1);
+	ga = lerp_pairs(t, u, wy0, wy1);
+
+	out = _mm_and_si128(_mm_or_si128(rb, _mm_slli_epi16(ga, 8)), valid);
+
+	if (nc == 4) {
+		_mm_storeu_si128((__m128i *)dst, out);
+	}
+	else {
+		static const int8_t packs[4][16] = {
+			{0},
+			{0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+			{0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1},
+			{0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1},
+		};
+		uint8_t tmp[16];
+		_mm_storeu_si128((__m128i *)tmp,
+						 _mm_shuffle_epi8(out, _mm_loadu_si128((const __m128i *)packs[nc])));
+		memcpy(dst, tmp, 4*nc);
+	}
+}
+
+/*
+ * a 32-bit fetch near the end of the image can read past the last pixel;
+ * only used when remap_offsets_fit(), so the limit fits in 32 bits
+ */
+static inline int32_t
+offset_limit(const image_t * src)
+{
+	return (int32_t)((size_t)(src->height - 1)*src->stride
+					 + (size_t)src->width*src->channels - 4 - src->stride - src->channels);
+}
+
+void
+remap_sample_row_sse41(uint8_t * dst, const image_t * src, const float * sxy, int32_t n)
+{
+	const int32_t nc = src->channels;
+	const int32_t stride = src->stride;
+	const uint8_t * base = src->pixels;
+	const __m128 xmax = _mm_set1_ps((float)(src->width - 1));
+	const __m128 ymax = _mm_set1_ps((float)(src->height - 1));
+	const __m128 scale = _mm_set1_ps(256.0f);
+	const __m128i vstride = _mm_set1_epi32(stride);
+	const __m128i vnc = _mm_set1_epi32(nc);
+	const __m128i fmask = _mm_set1_epi32(0xff);
+	const __m128i olimit = _mm_set1_epi32(offset_limit(src));
+	int32_t i = 0;
+
+	if (src->width < 2 || src->height < 2 || !remap_offsets_fit(src)) {
+		remap_sample_row_c(dst, src, sxy, n);
+		return;
+	}
+
+	for (; i+4<=n; i+=4) {
+		__m128 a = _mm_loadu_ps(sxy + 2*i);
+		__m128 b = _mm_loadu_ps(sxy + 2*i + 4);
+		__m128 xs = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 ys = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		__m128 vmask = _mm_and_ps(
+			_mm_and_ps(_mm_cmpge_ps(xs, _mm_setzero_ps( )), _mm_cmpge_ps(ys, _mm_setzero_ps( ))),
+			_mm_and_ps(_mm_cmplt_ps(xs, xmax), _mm_cmplt_ps(ys, ymax)));
+		__m128i valid = _mm_castps_si128(vmask);
+		__m128i xi = _mm_cvttps_epi32(_mm_mul_ps(xs, scale));
+		__m128i yi = _mm_cvttps_epi32(_mm_mul_ps(ys, scale));
+		__m128i off = _mm_add_epi32(_mm_mullo_epi32(_mm_srai_epi32(yi, 8), vstride),
+									_mm_mullo_epi32(_mm_srai_epi32(xi, 8), vnc));
+
+		off = _mm_and_si128(off, valid);
+		if (nc != 4 && !_mm_testz_si128(_mm_cmpgt_epi32(off, olimit), _mm_set1_epi32(-1))) {
+			remap_sample_row_c(dst + i*nc, src, sxy + 2*i, 4);
+			continue;
+		}
+
+		blend_store4(dst + i*nc, base, stride, nc, off,
+					 _mm_and_si128(xi, fmask), _mm_and_si128(yi, fmask), valid);
+	}
+
+	if (i < n) {
+		remap_sample_row_c(dst + i*nc, src, sxy + 2*i, n - i);
+	}
+}
+
+void
+remap_sample_row_fixed_sse41(uint8_t * dst, const image_t * src,
+							 const int16_t * ixy, const uint16_t * frac, int32_t n)
+{
+	const int32_t nc = src->channels;
+	const int32_t stride = src->stride;
+	const uint8_t * base = src->pixels;
+	const __m128i vstride = _mm_set1_epi32(stride);
+	const __m128i vnc = _mm_set1_epi32(nc);
+	const __m128i fmask = _mm_set1_epi32(0xff);
+	const __m128i olimit = _mm_set1_epi32(offset_limit(src));
+	int32_t i = 0;
+
+	if (src->width < 2 || src->height < 2 || !remap_offsets_fit(src)) {
+		remap_sample_row_fixed_c(dst, src, ixy, frac, n);
+		return;
+	}
+
+	for (; i+4<=n; i+=4) {
+		__m128i xy = _mm_loadu_si128((const __m128i *)(ixy + 2*i));
+		__m128i fr = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(frac + i)));
+		__m128i xs = _mm_srai_epi32(_mm_slli_epi32(xy, 16), 16);
+		__m128i ys = _mm_srai_epi32(xy, 16);
+		__m128i valid = _mm_cmpgt_epi32(xs, _mm_set1_epi32(-1));
+		__m128i off = _mm_add_epi32(_mm_mullo_epi32(ys, vstride), _mm_mullo_epi32(xs, vnc));
+
+		off = _mm_and_si128(off, valid);
+		if (nc != 4 && !_mm_testz_si128(_mm_cmpgt_epi32(off, olimit), _mm_set1_epi32(-1))) {
+			remap_sample_row_fixed_c(dst + i*nc, src, ixy + 2*i, frac + i, 4);
+			continue;
+		}
+
+		blend_store4(dst + i*nc, base, stride, nc, off,
+					 _mm_and_si128(fr, fmask), _mm_srli_epi32(fr, 8), valid);
+	}
+
+	if (i < n) {
+		remap_sample_row_fixed_c(dst + i*nc, src, ixy + 2*i, frac + i, n - i);
+	}
+}
+
+#else
+
+void
+remap_sample_row_sse41(uint8_t * dst, const image_t * src, const float * sxy, int32_t n)
+{
+	remap_sample_row_c(dst, src, sxy, n);
+}
+
+void
+remap_sample_row_fixed_sse41(uint8_t * dst, const image_t * src,
+							 const int16_t * ixy, const uint16_t * frac, int32_t n)
+{
+	remap_sample_row_fixed_c(dst, src, ixy, frac, n);
+}
+
+#endif
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
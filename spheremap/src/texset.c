@@ -0,0 +1,382 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file texset.c
+ * @brief Source image uploaded as one or more texture tiles.
+ *
+ * Tiles are uploaded straight from the decoded surface with the GL
+ * unpack row length and skips, so the image is held in memory once.
+ * Outside the image the tiles sample a black border, which lets the
+ * tiles of a large image be drawn in turn and added up. Without border
+ * clamping (before GL 1.3) each tile carries a one texel black margin
+ * instead.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <SDL.h>
+#include <SDL_image.h>
+#include <GL/gl.h>
+
+#include "common.h"
+#include "texset.h"
+#include "trace.h"
+
+#ifndef GL_BGR
+#define GL_BGR                   0x80E0
+#define GL_BGRA                  0x80E1
+#endif
+
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE         0x812F
+#endif
+
+#ifndef GL_CLAMP_TO_BORDER
+#define GL_CLAMP_TO_BORDER       0x812D
+#endif
+
+static int32_t
+peak_rss_kb( void )
+{
+#ifndef _WIN32
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		return (int32_t)ru.ru_maxrss;
+	}
+#endif
+	return -1;
+}
+
+static int32_t
+has_npot( void )
+{
+	const char_t * ver = (const char_t *)glGetString(GL_VERSION);
+	const char_t * ext = (const char_t *)glGetString(GL_EXTENSIONS);
+
+	if (ver != NULL && atoi(ver) >= 2) {
+		return 1;
+	}
+	return (ext != NULL && strstr(ext, "GL_ARB_texture_non_power_of_two") != NULL);
+}
+
+/**
+ * Wrap mode that samples black outside a tile, and the black margin in
+ * texels the tiles need for it: none with border clamping, else one so
+ * that even a clamp to the edge texel reads black.
+ */
+static GLint
+border_wrap(int32_t * margin)
+{
+	const char_t * ver = (const char_t *)glGetString(GL_VERSION);
+	const char_t * ext = (const char_t *)glGetString(GL_EXTENSIONS);
+	int32_t major = 1, minor = 0;
+
+	if (ver != NULL && sscanf(ver, "%d.%d", &major, &minor) != 2) {
+		major = 1;
+		minor = 0;
+	}
+
+	if (major > 1 || minor >= 3 ||
+		(ext != NULL && strstr(ext, "GL_ARB_texture_border_clamp") != NULL)) {
+		*margin = 0;
+		return GL_CLAMP_TO_BORDER;
+	}
+	*margin = 1;
+	if (minor >= 2 || (ext != NULL && strstr(ext, "GL_SGIS_texture_edge_clamp") != NULL)) {
+		return GL_CLAMP_TO_EDGE;
+	}
+	return GL_CLAMP;
+}
+
+static int32_t
+pot(int32_t n)
+{
+	int32_t p = 1;
+
+	while (p < n) {
+		p *= 2;
+	}
+	return p;
+}
+
+/**
+ * GL upload format of a decoded surface, or -1 if it has to be
+ * converted first (palettes, 16-bit pixels).
+ */
+static int
+surface_format(const SDL_PixelFormat * fmt, GLenum * format, GLint * internal)
+{
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+	const uint32_t lo = 0x000000ff;
+	const uint32_t hi24 = 0x00ff0000;
+#else
+	const uint32_t lo = 0x00ff0000;
+	const uint32_t hi24 = 0x000000ff;
+#endif
+
+	if (fmt->BytesPerPixel == 3) {
+		*internal = GL_RGB8;
+		if (fmt->Rmask == lo) {
+			*format = GL_RGB;
+			return 0;
+		}
+		if (fmt->Rmask == hi24) {
+			*format = GL_BGR;
+			return 0;
+		}
+	}
+	else if (fmt->BytesPerPixel == 4) {
+		*internal = fmt->Amask ? GL_RGBA8 : GL_RGB8;
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+		if (fmt->Rmask == 0x000000ff) {
+			*format = GL_RGBA;
+			return 0;
+		}
+		if (fmt->Rmask == 0x00ff0000) {
+			*format = GL_BGRA;
+			return 0;
+		}
+#else
+		if (fmt->Rmask == 0xff000000) {
+			*format = GL_RGBA;
+			return 0;
+		}
+		if (fmt->Rmask == 0x0000ff00) {
+			*format = GL_BGRA;
+			return 0;
+		}
+#endif
+	}
+
+	return -1;
+}
+
+/**
+ * Unpack row length and alignment that step through the surface rows.
+ * SDL pads the pitch of 24-bit surfaces to 4 bytes, which is not a
+ * whole number of pixels; GL gets there by rounding img->w pixels up to
+ * the alignment instead.
+ */
+static int
+unpack_layout(const SDL_Surface * img, GLint * row_length, GLint * align)
+{
+	const int32_t bpp = img->format->BytesPerPixel;
+	int32_t a;
+
+	if (img->pitch % bpp == 0) {
+		*row_length = img->pitch / bpp;
+		*align = 1;
+		return 0;
+	}
+	for (a=8; a>1; a/=2) {
+		if ((img->w*bpp + a - 1) / a * a == img->pitch) {
+			*row_length = img->w;
+			*align = a;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void
+upload_tile(texture_tile_t * t, const SDL_Surface * img, int32_t w, int32_t h,
+			GLenum format, GLint internal, GLint wrap, GLint row_length, GLint align,
+			const uint8_t * zero)
+{
+	static const GLfloat border[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+	glGenTextures(1, &t->tid);
+	glBindTexture(GL_TEXTURE_2D, t->tid);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+
+	/* zero is only needed to clear the margin and padding up to a power of two */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal, t->w, t->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, zero);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, align);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, t->x);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, t->y);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, t->margin, t->margin, w, h, format, GL_UNSIGNED_BYTE, img->pixels);
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+/**
+ * Decode an image and upload it in tiles of at most tile_limit pixels
+ * (0: the GL limit).
+ */
+int
+load_texture_set(texture_set_t * ts, const char_t * path, int32_t tile_limit)
+{
+	SDL_Surface * img;
+	GLenum format;
+	GLint internal;
+	GLint max_size = 0;
+	int32_t npot = has_npot( );
+	int32_t margin;
+	GLint wrap = border_wrap(&margin);
+	GLint row_length, align;
+	int32_t tile;
+	int32_t ntx, nty;
+	uint8_t * zero = NULL;
+	Uint32 t0 = SDL_GetTicks( );
+	Uint32 t1;
+
+	memset(ts, 0, sizeof(texture_set_t));
+
+	img = IMG_Load(path);
+	if (img == NULL) {
+		fprintf(stderr, "Failed to load texture: %s\n", path);
+		return -1;
+	}
+
+	if (surface_format(img->format, &format, &internal) < 0) {
+		SDL_Surface * rgb = SDL_CreateRGBSurface(SDL_SWSURFACE, 1, 1, 24,
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+												 0x000000ff, 0x0000ff00, 0x00ff0000,
+#else
+												 0x00ff0000, 0x0000ff00, 0x000000ff,
+#endif
+												 0x00000000);
+		SDL_Surface * conv = NULL;
+
+		if (rgb != NULL) {
+			conv = SDL_ConvertSurface(img, rgb->format, SDL_SWSURFACE);
+			SDL_FreeSurface(rgb);
+		}
+		SDL_FreeSurface(img);
+		if (conv == NULL) {
+			fprintf(stderr, "Failed to convert texture: %s\n", SDL_GetError( ));
+			return -1;
+		}
+		img = conv;
+		format = GL_RGB;
+		internal = GL_RGB8;
+	}
+	if (unpack_layout(img, &row_length, &align) < 0) {
+		fprintf(stderr, "Unsupported surface pitch %d for %d pixels: %s\n", img->pitch, img->w, path);
+		SDL_FreeSurface(img);
+		return -1;
+	}
+	t1 = SDL_GetTicks( );
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	/* the margins must fit in the texture too */
+	tile = max_size - 2*margin;
+	if (tile_limit > 0 && tile_limit < tile) {
+		tile = tile_limit;
+	}
+	ntx = (img->w + tile - 1) / tile;
+	nty = (img->h + tile - 1) / tile;
+
+	ts->width = img->w;
+	ts->height = img->h;
+	ts->tiles = calloc(ntx*nty, sizeof(texture_tile_t));
+	if (!npot || margin > 0) {
+		int32_t zw = (tile < img->w ? tile : img->w) + 2*margin;
+		int32_t zh = (tile < img->h ? tile : img->h) + 2*margin;
+		zero = calloc((size_t)(npot ? zw : pot(zw))*(npot ? zh : pot(zh)), 4);
+	}
+	if (ts->tiles == NULL || ((!npot || margin > 0) && zero == NULL)) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		free(ts->tiles);
+		free(zero);
+		ts->tiles = NULL;
+		SDL_FreeSurface(img);
+		return -1;
+	}
+
+	TRACE_BEGIN("texture upload");
+	SDL_LockSurface(img);
+	for (int32_t j=0; j<nty; j+=1) {
+		for (int32_t i=0; i<ntx; i+=1) {
+			texture_tile_t * t = &ts->tiles[ts->ntiles];
+			int32_t w, h;
+
+			t->x = i*tile;
+			t->y = j*tile;
+			w = (img->w - t->x < tile) ? img->w - t->x : tile;
+			h = (img->h - t->y < tile) ? img->h - t->y : tile;
+			t->margin = margin;
+			t->w = npot ? w + 2*margin : pot(w + 2*margin);
+			t->h = npot ? h + 2*margin : pot(h + 2*margin);
+
+			upload_tile(t, img, w, h, format, internal, wrap, row_length, align, zero);
+			ts->ntiles += 1;
+		}
+	}
+	SDL_UnlockSurface(img);
+	glFinish( );
+	TRACE_END( );
+
+	free(zero);
+	SDL_FreeSurface(img);
+
+	printf("texture: %dx%d in %d tile%s of up to %dx%d, decode %d ms, upload %d ms, peak RSS %d MB\n",
+		   ts->width, ts->height, ts->ntiles, ts->ntiles > 1 ? "s" : "", tile, tile,
+		   (int32_t)(t1 - t0), (int32_t)(SDL_GetTicks( ) - t1), peak_rss_kb( )/1024);
+
+	return 0;
+}
+
+void
+free_texture_set(texture_set_t * ts)
+{
+	for (int32_t i=0; i<ts->ntiles; i+=1) {
+		glDeleteTextures(1, &ts->tiles[i].tid);
+	}
+	free(ts->tiles);
+	ts->tiles = NULL;
+	ts->ntiles = 0;
+}
+
+/**
+ * Bind tile i, and map the mesh texture coordinates onto it: the
+ * image sits centred in the TEXSET_SPAN square.
+ */
+void
+texture_set_bind(const texture_set_t * ts, int32_t i)
+{
+	const texture_tile_t * t = &ts->tiles[i];
+	GLfloat ox = (GLfloat)((TEXSET_SPAN - ts->width)/2 + t->x - t->margin);
+	GLfloat oy = (GLfloat)((TEXSET_SPAN - ts->height)/2 + t->y - t->margin);
+
+	glBindTexture(GL_TEXTURE_2D, t->tid);
+
+	glMatrixMode(GL_TEXTURE);
+	glLoadIdentity( );
+	glScalef(1.0f/t->w, 1.0f/t->h, 1.0f);
+	glTranslatef(-ox, -oy, 0.0f);
+	glScalef((GLfloat)TEXSET_SPAN, (GLfloat)TEXSET_SPAN, 1.0f);
+	glMatrixMode(GL_MODELVIEW);
+}
+
+void
+texture_set_unbind( void )
+{
+	glMatrixMode(GL_TEXTURE);
+	glLoadIdentity( );
+	glMatrixMode(GL_MODELVIEW);
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,52 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file texset.h
+ * @brief Source image uploaded as one or more texture tiles.
+ *
+ */
+
+#ifndef SPHERE_TEXSET_H_
+#define SPHERE_TEXSET_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* side of the square the mesh texture coordinates span, in pixels */
+#define  TEXSET_SPAN  (2048)
+
+typedef struct {
+	GLuint tid;
+	int32_t x, y;		/* first image pixel */
+	int32_t w, h;		/* texture size */
+	int32_t margin;		/* black texels around the image */
+} texture_tile_t;
+
+/**
+ * Image tiles no larger than the GL texture size limit. The mesh maps
+ * into a TEXSET_SPAN square centred on the image; each tile's texture
+ * matrix maps that onto its part of the image.
+ */
+typedef struct {
+	int32_t width;
+	int32_t height;
+	int32_t ntiles;
+	texture_tile_t * tiles;
+} texture_set_t;
+
+extern int load_texture_set(texture_set_t * ts, const char_t * path, int32_t tile_limit);
+extern void free_texture_set(texture_set_t * ts);
+extern void texture_set_bind(const texture_set_t * ts, int32_t i);
+extern void texture_set_unbind(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_TEXSET_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -26,6 +26,10 @@ extern const uint8_t  _binary_resource_asciifont_tga_start[];
 extern const uint8_t  _binary_resource_asciifont_tga_end[];
 extern const uint32_t _binary_resource_asciifont_tga_size[];
 
+/* top-left corner of the 4x4 opaque texels in the font atlas */
+#define  FONT_SOLID_X  (508)
+#define  FONT_SOLID_Y  (508)
+
 GLuint
 load_font_image( void )
 {
@@ -41,6 +45,7 @@ load_font_image( void )
 		fnt_img = IMG_LoadTGA_RW(ops);
 
 		if (fnt_img != NULL) {
+			SDL_Rect solid = {FONT_SOLID_X, FONT_SOLID_Y, 4, 4};
 			SDL_Surface * tex_img = SDL_CreateRGBSurface(SDL_SWSURFACE, 512, 512, 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
 
 			SDL_SetAlpha(fnt_img, 0, 255);
@@ -49,6 +54,9 @@ load_font_image( void )
 
 			SDL_BlitSurface(fnt_img, NULL, tex_img, NULL);
 
+			/* solid white block for the background quad, clear of the glyphs */
+			SDL_FillRect(tex_img, &solid, 0xffffffff);
+
 			glBindTexture(GL_TEXTURE_2D, tex_num);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -69,83 +77,152 @@ load_font_image( void )
 	return tex_num;
 }
 
-static void
-draw_char(GLfloat x, GLfloat y, int c)
+#define  GLYPH_W      (11.0f)
+#define  GLYPH_H      (24.0f)
+#define  GLYPH_PITCH  (12.0f)
+#define  LINE_PITCH   (26.0f)
+
+int
+init_textwindow(textwin_t * tw)
 {
-	const GLfloat ts = 1.0/512.0;
-	const GLfloat tw = 11.0f;
-	const GLfloat th = 24.0f;
-	GLfloat tx0 = 10.0;
-	GLfloat ty0 = 0.0;
-
-	if (c >= 0x20 && c <= 0x7e) {
-		GLfloat txoff = (GLfloat)(c & 0x0f)*tw*2;
-		GLfloat tyoff = (GLfloat)(((c & 0x70) >> 4)-2)*th;
-		tx0 += txoff;
-		ty0 += tyoff;
+	memset(tw, 0, sizeof(textwin_t));
+
+	tw->vertices = malloc(sizeof(textwin_vertex_t)*4*(1 + TEXTWIN_LINES*TEXTWIN_COLS));
+	if (tw->vertices == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
 	}
+	tw->nlines = TEXTWIN_LENS_LINES;
+	tw->dirty = 1;
 
-	glBegin(GL_TRIANGLE_STRIP);
-	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+	return 0;
+}
 
-	glTexCoord2f(tx0*ts, ty0*ts);
-	glVertex3f(x, y, -2.0f);
-	glTexCoord2f(tx0*ts, (ty0+th)*ts);
-	glVertex3f(x, y-th, -2.0f);
-	glTexCoord2f((tx0+tw)*ts, ty0*ts);
-	glVertex3f(x+tw, y, -2.0f);
-	glTexCoord2f((tx0+tw)*ts, (ty0+th)*ts);
-	glVertex3f(x+tw, y-th, -2.0f);
+void
+free_textwindow(textwin_t * tw)
+{
+	free(tw->vertices);
+	tw->vertices = NULL;
+}
 
-	glEnd( );
+/**
+ * Set one line of the overlay. Lines below TEXTWIN_LENS_LINES are
+ * overwritten by draw_textwindow().
+ */
+void
+textwindow_line(textwin_t * tw, int32_t line, const char_t * fmt, ...)
+{
+	char_t buf[TEXTWIN_COLS];
+	va_list ap;
+
+	if (line < 0 || line >= TEXTWIN_LINES) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(buf, TEXTWIN_COLS, fmt, ap);
+	va_end(ap);
+
+	if (line >= tw->nlines) {
+		for (int32_t i=tw->nlines; i<line; i+=1) {
+			tw->lines[i][0] = 0;
+		}
+		tw->nlines = line + 1;
+		tw->dirty = 1;
+	}
+	if (strcmp(tw->lines[line], buf) != 0) {
+		strcpy(tw->lines[line], buf);
+		tw->dirty = 1;
+	}
 }
 
-static int
-draw_string(GLfloat x, GLfloat y, const char * str)
+static textwin_vertex_t *
+put_quad(textwin_vertex_t * v, GLfloat x, GLfloat y, GLfloat w, GLfloat h, GLfloat z,
+		 GLfloat u, GLfloat t, GLfloat du, GLfloat dt, uint32_t rgba)
 {
-	for (int32_t i=0; str[i] != 0; i+=1) {
-		draw_char(x + ((GLfloat)i)*12.0f, y, str[i]);
+	v[0] = (textwin_vertex_t){x  , y  , z, u   , t   };
+	v[1] = (textwin_vertex_t){x  , y-h, z, u   , t+dt};
+	v[2] = (textwin_vertex_t){x+w, y-h, z, u+du, t+dt};
+	v[3] = (textwin_vertex_t){x+w, y  , z, u+du, t   };
+	for (int32_t k=0; k<4; k+=1) {
+		v[k].rgba[0] = (uint8_t)(rgba >> 24);
+		v[k].rgba[1] = (uint8_t)(rgba >> 16);
+		v[k].rgba[2] = (uint8_t)(rgba >>  8);
+		v[k].rgba[3] = (uint8_t)rgba;
 	}
-	return 0;
+
+	return v + 4;
 }
 
-static const char *
-projection_type_name(lens_type_t t)
+static void
+build_textwindow(textwin_t * tw, GLfloat width, GLfloat height)
 {
-	const char * name = "unknown";
-	switch (t) {
-	case LENS_STEREOGRAPHIC:
-		name = "Stereographic";
-		break;
-	case LENS_EQUIDISTANT:
-		name = "Equidistant";
-		break;
-	case LENS_EQUISOLID:
-		name = "Equisolid";
-		break;
-	case LENS_ORTHOGONAL:
-		name = "Orthogonal";
-		break;
-	case LENS_MADOKA:
-		name = "MADOKA";
-		break;
+	const GLfloat ts = 1.0/512.0;
+	const GLfloat x_left  = -width *0.5f +  10.0f;
+	const GLfloat x_right =  width *0.5f -  10.0f;
+	const GLfloat y_bottom= -height*0.5f +  10.0f;
+	const GLfloat y_top   = y_bottom + LINE_PITCH*tw->nlines + 22.0f;
+	const GLfloat ox = x_left + 10.0f;
+	const GLfloat oy = y_top  -  5.0f;
+	textwin_vertex_t * v = tw->vertices;
+
+	/* background: one solid atlas texel, translucent black */
+	v = put_quad(v, x_left, y_top, x_right-x_left, y_top-y_bottom, -5.0f,
+				 (FONT_SOLID_X + 2)*ts, (FONT_SOLID_Y + 2)*ts, 0.0f, 0.0f, 0x000000bf);
+
+	for (int32_t j=0; j<tw->nlines; j+=1) {
+		const char_t * str = tw->lines[j];
+
+		for (int32_t i=0; str[i] != 0; i+=1) {
+			int c = (uint8_t)str[i];
+			GLfloat tx0 = 10.0f;
+			GLfloat ty0 = 0.0f;
+
+			if (c <= 0x20 || c > 0x7e) {
+				continue;		/* blank */
+			}
+			tx0 += (GLfloat)(c & 0x0f)*GLYPH_W*2;
+			ty0 += (GLfloat)(((c & 0x70) >> 4)-2)*GLYPH_H;
+			v = put_quad(v, ox + (GLfloat)i*GLYPH_PITCH, oy - (GLfloat)j*LINE_PITCH,
+						 GLYPH_W, GLYPH_H, -2.0f,
+						 tx0*ts, ty0*ts, GLYPH_W*ts, GLYPH_H*ts, 0xffffffff);
+		}
+	}
+
+	tw->nvertices = v - tw->vertices;
+	tw->dirty = 0;
+	tw->rebuilds += 1;
+}
+
+static void
+set_lens_lines(textwin_t * tw, const lens_param_t * lens)
+{
+	if (tw->lens_valid && tw->lens.type == lens->type && tw->lens.r == lens->r &&
+		tw->lens.center.x == lens->center.x && tw->lens.center.y == lens->center.y) {
+		return;
 	}
+	tw->lens = *lens;
+	tw->lens_valid = 1;
 
-	return name;
+	textwindow_line(tw, 0, "Projection: %s", lens_type_name(lens->type));
+	textwindow_line(tw, 1, "Center: % 6.1f, % 6.1f", lens->center.x, lens->center.y);
+	textwindow_line(tw, 2, "Radius: %6.1f", lens->r);
 }
 
+/**
+ * Draw the overlay, background and glyphs, in one call.
+ */
 int
-draw_textwindow(GLuint tid, const lens_param_t * lens)
+draw_textwindow(textwin_t * tw, GLuint tid, const lens_param_t * lens)
 {
 	const GLdouble width  = (GLdouble)800;
 	const GLdouble height = (GLdouble)600;
+	const textwin_vertex_t * v = tw->vertices;
 
-	const GLfloat x_left  = (GLfloat)-width *0.5 +  10.0;
-	const GLfloat x_right = (GLfloat) width *0.5 -  10.0;
-	const GLfloat y_top   = (GLfloat)-height*0.5 + 110.0;
-	const GLfloat y_bottom= (GLfloat)-height*0.5 +  10.0;
-	const GLfloat ox = x_left + 10.0;
-	const GLfloat oy = y_top  -  5.0;
+	set_lens_lines(tw, lens);
+	if (tw->dirty) {
+		build_textwindow(tw, width, height);
+	}
 
 	glMatrixMode(GL_PROJECTION);
 	glPushMatrix( );
@@ -155,34 +232,23 @@ draw_textwindow(GLuint tid, const lens_param_t * lens)
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity( );
 
-	glDisableClientState(GL_VERTEX_ARRAY);
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	glDisable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	glBegin(GL_TRIANGLE_STRIP);
-	glColor4f(0.0f, 0.0f, 0.0f, 0.75f);
-	glVertex3f(x_left , y_top   , -5.0f);
-	glVertex3f(x_left , y_bottom, -5.0f);
-	glVertex3f(x_right, y_top   , -5.0f);
-	glVertex3f(x_right, y_bottom, -5.0f);
-	glEnd( );
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(textwin_vertex_t), &v->x);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(textwin_vertex_t), &v->u);
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(textwin_vertex_t), v->rgba);
 
 	glEnable(GL_TEXTURE_2D);
 	glBindTexture(GL_TEXTURE_2D, tid);
-	{
-		char_t buf[128];
-		snprintf(buf, 128, "Projection: %s\n", projection_type_name(lens->type));
-		buf[127] = 0;
-		draw_string(ox, oy, buf);
-		snprintf(buf, 128, "Center: % 6.1f, % 6.1f", lens->center.x, lens->center.y);
-		buf[127] = 0;
-		draw_string(ox, oy-26.0f, buf);
-		snprintf(buf, 128, "Radius: %6.1f", lens->r);
-		buf[127] = 0;
-		draw_string(ox, oy-26*2.0f, buf);
-	}
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArrays(GL_QUADS, 0, tw->nvertices);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
 
 	glMatrixMode(GL_PROJECTION);
 	glPopMatrix( );
@@ -191,7 +257,6 @@ draw_textwindow(GLuint tid, const lens_param_t * lens)
 	return 0;
 }
 
-
 /*
  * Local Variables:
  * indent-tabs-mode: t
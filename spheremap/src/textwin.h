@@ -13,8 +13,38 @@
 extern "C" {
 #endif
 
+#define  TEXTWIN_LINES  (16)
+#define  TEXTWIN_COLS   (64)
+
+typedef struct {
+	float x, y, z;
+	float u, v;
+	uint8_t rgba[4];
+} textwin_vertex_t;
+
+/**
+ * Text overlay: the lens parameters followed by free diagnostic lines.
+ * Glyph quads are rebuilt only when a line's text changes.
+ */
+typedef struct {
+	int32_t nlines;
+	char_t lines[TEXTWIN_LINES][TEXTWIN_COLS];
+	int32_t lens_valid;
+	lens_param_t lens;			/* as shown in the first lines */
+	int32_t dirty;
+	int32_t nvertices;			/* background quad, then glyphs */
+	textwin_vertex_t * vertices;
+	int32_t rebuilds;
+} textwin_t;
+
+/* lines taken by the lens parameters */
+#define  TEXTWIN_LENS_LINES  (3)
+
 extern GLuint load_font_image( void );
-extern int draw_textwindow(GLuint tid, const lens_param_t * lens);
+extern int init_textwindow(textwin_t * tw);
+extern void free_textwindow(textwin_t * tw);
+extern void textwindow_line(textwin_t * tw, int32_t line, const char_t * fmt, ...);
+extern int draw_textwindow(textwin_t * tw, GLuint tid, const lens_param_t * lens);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,317 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file tilesrc.c
+ * @brief Source images read in tiles on demand through a bounded cache.
+ *
+ * The raster of a binary PNM file is read straight from disk one tile
+ * at a time, so images larger than memory can be remapped. Tiles live
+ * in a fixed number of slots sized from the memory cap; when they are
+ * all taken, the least recently used tile nobody holds is evicted.
+ * Reads happen outside the cache lock; a thread asking for a tile that
+ * is still being read waits for it instead of reading it again.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "vector.h"
+#include "lens.h"
+#include "remap.h"
+#include "pnm.h"
+#include "tilesrc.h"
+
+typedef struct {
+	int32_t tile;		/* cached tile, -1 if free */
+	int32_t pins;
+	int32_t loading;
+	uint64_t used;		/* LRU stamp */
+	image_t img;
+} tile_slot_t;
+
+struct tile_source {
+	FILE * fp;
+	int64_t data_offset;
+	int32_t width;
+	int32_t height;
+	int32_t channels;
+	int32_t tiles_x;
+	int32_t tiles_y;
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	int32_t nslots;
+	tile_slot_t * slots;
+	int32_t * slot_of;	/* per tile, -1 if not cached */
+	uint64_t clock;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t bytes_read;
+};
+
+/**
+ * Open a PNM file for tiled reading with at most mem_cap bytes of
+ * cached tiles (at least one tile is always kept).
+ */
+tile_source_t *
+tile_source_open(const char_t * path, size_t mem_cap)
+{
+	tile_source_t * ts;
+	size_t slot_bytes;
+	int32_t i;
+
+	ts = calloc(1, sizeof(tile_source_t));
+	if (ts == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return NULL;
+	}
+	pthread_mutex_init(&ts->lock, NULL);
+	pthread_cond_init(&ts->changed, NULL);
+
+	ts->fp = fopen(path, "rb");
+	if (ts->fp == NULL) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		tile_source_close(ts);
+		return NULL;
+	}
+	if (pnm_read_header(ts->fp, &ts->width, &ts->height, &ts->channels) < 0) {
+		tile_source_close(ts);
+		return NULL;
+	}
+	ts->data_offset = (int64_t)ftello(ts->fp);
+	ts->tiles_x = (ts->width + TILE_SRC_SIZE - 1) >> TILE_SRC_SHIFT;
+	ts->tiles_y = (ts->height + TILE_SRC_SIZE - 1) >> TILE_SRC_SHIFT;
+
+	slot_bytes = (size_t)(TILE_SRC_SIZE + 1)*(TILE_SRC_SIZE + 1)*ts->channels;
+	ts->nslots = (int32_t)(mem_cap / slot_bytes);
+	if (ts->nslots < 1) {
+		ts->nslots = 1;
+	}
+	if (ts->nslots > ts->tiles_x*ts->tiles_y) {
+		ts->nslots = ts->tiles_x*ts->tiles_y;
+	}
+
+	ts->slots = calloc(ts->nslots, sizeof(tile_slot_t));
+	ts->slot_of = malloc(sizeof(int32_t)*ts->tiles_x*ts->tiles_y);
+	if (ts->slots == NULL || ts->slot_of == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		tile_source_close(ts);
+		return NULL;
+	}
+	for (i=0; i<ts->tiles_x*ts->tiles_y; i++) {
+		ts->slot_of[i] = -1;
+	}
+	for (i=0; i<ts->nslots; i++) {
+		ts->slots[i].tile = -1;
+		if (image_alloc(&ts->slots[i].img, TILE_SRC_SIZE + 1, TILE_SRC_SIZE + 1, ts->channels) < 0) {
+			tile_source_close(ts);
+			return NULL;
+		}
+	}
+
+	return ts;
+}
+
+void
+tile_source_close(tile_source_t * ts)
+{
+	int32_t i;
+
+	if (ts == NULL) {
+		return;
+	}
+	if (ts->slots != NULL) {
+		for (i=0; i<ts->nslots; i++) {
+			image_free(&ts->slots[i].img);
+		}
+	}
+	free(ts->slots);
+	free(ts->slot_of);
+	if (ts->fp != NULL) {
+		fclose(ts->fp);
+	}
+	pthread_mutex_destroy(&ts->lock);
+	pthread_cond_destroy(&ts->changed);
+	free(ts);
+}
+
+void
+tile_source_get_info(tile_source_t * ts, tile_source_info_t * info)
+{
+	pthread_mutex_lock(&ts->lock);
+	info->width = ts->width;
+	info->height = ts->height;
+	info->channels = ts->channels;
+	info->tiles_x = ts->tiles_x;
+	info->tiles_y = ts->tiles_y;
+	info->slots = ts->nslots;
+	info->hits = ts->hits;
+	info->misses = ts->misses;
+	info->evictions = ts->evictions;
+	info->bytes_read = ts->bytes_read;
+	pthread_mutex_unlock(&ts->lock);
+}
+
+static int
+read_at(tile_source_t * ts, void * buf, size_t len, int64_t offset)
+{
+#ifndef _WIN32
+	uint8_t * p = buf;
+
+	while (len > 0) {
+		ssize_t n = pread(fileno(ts->fp), p, len, (off_t)offset);
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+		offset += n;
+	}
+	return 0;
+#else
+	/* no pread: share the stream under a lock of its own */
+	static pthread_mutex_t s_io_lock = PTHREAD_MUTEX_INITIALIZER;
+	int rc = 0;
+
+	pthread_mutex_lock(&s_io_lock);
+	if (fseeko(ts->fp, (off_t)offset, SEEK_SET) != 0 || fread(buf, 1, len, ts->fp) != len) {
+		rc = -1;
+	}
+	pthread_mutex_unlock(&s_io_lock);
+	return rc;
+#endif
+}
+
+/* Fill img with tile t and the row and column after it, if any */
+static int
+read_tile(tile_source_t * ts, image_t * img, int32_t t)
+{
+	int32_t x0 = (t % ts->tiles_x) << TILE_SRC_SHIFT;
+	int32_t y0 = (t / ts->tiles_x) << TILE_SRC_SHIFT;
+	int32_t w = (ts->width - x0 < TILE_SRC_SIZE + 1) ? ts->width - x0 : TILE_SRC_SIZE + 1;
+	int32_t h = (ts->height - y0 < TILE_SRC_SIZE + 1) ? ts->height - y0 : TILE_SRC_SIZE + 1;
+	size_t row = (size_t)ts->width*ts->channels;
+	int32_t y;
+
+	img->width = w;
+	img->height = h;
+	for (y=0; y<h; y++) {
+		int64_t offset = ts->data_offset + (int64_t)(y0 + y)*row + (int64_t)x0*ts->channels;
+		if (read_at(ts, img->pixels + (size_t)y*img->stride, (size_t)w*ts->channels, offset) < 0) {
+			fprintf(stderr, "Unexpected end of image data\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Least recently used slot that nobody holds, or -1 */
+static int32_t
+find_victim(const tile_source_t * ts)
+{
+	int32_t best = -1;
+	int32_t i;
+
+	for (i=0; i<ts->nslots; i++) {
+		const tile_slot_t * s = &ts->slots[i];
+		if (s->pins == 0 && !s->loading && (best < 0 || s->used < ts->slots[best].used)) {
+			best = i;
+			if (s->tile < 0) {
+				break;
+			}
+		}
+	}
+
+	return best;
+}
+
+/**
+ * Tile (tx, ty), read on a miss. It stays valid until the matching
+ * tile_source_release(). Returns NULL if it cannot be read.
+ */
+const image_t *
+tile_source_acquire(tile_source_t * ts, int32_t tx, int32_t ty)
+{
+	int32_t t = ty*ts->tiles_x + tx;
+	tile_slot_t * s;
+	int32_t i;
+
+	pthread_mutex_lock(&ts->lock);
+	for (;;) {
+		i = ts->slot_of[t];
+		if (i >= 0) {
+			s = &ts->slots[i];
+			if (!s->loading) {
+				s->pins++;
+				s->used = ++ts->clock;
+				ts->hits++;
+				pthread_mutex_unlock(&ts->lock);
+				return &s->img;
+			}
+		}
+		else if ((i = find_victim(ts)) >= 0) {
+			break;
+		}
+		pthread_cond_wait(&ts->changed, &ts->lock);
+	}
+
+	s = &ts->slots[i];
+	if (s->tile >= 0) {
+		ts->slot_of[s->tile] = -1;
+		ts->evictions++;
+	}
+	s->tile = t;
+	s->loading = 1;
+	s->pins = 1;
+	ts->slot_of[t] = i;
+	ts->misses++;
+	pthread_mutex_unlock(&ts->lock);
+
+	if (read_tile(ts, &s->img, t) < 0) {
+		pthread_mutex_lock(&ts->lock);
+		ts->slot_of[t] = -1;
+		s->tile = -1;
+		s->loading = 0;
+		s->pins = 0;
+		pthread_cond_broadcast(&ts->changed);
+		pthread_mutex_unlock(&ts->lock);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&ts->lock);
+	s->loading = 0;
+	s->used = ++ts->clock;
+	ts->bytes_read += (uint64_t)s->img.width*s->img.height*ts->channels;
+	pthread_cond_broadcast(&ts->changed);
+	pthread_mutex_unlock(&ts->lock);
+
+	return &s->img;
+}
+
+void
+tile_source_release(tile_source_t * ts, int32_t tx, int32_t ty)
+{
+	int32_t i;
+
+	pthread_mutex_lock(&ts->lock);
+	i = ts->slot_of[ty*ts->tiles_x + tx];
+	if (i >= 0 && --ts->slots[i].pins == 0) {
+		pthread_cond_broadcast(&ts->changed);
+	}
+	pthread_mutex_unlock(&ts->lock);
+}
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
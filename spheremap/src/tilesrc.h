@@ -0,0 +1,54 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file tilesrc.h
+ * @brief Source images read in tiles on demand through a bounded cache.
+ *
+ */
+
+#ifndef SPHERE_TILESRC_H_
+#define SPHERE_TILESRC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Tile side in pixels (a power of two). Each cached tile also holds
+ * the next row and column, so a bilinear sample whose top-left pixel
+ * is in a tile never needs its neighbours.
+ */
+#define  TILE_SRC_SHIFT  (8)
+#define  TILE_SRC_SIZE   (1 << TILE_SRC_SHIFT)
+
+typedef struct tile_source tile_source_t;
+
+typedef struct {
+	int32_t width;
+	int32_t height;
+	int32_t channels;
+	int32_t tiles_x;
+	int32_t tiles_y;
+	int32_t slots;			/* tiles the cache holds at most */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t bytes_read;
+} tile_source_info_t;
+
+extern tile_source_t * tile_source_open(const char_t * path, size_t mem_cap);
+extern void tile_source_close(tile_source_t * ts);
+extern void tile_source_get_info(tile_source_t * ts, tile_source_info_t * info);
+extern const image_t * tile_source_acquire(tile_source_t * ts, int32_t tx, int32_t ty);
+extern void tile_source_release(tile_source_t * ts, int32_t tx, int32_t ty);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_TILESRC_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
@@ -0,0 +1,195 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file trace.c
+ * @brief Scoped timers dumped as a Chrome/Perfetto trace.
+ *
+ * Each thread records into its own ring buffer, so a timer costs two
+ * clock reads and a few stores with no locking; the rings are linked
+ * into a list once, on a thread's first event. The oldest events are
+ * overwritten when a ring wraps.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "trace.h"
+
+#ifdef SPHERE_TRACE
+
+#define  TRACE_RING_SIZE    (1 << 16)
+#define  TRACE_STACK_DEPTH  (32)
+
+typedef struct {
+	const char_t * name;
+	uint64_t t0;		/* ns */
+	uint64_t dur;
+} trace_event_t;
+
+typedef struct trace_ring {
+	struct trace_ring * next;
+	const char_t * thread_name;
+	int32_t tid;
+	int32_t depth;
+	uint64_t head;		/* events written so far */
+	const char_t * stack_name[TRACE_STACK_DEPTH];
+	uint64_t stack_t0[TRACE_STACK_DEPTH];
+	trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static __thread trace_ring_t * s_ring;
+static trace_ring_t * s_rings;
+static int32_t s_ntids;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+static trace_ring_t *
+get_ring(void)
+{
+	trace_ring_t * r = s_ring;
+
+	if (r == NULL) {
+		r = calloc(1, sizeof(trace_ring_t));
+		if (r == NULL) {
+			return NULL;
+		}
+		r->tid = __atomic_add_fetch(&s_ntids, 1, __ATOMIC_RELAXED);
+		r->next = __atomic_load_n(&s_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&s_rings, &r->next, r, 1,
+											__ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			/* r->next reloaded */
+		}
+		s_ring = r;
+	}
+
+	return r;
+}
+
+void
+trace_begin(const char_t * name)
+{
+	trace_ring_t * r = get_ring( );
+
+	if (r == NULL) {
+		return;
+	}
+	if (r->depth < TRACE_STACK_DEPTH) {
+		r->stack_name[r->depth] = name;
+		r->stack_t0[r->depth] = now_ns( );
+	}
+	r->depth++;
+}
+
+void
+trace_end(void)
+{
+	trace_ring_t * r = s_ring;
+	uint64_t t1 = now_ns( );
+
+	if (r == NULL || r->depth == 0) {
+		return;
+	}
+	r->depth--;
+	if (r->depth < TRACE_STACK_DEPTH) {
+		uint64_t h = r->head;
+		trace_event_t * ev = &r->events[h & (TRACE_RING_SIZE-1)];
+
+		ev->name = r->stack_name[r->depth];
+		ev->t0 = r->stack_t0[r->depth];
+		ev->dur = t1 - ev->t0;
+		__atomic_store_n(&r->head, h+1, __ATOMIC_RELEASE);
+	}
+}
+
+void
+trace_thread_name(const char_t * name)
+{
+	trace_ring_t * r = get_ring( );
+
+	if (r != NULL) {
+		r->thread_name = name;
+	}
+}
+
+/**
+ * Write every ring as complete ("X") events. Rings keep being written
+ * meanwhile: events are copied out first, and the ones the writer may
+ * have lapped during the copy are dropped.
+ */
+int
+trace_dump(const char_t * path)
+{
+	trace_ring_t * r;
+	trace_event_t * copy;
+	FILE * fp;
+	int32_t nevents = 0;
+	const char_t * sep = "";
+
+	copy = malloc(sizeof(trace_event_t)*TRACE_RING_SIZE);
+	if (copy == NULL) {
+		fprintf(stderr, "Failed to allocate memory...\n");
+		return -1;
+	}
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		free(copy);
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (r=__atomic_load_n(&s_rings, __ATOMIC_ACQUIRE); r!=NULL; r=r->next) {
+		uint64_t h0 = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t first = (h0 > TRACE_RING_SIZE) ? h0 - TRACE_RING_SIZE : 0;
+		uint64_t h1;
+		uint64_t i;
+
+		for (i=first; i<h0; i++) {
+			copy[i & (TRACE_RING_SIZE-1)] = r->events[i & (TRACE_RING_SIZE-1)];
+		}
+		h1 = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (h1 > first + TRACE_RING_SIZE) {
+			first = h1 - TRACE_RING_SIZE;
+		}
+
+		if (r->thread_name != NULL) {
+			fprintf(fp, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+					"\"args\": {\"name\": \"%s\"}}", sep, r->tid, r->thread_name);
+			sep = ",";
+		}
+		for (i=first; i<h0; i++) {
+			const trace_event_t * ev = &copy[i & (TRACE_RING_SIZE-1)];
+
+			fprintf(fp, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+					"\"ts\": %.3f, \"dur\": %.3f}",
+					sep, ev->name, r->tid, ev->t0*1e-3, ev->dur*1e-3);
+			sep = ",";
+			nevents++;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	free(copy);
+
+	printf("trace: %d events to %s\n", nevents, path);
+
+	return 0;
+}
+
+#endif /* SPHERE_TRACE */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */
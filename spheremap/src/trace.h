@@ -0,0 +1,52 @@
+/* -*- mode: c; coding: utf-8-unix -*- */
+/**
+ * @file trace.h
+ * @brief Scoped timers dumped as a Chrome/Perfetto trace.
+ *
+ * Built in with -DSPHERE_TRACE (make TRACE=1); otherwise every macro
+ * expands to nothing. Names must be string literals, and each
+ * TRACE_BEGIN() is closed by a TRACE_END() on the same thread.
+ */
+
+#ifndef SPHERE_TRACE_H_
+#define SPHERE_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* default output of the viewer's trace dump */
+#define  TRACE_FILE  "sphere-trace.json"
+
+#ifdef SPHERE_TRACE
+
+#define  TRACE_BEGIN(name)        trace_begin(name)
+#define  TRACE_END()              trace_end( )
+#define  TRACE_THREAD_NAME(name)  trace_thread_name(name)
+#define  TRACE_DUMP(path)         trace_dump(path)
+
+extern void trace_begin(const char_t * name);
+extern void trace_end(void);
+extern void trace_thread_name(const char_t * name);
+extern int trace_dump(const char_t * path);
+
+#else
+
+#define  TRACE_BEGIN(name)        ((void)0)
+#define  TRACE_END()              ((void)0)
+#define  TRACE_THREAD_NAME(name)  ((void)0)
+#define  TRACE_DUMP(path)         ((void)0)
+
+#endif /* SPHERE_TRACE */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* SPHERE_TRACE_H_ */
+
+/*
+ * Local Variables:
+ * indent-tabs-mode: t
+ * tab-width: 4
+ * End:
+ */